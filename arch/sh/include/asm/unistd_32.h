@@ -374,10 +374,19 @@
 #define __NR_getsockopt    354
 #define __NR_sendmsg       355
 #define __NR_recvmsg       356
-/* #define __NR_recvmmsg   357 - implemented in later kernels */
+#define __NR_recvmmsg      357
 #define __NR_accept4       358
+/*
+ Not defined in STLinux kernel either, see above
+
+#define __NR_name_to_handle_at	359
+#define __NR_open_by_handle_at	360
+#define __NR_clock_adjtime	361
+#define __NR_syncfs		362
+*/
+#define __NR_sendmmsg		363
 
-#define NR_syscalls 359
+#define NR_syscalls 364
 
 #ifdef __KERNEL__
 
@@ -700,7 +700,7 @@ static void __flush_dcache_segment_4way(unsigned long start,
 	} while (a0 < a0e);
 }
 
-extern void __weak sh4__flush_region_init(void);
+extern void __weak sh4__flush_region_init(void (*flush_all)(void));
 
 /*
  * SH-4 has virtually indexed and physically tagged cache.
@@ -748,5 +748,5 @@ void __init sh4_cache_init(void)
 	local_flush_cache_page		= sh4_flush_cache_page;
 	local_flush_cache_range		= sh4_flush_cache_range;
 
-	sh4__flush_region_init();
+	sh4__flush_region_init(flush_dcache_all);
 }
@@ -20,7 +20,7 @@
 #include <asm/uaccess.h>
 #include <asm/mmu_context.h>
 
-extern void __weak sh4__flush_region_init(void);
+extern void __weak sh4__flush_region_init(void (*flush_all)(void));
 
 /* Wired TLB entry for the D-cache */
 static unsigned long long dtlb_cache_slot;
@@ -617,5 +617,5 @@ void __init sh5_cache_init(void)
 	/* Reserve a slot for dcache colouring in the DTLB */
 	dtlb_cache_slot	= sh64_get_wired_dtlb_entry();
 
-	sh4__flush_region_init();
+	sh4__flush_region_init(NULL);
 }
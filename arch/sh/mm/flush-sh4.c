@@ -1,14 +1,52 @@
 #include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <asm/mmu_context.h>
 #include <asm/cacheflush.h>
 
+enum {
+	SH4_FLUSH_WBACK,
+	SH4_FLUSH_PURGE,
+	SH4_FLUSH_INVALIDATE,
+	SH4_FLUSH_NR_OPS,
+};
+
+/*
+ * Rough costs of the two ways of getting a region out of the D-cache,
+ * for a ~450MHz ST40: an ocbwb/ocbp/ocbi on a line, and one movca.l/ocbi
+ * pair of the whole-cache walk.  Only used to seed the thresholds below;
+ * the debugfs benchmark measures the real figures for a given SoC.
+ */
+#define SH4_FLUSH_LINE_NS	10
+#define SH4_FLUSH_ENTRY_NS	20
+
+/*
+ * Whole D-cache flush provided by the CPU cache code, or NULL.
+ */
+static void (*sh4__flush_dcache_all)(void);
+
+/*
+ * Region sizes (in bytes) from which flushing the whole D-cache is
+ * cheaper than walking the region line by line.  ~0 means never.
+ */
+static u32 sh4_flush_threshold[SH4_FLUSH_NR_OPS] = {
+	[0 ... SH4_FLUSH_NR_OPS - 1] = ~0U,
+};
+
+static inline int sh4__flush_use_all(int op, int size)
+{
+	return (u32)size >= sh4_flush_threshold[op];
+}
+
 /*
  * Write back the dirty D-caches, but not invalidate them.
  *
  * START: Virtual Address (U0, P1, or P3)
  * SIZE: Size of the region.
  */
-static void sh4__flush_wback_region(void *start, int size)
+static void sh4__flush_wback_lines(void *start, int size)
 {
 	reg_size_t aligned_start, v, cnt, end;
 
@@ -42,7 +80,7 @@ static void sh4__flush_wback_region(void *start, int size)
  * START: Virtual Address (U0, P1, or P3)
  * SIZE: Size of the region.
  */
-static void sh4__flush_purge_region(void *start, int size)
+static void sh4__flush_purge_lines(void *start, int size)
 {
 	reg_size_t aligned_start, v, cnt, end;
 
@@ -72,7 +110,7 @@ static void sh4__flush_purge_region(void *start, int size)
 /*
  * No write back please
  */
-static void sh4__flush_invalidate_region(void *start, int size)
+static void sh4__flush_invalidate_lines(void *start, int size)
 {
 	reg_size_t aligned_start, v, cnt, end;
 
@@ -100,9 +138,182 @@ static void sh4__flush_invalidate_region(void *start, int size)
 	}
 }
 
-void __init sh4__flush_region_init(void)
+static void sh4__flush_wback_region(void *start, int size)
+{
+	if (sh4__flush_use_all(SH4_FLUSH_WBACK, size))
+		sh4__flush_dcache_all();
+	else
+		sh4__flush_wback_lines(start, size);
+}
+
+static void sh4__flush_purge_region(void *start, int size)
+{
+	if (sh4__flush_use_all(SH4_FLUSH_PURGE, size))
+		sh4__flush_dcache_all();
+	else
+		sh4__flush_purge_lines(start, size);
+}
+
+/*
+ * The whole-cache walk writes back dirty lines rather than dropping
+ * them.  That is harmless for a buffer about to be handed to a device
+ * (SH-3 always purges here), as the DMA overwrites memory afterwards.
+ */
+static void sh4__flush_invalidate_region(void *start, int size)
+{
+	if (sh4__flush_use_all(SH4_FLUSH_INVALIDATE, size))
+		sh4__flush_dcache_all();
+	else
+		sh4__flush_invalidate_lines(start, size);
+}
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * Microbenchmark of the flush strategies, reporting ns/KB for each of
+ * them over a range of region sizes so that the thresholds can be
+ * calibrated for a given SoC.
+ */
+#define SH4_FLUSH_BENCH_ORDER	8
+
+static void (*sh4_flush_bench_lines[SH4_FLUSH_NR_OPS])(void *, int) = {
+	[SH4_FLUSH_WBACK]	= sh4__flush_wback_lines,
+	[SH4_FLUSH_PURGE]	= sh4__flush_purge_lines,
+	[SH4_FLUSH_INVALIDATE]	= sh4__flush_invalidate_lines,
+};
+
+static u64 sh4_flush_bench_one(void (*fn)(void *, int), void *buf, int size)
+{
+	unsigned long flags;
+	ktime_t t0, t1;
+
+	/* Dirty the buffer, as a DMA buffer being handed over would be */
+	memset(buf, 0x5a, size);
+
+	local_irq_save(flags);
+	t0 = ktime_get();
+	if (fn)
+		fn(buf, size);
+	else
+		sh4__flush_dcache_all();
+	t1 = ktime_get();
+	local_irq_restore(flags);
+
+	return ktime_to_ns(ktime_sub(t1, t0));
+}
+
+static int sh4_flush_bench_show(struct seq_file *s, void *v)
+{
+	static const char *names[SH4_FLUSH_NR_OPS] = {
+		[SH4_FLUSH_WBACK]	= "wback",
+		[SH4_FLUSH_PURGE]	= "purge",
+		[SH4_FLUSH_INVALIDATE]	= "invalidate",
+	};
+	u64 line_ns[SH4_FLUSH_NR_OPS], all_ns = 0;
+	int size, max_size = PAGE_SIZE << SH4_FLUSH_BENCH_ORDER;
+	void *buf;
+	int op;
+
+	buf = (void *)__get_free_pages(GFP_KERNEL, SH4_FLUSH_BENCH_ORDER);
+	if (!buf)
+		return -ENOMEM;
+
+	seq_printf(s, "%8s %10s %10s %10s %10s  (ns/KB)\n",
+		   "size", "ocbwb", "ocbp", "ocbi", "all");
+
+	for (size = PAGE_SIZE; size <= max_size; size <<= 2) {
+		seq_printf(s, "%8d", size);
+		for (op = 0; op < SH4_FLUSH_NR_OPS; op++) {
+			line_ns[op] = sh4_flush_bench_one(
+					sh4_flush_bench_lines[op], buf, size);
+			seq_printf(s, " %10llu",
+				   div_u64(line_ns[op] << 10, size));
+		}
+		if (sh4__flush_dcache_all) {
+			all_ns = sh4_flush_bench_one(NULL, buf, size);
+			seq_printf(s, " %10llu\n", div_u64(all_ns << 10, size));
+		} else
+			seq_printf(s, " %10s\n", "-");
+	}
+
+	free_pages((unsigned long)buf, SH4_FLUSH_BENCH_ORDER);
+
+	if (!sh4__flush_dcache_all)
+		return 0;
+
+	/* Break-even sizes, from the largest (least noisy) run */
+	for (op = 0; op < SH4_FLUSH_NR_OPS; op++)
+		seq_printf(s, "suggested %s threshold: %llu (now %u)\n",
+			   names[op], line_ns[op] ?
+			   div64_u64(all_ns * max_size, line_ns[op]) : 0ULL,
+			   sh4_flush_threshold[op]);
+
+	return 0;
+}
+
+static int sh4_flush_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sh4_flush_bench_show, NULL);
+}
+
+static const struct file_operations sh4_flush_bench_fops = {
+	.open		= sh4_flush_bench_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init sh4_flush_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("dcache-flush", sh_debugfs_root);
+	if (!dir || IS_ERR(dir))
+		return -ENOMEM;
+
+	debugfs_create_file("bench", S_IRUSR, dir, NULL,
+			    &sh4_flush_bench_fops);
+
+	if (!sh4__flush_dcache_all)
+		return 0;
+
+	debugfs_create_u32("wback_threshold", S_IRUGO | S_IWUSR, dir,
+			   &sh4_flush_threshold[SH4_FLUSH_WBACK]);
+	debugfs_create_u32("purge_threshold", S_IRUGO | S_IWUSR, dir,
+			   &sh4_flush_threshold[SH4_FLUSH_PURGE]);
+	debugfs_create_u32("invalidate_threshold", S_IRUGO | S_IWUSR, dir,
+			   &sh4_flush_threshold[SH4_FLUSH_INVALIDATE]);
+
+	return 0;
+}
+device_initcall(sh4_flush_debugfs_init);
+#endif /* CONFIG_DEBUG_FS */
+
+/*
+ * FLUSH_ALL is the CPU's whole D-cache flush, if it has one.  On SMP it
+ * would only reach the local cache, so ranges are always done by line.
+ */
+void __init sh4__flush_region_init(void (*flush_all)(void))
 {
 	__flush_wback_region		= sh4__flush_wback_region;
 	__flush_invalidate_region	= sh4__flush_invalidate_region;
 	__flush_purge_region		= sh4__flush_purge_region;
+
+#ifndef CONFIG_SMP
+	if (flush_all) {
+		struct cache_info *dcache = &boot_cpu_data.dcache;
+		u64 all_ns, line_ns_per_kb;
+		int op;
+
+		/* Seed the break-even sizes from the nominal costs */
+		all_ns = (u64)(dcache->ways * dcache->way_size / dcache->linesz)
+			* SH4_FLUSH_ENTRY_NS;
+		line_ns_per_kb = (1024 / L1_CACHE_BYTES) * SH4_FLUSH_LINE_NS;
+
+		for (op = 0; op < SH4_FLUSH_NR_OPS; op++)
+			sh4_flush_threshold[op] =
+				div64_u64(all_ns << 10, line_ns_per_kb);
+
+		sh4__flush_dcache_all = flush_all;
+	}
+#endif
 }
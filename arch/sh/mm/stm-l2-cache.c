@@ -26,6 +26,8 @@
 #include <linux/io.h>
 #include <linux/pm.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <asm/addrspace.h>
 #include <asm/page.h>
 #include <asm/pgtable.h>
@@ -71,6 +73,14 @@ static int stm_l2_n_ways;
 static enum stm_l2_mode stm_l2_current_mode = MODE_BYPASS;
 static DEFINE_SPINLOCK(stm_l2_current_mode_lock);
 
+/* Region sizes (in bytes) from which walking the whole cache by entry
+ * (write back, copy-back mode) or by set (invalidate, write-through
+ * mode) takes fewer register writes than walking the region by address.
+ * Set at probe time to the size of the cache and of one way; tunable
+ * through debugfs. */
+static u32 stm_l2_wback_threshold = ~0U;
+static u32 stm_l2_invalidate_threshold = ~0U;
+
 
 
 /* Performance informations */
@@ -289,6 +299,127 @@ static const struct file_operations stm_l2_perf_counter_fops = {
 
 
 
+/* Flush strategies microbenchmark */
+
+#define STM_L2_FLUSH_BENCH_ORDER 8
+
+static void stm_l2_sync(void);
+static void stm_l2_flush_common(unsigned long start, int size, int is_phys,
+		unsigned int l2reg);
+static void stm_l2_flush_all(unsigned int l2reg);
+
+static struct stm_l2_flush_strategy {
+	unsigned int l2reg;
+	int whole;
+	const char *name;
+} stm_l2_flush_strategies[] = {
+	{ L2FA, 0, "L2FA" },
+	{ L2PA, 0, "L2PA" },
+	{ L2IA, 0, "L2IA" },
+	{ L2FE, 1, "L2FE" },
+	{ L2IS, 1, "L2IS" },
+};
+
+static u64 stm_l2_flush_bench_one(struct stm_l2_flush_strategy *strategy,
+		void *buf, int size)
+{
+	unsigned long flags;
+	ktime_t t0, t1;
+
+	/* Get the buffer dirty in the L2 */
+	memset(buf, 0x5a, size);
+	__flush_purge_region(buf, size);
+
+	spin_lock_irqsave(&stm_l2_current_mode_lock, flags);
+	/* The mode may have been changed under our feet */
+	if (stm_l2_current_mode == MODE_BYPASS || (strategy->l2reg == L2IS &&
+			stm_l2_current_mode != MODE_WRITE_THROUGH)) {
+		spin_unlock_irqrestore(&stm_l2_current_mode_lock, flags);
+		return 0;
+	}
+	t0 = ktime_get();
+	if (strategy->whole)
+		stm_l2_flush_all(strategy->l2reg);
+	else
+		stm_l2_flush_common((unsigned long)buf, size, 0,
+				strategy->l2reg);
+	stm_l2_sync();
+	t1 = ktime_get();
+	spin_unlock_irqrestore(&stm_l2_current_mode_lock, flags);
+
+	return ktime_to_ns(ktime_sub(t1, t0));
+}
+
+static int stm_l2_flush_bench_show(struct seq_file *s, void *v)
+{
+	u64 ns[ARRAY_SIZE(stm_l2_flush_strategies)];
+	int size, max_size = PAGE_SIZE << STM_L2_FLUSH_BENCH_ORDER;
+	int write_through = stm_l2_current_mode == MODE_WRITE_THROUGH;
+	void *buf;
+	int i;
+
+	if (stm_l2_current_mode == MODE_BYPASS) {
+		seq_printf(s, "L2 bypassed\n");
+		return 0;
+	}
+
+	buf = (void *)__get_free_pages(GFP_KERNEL, STM_L2_FLUSH_BENCH_ORDER);
+	if (!buf)
+		return -ENOMEM;
+
+	seq_printf(s, "%8s", "size");
+	for (i = 0; i < ARRAY_SIZE(stm_l2_flush_strategies); i++)
+		seq_printf(s, " %10s", stm_l2_flush_strategies[i].name);
+	seq_printf(s, "  (ns/KB)\n");
+
+	for (size = PAGE_SIZE; size <= max_size; size <<= 2) {
+		seq_printf(s, "%8d", size);
+		for (i = 0; i < ARRAY_SIZE(stm_l2_flush_strategies); i++) {
+			struct stm_l2_flush_strategy *strategy =
+					&stm_l2_flush_strategies[i];
+
+			/* Invalidating the whole cache by set is only safe
+			 * when it holds no dirty data. */
+			if (strategy->l2reg == L2IS && !write_through) {
+				ns[i] = 0;
+				seq_printf(s, " %10s", "-");
+				continue;
+			}
+			ns[i] = stm_l2_flush_bench_one(strategy, buf, size);
+			seq_printf(s, " %10llu", div_u64(ns[i] << 10, size));
+		}
+		seq_printf(s, "\n");
+	}
+
+	free_pages((unsigned long)buf, STM_L2_FLUSH_BENCH_ORDER);
+
+	/* Break-even sizes, from the largest (least noisy) run */
+	seq_printf(s, "suggested wback threshold: %llu (now %u)\n",
+			ns[0] ? div64_u64(ns[3] * max_size, ns[0]) : 0ULL,
+			stm_l2_wback_threshold);
+	if (write_through)
+		seq_printf(s, "suggested invalidate threshold: %llu "
+				"(now %u)\n", ns[2] ?
+				div64_u64(ns[4] * max_size, ns[2]) : 0ULL,
+				stm_l2_invalidate_threshold);
+
+	return 0;
+}
+
+static int stm_l2_flush_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stm_l2_flush_bench_show, NULL);
+}
+
+static const struct file_operations stm_l2_flush_bench_fops = {
+	.open = stm_l2_flush_bench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+
+
 static int __init stm_l2_perf_counters_init(void)
 {
 	struct dentry *dir;
@@ -320,6 +451,13 @@ static int __init stm_l2_perf_counters_init(void)
 				dir, counter, &stm_l2_perf_counter_fops);
 	}
 
+	debugfs_create_file("flush_bench", S_IFREG | S_IRUSR,
+			dir, NULL, &stm_l2_flush_bench_fops);
+	debugfs_create_u32("wback_threshold", S_IRUGO | S_IWUSR,
+			dir, &stm_l2_wback_threshold);
+	debugfs_create_u32("invalidate_threshold", S_IRUGO | S_IWUSR,
+			dir, &stm_l2_invalidate_threshold);
+
 	return 0;
 }
 device_initcall(stm_l2_perf_counters_init);
@@ -421,6 +559,50 @@ static void stm_l2_flush_common(unsigned long start, int size, int is_phys,
 	}
 }
 
+/* Apply an entry- or set-indexed operation to the whole cache */
+static void stm_l2_flush_all(unsigned int l2reg)
+{
+	unsigned long top;
+	unsigned long i;
+
+	top = stm_l2_block_size * stm_l2_n_sets;
+	if (l2reg == L2FE)
+		top *= stm_l2_n_ways;
+
+	/* Ensure L1 writeback is done before starting writeback on L2 */
+	asm volatile("synco"
+			: /* no output */
+			: /* no input */
+			: "memory");
+
+	for (i = 0; i < top; i += stm_l2_block_size)
+		writel(i, stm_l2_base + l2reg);
+}
+
+/* Drop the whole cache, but only while it cannot hold dirty data: in
+ * copy-back mode that would lose other data, and there is no whole-cache
+ * purge, so large regions are still done by address there.  The mode
+ * lock keeps copy-back from being enabled meanwhile; if a mode change is
+ * in progress, just let the caller do it by address. */
+static int stm_l2_invalidate_all_clean(void)
+{
+	unsigned long flags;
+	int done = 0;
+
+	if (!spin_trylock_irqsave(&stm_l2_current_mode_lock, flags))
+		return 0;
+
+	if (stm_l2_current_mode == MODE_WRITE_THROUGH) {
+		stm_l2_flush_all(L2IS);
+		stm_l2_sync();
+		done = 1;
+	}
+
+	spin_unlock_irqrestore(&stm_l2_current_mode_lock, flags);
+
+	return done;
+}
+
 void stm_l2_flush_wback(unsigned long start, int size, int is_phys)
 {
 	if (!stm_l2_base)
@@ -428,7 +610,10 @@ void stm_l2_flush_wback(unsigned long start, int size, int is_phys)
 
 	switch (stm_l2_current_mode) {
 	case MODE_COPY_BACK:
-		stm_l2_flush_common(start, size, is_phys, L2FA);
+		if ((u32)size >= stm_l2_wback_threshold)
+			stm_l2_flush_all(L2FE);
+		else
+			stm_l2_flush_common(start, size, is_phys, L2FA);
 		/* Fall through */
 	case MODE_WRITE_THROUGH:
 		/* Since this is for the purposes of DMA, we have to
@@ -488,8 +673,12 @@ void stm_l2_flush_invalidate(unsigned long start, int size, int is_phys)
 	 * may actually be a non-issue (may be impossible in view of L2
 	 * implementation), or is going to be at least very rare. */
 	switch (stm_l2_current_mode) {
-	case MODE_COPY_BACK:
 	case MODE_WRITE_THROUGH:
+		if ((u32)size >= stm_l2_invalidate_threshold &&
+				stm_l2_invalidate_all_clean())
+			break;
+		/* Fall through */
+	case MODE_COPY_BACK:
 		stm_l2_flush_common(start, size, is_phys, L2IA);
 		stm_l2_sync();
 		break;
@@ -740,6 +929,12 @@ static int __init stm_l2_probe(struct platform_device *pdev)
 	}
 	stm_l2_base = base;
 
+	/* Each address, entry or set operation is a single register write,
+	 * so whole-cache walks pay off once the region is that big. */
+	stm_l2_wback_threshold = stm_l2_block_size * stm_l2_n_sets *
+			stm_l2_n_ways;
+	stm_l2_invalidate_threshold = stm_l2_block_size * stm_l2_n_sets;
+
 	/* Invalidate the L2 */
 	step = stm_l2_block_size;
 	top = step << nsets;
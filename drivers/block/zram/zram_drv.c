@@ -0,0 +1,650 @@
+/*
+ * Compressed RAM block device
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Pages written to /dev/zram<id> are compressed with LZO and kept in
+ * memory allocated with zsmalloc.  Used as a swap device, it lets a
+ * system without backing store page out anonymous memory at the cost
+ * of some CPU time.  Swap frees slots it no longer needs with discard
+ * requests, so the memory is given back as soon as possible.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/bitops.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/device.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/lzo.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* Globals */
+static int zram_major;
+struct zram *zram_devices;
+
+/* Module params (documentation at end) */
+unsigned int zram_num_devices;
+
+static void zram_stat_inc(u32 *v)
+{
+	*v = *v + 1;
+}
+
+static void zram_stat_dec(u32 *v)
+{
+	*v = *v - 1;
+}
+
+static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
+{
+	spin_lock(&zram->stat64_lock);
+	*v = *v + inc;
+	spin_unlock(&zram->stat64_lock);
+}
+
+static void zram_stat64_sub(struct zram *zram, u64 *v, u64 dec)
+{
+	spin_lock(&zram->stat64_lock);
+	*v = *v - dec;
+	spin_unlock(&zram->stat64_lock);
+}
+
+static void zram_stat64_inc(struct zram *zram, u64 *v)
+{
+	zram_stat64_add(zram, v, 1);
+}
+
+u64 zram_stat64_read(struct zram *zram, u64 *v)
+{
+	u64 val;
+
+	spin_lock(&zram->stat64_lock);
+	val = *v;
+	spin_unlock(&zram->stat64_lock);
+
+	return val;
+}
+
+static int zram_test_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
+{
+	return zram->table[index].flags & BIT(flag);
+}
+
+static void zram_set_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
+{
+	zram->table[index].flags |= BIT(flag);
+}
+
+static void zram_clear_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
+{
+	zram->table[index].flags &= ~BIT(flag);
+}
+
+static int page_zero_filled(void *ptr)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	page = (unsigned long *)ptr;
+
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos])
+			return 0;
+	}
+
+	return 1;
+}
+
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	unsigned long handle = zram->table[index].handle;
+	u16 size = zram->table[index].size;
+
+	if (unlikely(!handle)) {
+		/*
+		 * No memory is allocated for zero filled pages.
+		 * Simply clear zero page flag.
+		 */
+		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+			zram_clear_flag(zram, index, ZRAM_ZERO);
+			zram_stat_dec(&zram->stats.pages_zero);
+		}
+		return;
+	}
+
+	zs_free(zram->mem_pool, handle);
+
+	if (size <= good_compress_size)
+		zram_stat_dec(&zram->stats.good_compress);
+	else if (size == PAGE_SIZE)
+		zram_stat_dec(&zram->stats.pages_expand);
+
+	zram_stat64_sub(zram, &zram->stats.compr_size, size);
+	zram_stat_dec(&zram->stats.pages_stored);
+
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
+}
+
+static void handle_zero_page(struct page *page)
+{
+	void *user_mem;
+
+	user_mem = kmap_atomic(page, KM_USER1);
+	memset(user_mem, 0, PAGE_SIZE);
+	kunmap_atomic(user_mem, KM_USER1);
+
+	flush_dcache_page(page);
+}
+
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
+{
+	unsigned long handle = zram->table[index].handle;
+	size_t clen = PAGE_SIZE;
+	unsigned char *cmem, *user_mem;
+	int ret = LZO_E_OK;
+
+	if (!handle) {
+		/* Zero filled, or never written */
+		if (zram_test_flag(zram, index, ZRAM_ZERO))
+			zram_stat64_inc(zram, &zram->stats.zero_hits);
+		handle_zero_page(page);
+		return 0;
+	}
+
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	user_mem = kmap_atomic(page, KM_USER1);
+
+	if (zram->table[index].size == PAGE_SIZE)
+		memcpy(user_mem, cmem, PAGE_SIZE);
+	else
+		ret = lzo1x_decompress_safe(cmem, zram->table[index].size,
+					    user_mem, &clen);
+
+	kunmap_atomic(user_mem, KM_USER1);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret != LZO_E_OK || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return -EIO;
+	}
+
+	flush_dcache_page(page);
+	return 0;
+}
+
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	unsigned long handle;
+	size_t clen;
+	unsigned char *src, *cmem, *user_mem;
+	int ret;
+
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_free_page(zram, index);
+
+	user_mem = kmap_atomic(page, KM_USER1);
+	if (page_zero_filled(user_mem)) {
+		kunmap_atomic(user_mem, KM_USER1);
+		zram_stat_inc(&zram->stats.pages_zero);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+		return 0;
+	}
+
+	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, zram->compress_buffer,
+			       &clen, zram->compress_workmem);
+	kunmap_atomic(user_mem, KM_USER1);
+
+	if (unlikely(ret != LZO_E_OK)) {
+		pr_err("Compression failed! err=%d\n", ret);
+		return -EIO;
+	}
+
+	/* Not worth decompressing on every read: keep the page as it is. */
+	src = zram->compress_buffer;
+	if (unlikely(clen > max_zpage_size)) {
+		clen = PAGE_SIZE;
+		src = NULL;
+	}
+
+	handle = zs_malloc(zram->mem_pool, clen);
+	if (!handle) {
+		pr_info("Error allocating memory for compressed page: %u, size=%zu\n",
+			index, clen);
+		return -ENOMEM;
+	}
+
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	if (src) {
+		memcpy(cmem, src, clen);
+	} else {
+		user_mem = kmap_atomic(page, KM_USER1);
+		memcpy(cmem, user_mem, PAGE_SIZE);
+		kunmap_atomic(user_mem, KM_USER1);
+	}
+	zs_unmap_object(zram->mem_pool, handle);
+
+	zram->table[index].handle = handle;
+	zram->table[index].size = clen;
+
+	/* Update stats */
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (clen <= good_compress_size)
+		zram_stat_inc(&zram->stats.good_compress);
+	else if (clen == PAGE_SIZE)
+		zram_stat_inc(&zram->stats.pages_expand);
+
+	return 0;
+}
+
+/*
+ * Discard: free the pages fully covered by the request.  Partial pages
+ * at either end are left alone, their other sectors may still be live.
+ */
+static void zram_discard(struct zram *zram, struct bio *bio)
+{
+	u64 start = bio->bi_sector;
+	u64 end = start + (bio->bi_size >> SECTOR_SHIFT);
+	u32 index;
+
+	start = (start + SECTORS_PER_PAGE - 1) >> SECTORS_PER_PAGE_SHIFT;
+	end >>= SECTORS_PER_PAGE_SHIFT;
+
+	for (index = start; index < end; index++) {
+		if (!zram->table[index].handle &&
+		    !zram_test_flag(zram, index, ZRAM_ZERO))
+			continue;
+		zram_free_page(zram, index);
+		zram_stat64_inc(zram, &zram->stats.notify_free);
+	}
+}
+
+static int __zram_make_request(struct zram *zram, struct bio *bio, int rw)
+{
+	int i, ret = 0;
+	u32 index;
+	struct bio_vec *bvec;
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		/* Requests are page aligned, see zram_valid_io_request() */
+		if (unlikely(bvec->bv_len != PAGE_SIZE || bvec->bv_offset)) {
+			zram_stat64_inc(zram, &zram->stats.invalid_io);
+			ret = -EINVAL;
+			break;
+		}
+
+		if (rw == READ)
+			ret = zram_read_page(zram, bvec->bv_page, index);
+		else
+			ret = zram_write_page(zram, bvec->bv_page, index);
+
+		if (ret) {
+			if (rw == WRITE)
+				zram_stat64_inc(zram,
+						&zram->stats.failed_writes);
+			break;
+		}
+		index++;
+	}
+
+	return ret;
+}
+
+/*
+ * Check if request is within bounds and page aligned.
+ */
+static inline int zram_valid_io_request(struct zram *zram, struct bio *bio)
+{
+	if (unlikely(
+		(bio->bi_sector >= (zram->disksize >> SECTOR_SHIFT)) ||
+		(bio->bi_sector & (SECTORS_PER_PAGE - 1)) ||
+		(bio->bi_size & (PAGE_SIZE - 1)))) {
+
+		return 0;
+	}
+
+	/* I/O request is valid */
+	return 1;
+}
+
+/*
+ * Handler function for all zram I/O requests.
+ */
+static int zram_make_request(struct request_queue *queue, struct bio *bio)
+{
+	struct zram *zram = queue->queuedata;
+	int rw = bio_rw(bio);
+	int err = -EIO;
+
+	if (rw == READA)
+		rw = READ;
+
+	down_read(&zram->init_lock);
+	if (unlikely(!zram->init_done))
+		goto out;
+
+	if (bio_rw_flagged(bio, BIO_RW_DISCARD)) {
+		if (bio->bi_sector + (bio->bi_size >> SECTOR_SHIFT) >
+		    (zram->disksize >> SECTOR_SHIFT))
+			goto out;
+		down_write(&zram->lock);
+		zram_discard(zram, bio);
+		up_write(&zram->lock);
+		err = 0;
+		goto out;
+	}
+
+	if (!zram_valid_io_request(zram, bio)) {
+		zram_stat64_inc(zram, &zram->stats.invalid_io);
+		goto out;
+	}
+
+	if (rw == READ) {
+		zram_stat64_inc(zram, &zram->stats.num_reads);
+		down_read(&zram->lock);
+		err = __zram_make_request(zram, bio, rw);
+		up_read(&zram->lock);
+	} else {
+		zram_stat64_inc(zram, &zram->stats.num_writes);
+		down_write(&zram->lock);
+		err = __zram_make_request(zram, bio, rw);
+		up_write(&zram->lock);
+	}
+
+out:
+	up_read(&zram->init_lock);
+	bio_endio(bio, err);
+	return 0;
+}
+
+static void __zram_reset_device(struct zram *zram)
+{
+	size_t index;
+
+	zram->init_done = 0;
+
+	/* Free various per-device buffers */
+	kfree(zram->compress_workmem);
+	free_pages((unsigned long)zram->compress_buffer, 1);
+
+	zram->compress_workmem = NULL;
+	zram->compress_buffer = NULL;
+
+	/* Free all pages that are still in this zram device */
+	if (zram->table) {
+		for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+			zram_free_page(zram, index);
+		vfree(zram->table);
+		zram->table = NULL;
+	}
+
+	if (zram->mem_pool) {
+		zs_destroy_pool(zram->mem_pool);
+		zram->mem_pool = NULL;
+	}
+
+	/* Reset stats */
+	memset(&zram->stats, 0, sizeof(zram->stats));
+
+	zram->disksize = 0;
+	set_capacity(zram->disk, 0);
+}
+
+void zram_reset_device(struct zram *zram)
+{
+	down_write(&zram->init_lock);
+	__zram_reset_device(zram);
+	up_write(&zram->init_lock);
+}
+
+/*
+ * Allocate everything the device needs for zram->disksize bytes.
+ * Called with init_lock held for writing.
+ */
+int zram_init_device(struct zram *zram)
+{
+	int ret;
+	size_t num_pages;
+
+	if (zram->init_done)
+		return 0;
+
+	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	if (!zram->compress_workmem) {
+		pr_err("Error allocating compressor working memory!\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	/* lzo1x output may be larger than its input: two pages */
+	zram->compress_buffer =
+		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!zram->compress_buffer) {
+		pr_err("Error allocating compressor buffer space\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	zram->table = vmalloc(num_pages * sizeof(*zram->table));
+	if (!zram->table) {
+		pr_err("Error allocating zram address table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(zram->table, 0, num_pages * sizeof(*zram->table));
+
+	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
+	if (!zram->mem_pool) {
+		pr_err("Error creating memory pool\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
+
+	zram->init_done = 1;
+
+	pr_debug("Initialization done!\n");
+	return 0;
+
+fail:
+	__zram_reset_device(zram);
+	pr_err("Initialization failed: err=%d\n", ret);
+	return ret;
+}
+
+static const struct block_device_operations zram_devops = {
+	.owner = THIS_MODULE
+};
+
+static int create_device(struct zram *zram, int device_id)
+{
+	int ret = 0;
+
+	init_rwsem(&zram->lock);
+	init_rwsem(&zram->init_lock);
+	spin_lock_init(&zram->stat64_lock);
+
+	zram->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!zram->queue) {
+		pr_err("Error allocating disk queue for device %d\n",
+			device_id);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	blk_queue_make_request(zram->queue, zram_make_request);
+	zram->queue->queuedata = zram;
+
+	 /* gendisk structure */
+	zram->disk = alloc_disk(1);
+	if (!zram->disk) {
+		blk_cleanup_queue(zram->queue);
+		pr_warning("Error allocating disk structure for device %d\n",
+			device_id);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	zram->disk->major = zram_major;
+	zram->disk->first_minor = device_id;
+	zram->disk->fops = &zram_devops;
+	zram->disk->queue = zram->queue;
+	zram->disk->private_data = zram;
+	snprintf(zram->disk->disk_name, 16, "zram%d", device_id);
+
+	/* Actual capacity set using sysfs (/sys/block/zram<id>/disksize */
+	set_capacity(zram->disk, 0);
+
+	/*
+	 * To ensure that we always get PAGE_SIZE aligned
+	 * and n*PAGE_SIZED sized I/O requests.
+	 */
+	blk_queue_physical_block_size(zram->disk->queue, PAGE_SIZE);
+	blk_queue_logical_block_size(zram->disk->queue, PAGE_SIZE);
+	blk_queue_io_min(zram->disk->queue, PAGE_SIZE);
+	blk_queue_io_opt(zram->disk->queue, PAGE_SIZE);
+
+	/* Freed swap slots come back as discards */
+	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, zram->disk->queue);
+	blk_queue_max_discard_sectors(zram->disk->queue, UINT_MAX >> 9);
+
+	add_disk(zram->disk);
+
+#ifdef CONFIG_SYSFS
+	ret = sysfs_create_group(&disk_to_dev(zram->disk)->kobj,
+				&zram_disk_attr_group);
+	if (ret < 0) {
+		pr_warning("Error creating sysfs group");
+		goto out_free_disk;
+	}
+#endif
+
+	zram->init_done = 0;
+	return 0;
+
+out_free_disk:
+	del_gendisk(zram->disk);
+	put_disk(zram->disk);
+	blk_cleanup_queue(zram->queue);
+out:
+	return ret;
+}
+
+static void destroy_device(struct zram *zram)
+{
+#ifdef CONFIG_SYSFS
+	sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
+			&zram_disk_attr_group);
+#endif
+
+	if (zram->disk) {
+		del_gendisk(zram->disk);
+		put_disk(zram->disk);
+	}
+
+	if (zram->queue)
+		blk_cleanup_queue(zram->queue);
+}
+
+static int __init zram_init(void)
+{
+	int ret, dev_id;
+
+	if (zram_num_devices > max_num_devices) {
+		pr_warning("Invalid value for num_devices: %u\n",
+				zram_num_devices);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	zram_major = register_blkdev(0, "zram");
+	if (zram_major <= 0) {
+		pr_warning("Unable to get major number\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (!zram_num_devices) {
+		pr_info("num_devices not specified. Using default: 1\n");
+		zram_num_devices = 1;
+	}
+
+	/* Allocate the device array and initialize each one */
+	pr_info("Creating %u devices ...\n", zram_num_devices);
+	zram_devices = kzalloc(zram_num_devices * sizeof(struct zram),
+			       GFP_KERNEL);
+	if (!zram_devices) {
+		ret = -ENOMEM;
+		goto unregister;
+	}
+
+	for (dev_id = 0; dev_id < zram_num_devices; dev_id++) {
+		ret = create_device(&zram_devices[dev_id], dev_id);
+		if (ret)
+			goto free_devices;
+	}
+
+	return 0;
+
+free_devices:
+	while (dev_id)
+		destroy_device(&zram_devices[--dev_id]);
+	kfree(zram_devices);
+unregister:
+	unregister_blkdev(zram_major, "zram");
+out:
+	return ret;
+}
+
+static void __exit zram_exit(void)
+{
+	int i;
+	struct zram *zram;
+
+	for (i = 0; i < zram_num_devices; i++) {
+		zram = &zram_devices[i];
+
+		zram_reset_device(zram);
+		destroy_device(zram);
+	}
+
+	unregister_blkdev(zram_major, "zram");
+
+	kfree(zram_devices);
+	pr_debug("Cleanup done!\n");
+}
+
+module_param_named(num_devices, zram_num_devices, uint, 0);
+MODULE_PARM_DESC(num_devices, "Number of zram devices");
+
+module_init(zram_init);
+module_exit(zram_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed RAM Block Device");
@@ -0,0 +1,413 @@
+/*
+ * Compact allocator for compressed pages
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Objects are rounded up to a multiple of ZS_SIZE_CLASS_DELTA bytes and
+ * carved out of "zspages": groups of up to ZS_MAX_PAGES_PER_ZSPAGE
+ * order-0 pages, each group serving a single size class.  The number of
+ * pages in a zspage is picked per class so that as little as possible
+ * is left over at its end, which means objects may straddle two pages.
+ * Such objects are copied to a per-cpu buffer while they are mapped.
+ *
+ * The pages need not be contiguous and may come from highmem, so an
+ * object is named by a handle (pfn of the first page of its zspage and
+ * object index) and has to be mapped with zs_map_object() to be used.
+ * Free objects are chained through their first word.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+
+#include "zsmalloc.h"
+
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+				 ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage holds at most ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE /
+ * ZS_MIN_ALLOC_SIZE = PAGE_SIZE / 8 objects.  Handles store the object
+ * index plus one, so that no valid handle is 0.
+ */
+#define OBJ_INDEX_BITS		(PAGE_SHIFT - 2)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+
+struct size_class;
+
+struct zspage {
+	struct list_head	list;		/* in size_class->partial */
+	struct size_class	*class;
+	unsigned int		inuse;
+	unsigned int		freeobj;	/* first free object */
+	struct page		*pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	spinlock_t		lock;
+	unsigned int		size;
+	unsigned int		pages_per_zspage;
+	unsigned int		objs_per_zspage;
+	struct list_head	partial;	/* zspages with free objects */
+};
+
+/* Per-cpu state of the object currently mapped. */
+struct mapping_area {
+	char			*buf;		/* for straddling objects */
+	char			*vaddr;		/* kmap_atomic() address */
+	struct page		*pages[2];
+	unsigned int		offset;		/* object offset in pages[0] */
+	unsigned int		size;
+	enum zs_mapmode		mm;
+};
+
+struct zs_pool {
+	const char		*name;
+	gfp_t			flags;
+	atomic_t		pages_allocated;
+	struct mapping_area	*area;		/* per-cpu */
+	struct size_class	size_class[ZS_SIZE_CLASSES];
+};
+
+static unsigned int get_size_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/* Number of pages which wastes the least space at the end of a zspage. */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, used, max_used = 0, best = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		used = (i * PAGE_SIZE / size) * size * 100 / (i * PAGE_SIZE);
+		if (used > max_used) {
+			max_used = used;
+			best = i;
+		}
+	}
+	return best;
+}
+
+static unsigned long obj_to_handle(struct zspage *zspage, unsigned int idx)
+{
+	return (page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS) | (idx + 1);
+}
+
+static struct zspage *handle_to_zspage(unsigned long handle,
+				       unsigned int *idx)
+{
+	struct page *page = pfn_to_page(handle >> OBJ_INDEX_BITS);
+
+	*idx = (handle & OBJ_INDEX_MASK) - 1;
+	return (struct zspage *)page_private(page);
+}
+
+/* The free list link lives in the first word of a free object. */
+static unsigned int *obj_link(struct zspage *zspage, unsigned int idx,
+			      void **vaddr)
+{
+	unsigned long offset = idx * zspage->class->size;
+
+	*vaddr = kmap_atomic(zspage->pages[offset >> PAGE_SHIFT], KM_USER0);
+	return *vaddr + (offset & ~PAGE_MASK);
+}
+
+static unsigned int obj_get_link(struct zspage *zspage, unsigned int idx)
+{
+	unsigned int *link, next;
+	void *vaddr;
+
+	link = obj_link(zspage, idx, &vaddr);
+	next = *link;
+	kunmap_atomic(vaddr, KM_USER0);
+	return next;
+}
+
+static void obj_set_link(struct zspage *zspage, unsigned int idx,
+			 unsigned int next)
+{
+	unsigned int *link;
+	void *vaddr;
+
+	link = obj_link(zspage, idx, &vaddr);
+	*link = next;
+	kunmap_atomic(vaddr, KM_USER0);
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	unsigned int i, nr = zspage->class->pages_per_zspage;
+
+	for (i = 0; i < nr; i++) {
+		if (!zspage->pages[i])
+			break;
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	atomic_sub(i, &pool->pages_allocated);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				   struct size_class *class)
+{
+	struct zspage *zspage;
+	unsigned int i;
+
+	zspage = kzalloc(sizeof(*zspage), pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page = alloc_page(pool->flags);
+
+		if (!page) {
+			free_zspage(pool, zspage);
+			return NULL;
+		}
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+		atomic_inc(&pool->pages_allocated);
+	}
+
+	for (i = 0; i < class->objs_per_zspage; i++)
+		obj_set_link(zspage, i, i + 1);
+	zspage->freeobj = 0;
+
+	return zspage;
+}
+
+/**
+ * zs_malloc - allocate an object from the pool
+ * @pool: pool to allocate from
+ * @size: size of the object, at most PAGE_SIZE
+ *
+ * Returns a handle for the object, or 0 if no memory could be found.
+ * May sleep if the pool flags allow it.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (!zspage)
+			return 0;
+		spin_lock(&class->lock);
+		list_add(&zspage->list, &class->partial);
+	}
+
+	zspage = list_first_entry(&class->partial, struct zspage, list);
+	idx = zspage->freeobj;
+	zspage->freeobj = obj_get_link(zspage, idx);
+	if (++zspage->inuse == class->objs_per_zspage)
+		list_del_init(&zspage->list);
+	spin_unlock(&class->lock);
+
+	return obj_to_handle(zspage, idx);
+}
+
+/**
+ * zs_free - give an object back to the pool
+ * @pool: pool the object was allocated from
+ * @handle: handle returned by zs_malloc()
+ */
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+
+	zspage = handle_to_zspage(handle, &idx);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_set_link(zspage, idx, zspage->freeobj);
+	zspage->freeobj = idx;
+	if (zspage->inuse-- == class->objs_per_zspage)
+		list_add(&zspage->list, &class->partial);
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		spin_unlock(&class->lock);
+		free_zspage(pool, zspage);
+		return;
+	}
+	spin_unlock(&class->lock);
+}
+
+/**
+ * zs_map_object - get a kernel address for an object
+ * @pool: pool the object was allocated from
+ * @handle: handle returned by zs_malloc()
+ * @mm: whether the object will be read, written or both
+ *
+ * The mapping is atomic: nothing may sleep until zs_unmap_object(), and
+ * the KM_USER0 kmap slot is in use meanwhile.  Only one object can be
+ * mapped at a time on a given cpu.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+		    enum zs_mapmode mm)
+{
+	struct mapping_area *area;
+	struct zspage *zspage;
+	unsigned long offset;
+	unsigned int idx, first;
+	char *vaddr;
+
+	zspage = handle_to_zspage(handle, &idx);
+	offset = idx * zspage->class->size;
+
+	area = per_cpu_ptr(pool->area, get_cpu());
+	area->pages[0] = zspage->pages[offset >> PAGE_SHIFT];
+	area->offset = offset & ~PAGE_MASK;
+	area->size = zspage->class->size;
+	area->mm = mm;
+
+	if (area->offset + area->size <= PAGE_SIZE) {
+		area->vaddr = kmap_atomic(area->pages[0], KM_USER0);
+		return area->vaddr + area->offset;
+	}
+
+	/* The object straddles two pages: work on a copy. */
+	area->vaddr = NULL;
+	area->pages[1] = zspage->pages[(offset >> PAGE_SHIFT) + 1];
+	if (mm != ZS_MM_WO) {
+		first = PAGE_SIZE - area->offset;
+		vaddr = kmap_atomic(area->pages[0], KM_USER0);
+		memcpy(area->buf, vaddr + area->offset, first);
+		kunmap_atomic(vaddr, KM_USER0);
+		vaddr = kmap_atomic(area->pages[1], KM_USER0);
+		memcpy(area->buf + first, vaddr, area->size - first);
+		kunmap_atomic(vaddr, KM_USER0);
+	}
+	return area->buf;
+}
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct mapping_area *area;
+	unsigned int first;
+	char *vaddr;
+
+	area = per_cpu_ptr(pool->area, smp_processor_id());
+	if (area->vaddr) {
+		kunmap_atomic(area->vaddr, KM_USER0);
+	} else if (area->mm != ZS_MM_RO) {
+		first = PAGE_SIZE - area->offset;
+		vaddr = kmap_atomic(area->pages[0], KM_USER0);
+		memcpy(vaddr + area->offset, area->buf, first);
+		kunmap_atomic(vaddr, KM_USER0);
+		vaddr = kmap_atomic(area->pages[1], KM_USER0);
+		memcpy(vaddr, area->buf + first, area->size - first);
+		kunmap_atomic(vaddr, KM_USER0);
+	}
+	put_cpu();
+}
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+
+static void zs_free_areas(struct zs_pool *pool)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(pool->area, cpu)->buf);
+	free_percpu(pool->area);
+}
+
+/**
+ * zs_create_pool - create an allocation pool
+ * @name: name of the pool, for messages
+ * @flags: allocation flags for the backing pages, may include
+ *	__GFP_HIGHMEM
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	struct zs_pool *pool;
+	unsigned int i;
+	int cpu;
+
+	BUILD_BUG_ON(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE / ZS_MIN_ALLOC_SIZE
+		     >= (1UL << OBJ_INDEX_BITS));
+	BUILD_BUG_ON(ZS_MIN_ALLOC_SIZE % ZS_SIZE_CLASS_DELTA);
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	pool->area = alloc_percpu(struct mapping_area);
+	if (!pool->area)
+		goto out_free_pool;
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = per_cpu_ptr(pool->area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto out_free_areas;
+	}
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		INIT_LIST_HEAD(&class->partial);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+					 class->size;
+	}
+
+	pool->name = name;
+	pool->flags = flags;
+	atomic_set(&pool->pages_allocated, 0);
+
+	return pool;
+
+out_free_areas:
+	zs_free_areas(pool);
+out_free_pool:
+	kfree(pool);
+	return NULL;
+}
+
+/*
+ * All objects must have been freed: zspages are only tracked while they
+ * have free objects.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	if (atomic_read(&pool->pages_allocated))
+		pr_err("zsmalloc: %s: destroyed with %d pages in use\n",
+		       pool->name, atomic_read(&pool->pages_allocated));
+
+	zs_free_areas(pool);
+	kfree(pool);
+}
@@ -28,6 +28,7 @@
 #include <linux/poll.h>
 #include <linux/ioctl.h>
 #include <linux/wait.h>
+#include <linux/mm.h>
 #include <asm/uaccess.h>
 #include <asm/system.h>
 #include "dmxdev.h"
@@ -58,6 +59,141 @@ static int dvb_dmxdev_buffer_write(struct dvb_ringbuffer *buf,
 	return dvb_ringbuffer_write(buf, src, len);
 }
 
+/*
+ * mmap()ed buffers: the application owns the data between pread and
+ * pwrite, so nothing is ever flushed; what does not fit is dropped and
+ * accounted in the overflow counter. Returns non-zero when the reader
+ * has to be woken up.
+ */
+static int dvb_dmxdev_ring_ready(struct dvb_ringbuffer *buf,
+				 struct dmx_ring *hdr)
+{
+	u32 pread = ACCESS_ONCE(hdr->pread);
+	u32 threshold = ACCESS_ONCE(hdr->threshold);
+	ssize_t avail;
+
+	if (pread >= buf->size)
+		return 1;
+
+	avail = buf->pwrite - pread;
+	if (avail < 0)
+		avail += buf->size;
+
+	threshold = clamp_t(u32, threshold, 1, buf->size - 1);
+
+	return avail >= threshold;
+}
+
+static int dvb_dmxdev_ring_write(struct dvb_ringbuffer *buf,
+				 struct dmx_ring *hdr,
+				 const u8 *buf1, size_t len1,
+				 const u8 *buf2, size_t len2)
+{
+	u32 pread = ACCESS_ONCE(hdr->pread);
+
+	if (!len1 && !len2)
+		return 0;
+
+	/* a bogus index from the application only stalls its own ring */
+	if (pread < buf->size)
+		buf->pread = pread;
+	smp_mb();
+
+	if (len1 + len2 > dvb_ringbuffer_free(buf)) {
+		dprintk("dmxdev: mmap buffer overflow\n");
+		hdr->overflows += len1 + len2;
+		return 1;
+	}
+
+	if (len1)
+		dvb_ringbuffer_write(buf, buf1, len1);
+	if (len2)
+		dvb_ringbuffer_write(buf, buf2, len2);
+
+	/* publish the data before the producer index */
+	smp_wmb();
+	hdr->pwrite = buf->pwrite;
+
+	return dvb_dmxdev_ring_ready(buf, hdr);
+}
+
+/*
+ * Switch the buffer to a vmalloc_user() area (header page + data) and map
+ * it. vmalloc_user() and MAP_SHARED mappings are both SHMLBA aligned, so
+ * the kernel and the user aliases never conflict in the cache.
+ */
+static int dvb_dmxdev_ring_mmap(struct dmxdev *dmxdev,
+				struct dvb_ringbuffer *buf,
+				struct dmxdev_ring *ring,
+				struct vm_area_struct *vma)
+{
+	ssize_t size = buf->size;
+	unsigned long len = PAGE_SIZE + PAGE_ALIGN(size);
+	struct dmx_ring *hdr;
+	void *mem, *oldmem;
+
+	if (!(vma->vm_flags & VM_SHARED) || vma->vm_pgoff ||
+	    vma->vm_end - vma->vm_start != len)
+		return -EINVAL;
+
+	if (ring->mem)
+		return remap_vmalloc_range(vma, ring->mem, 0);
+
+	mem = vmalloc_user(len);
+	if (!mem)
+		return -ENOMEM;
+
+	hdr = mem;
+	hdr->size = size;
+	hdr->data_offset = PAGE_SIZE;
+
+	spin_lock_irq(&dmxdev->lock);
+	if (ring->mem || buf->size != size) {
+		spin_unlock_irq(&dmxdev->lock);
+		vfree(mem);
+		return ring->mem ? remap_vmalloc_range(vma, ring->mem, 0) :
+				   -EBUSY;
+	}
+	oldmem = buf->data;
+	buf->data = mem + PAGE_SIZE;
+	dvb_ringbuffer_reset(buf);
+	ring->mem = mem;
+	ring->hdr = hdr;
+	spin_unlock_irq(&dmxdev->lock);
+
+	vfree(oldmem);
+
+	return remap_vmalloc_range(vma, mem, 0);
+}
+
+static void dvb_dmxdev_buffer_free(struct dmxdev *dmxdev,
+				   struct dvb_ringbuffer *buf,
+				   struct dmxdev_ring *ring)
+{
+	void *mem = ring->mem ? ring->mem : buf->data;
+
+	if (!mem)
+		return;
+
+	mb();
+	spin_lock_irq(&dmxdev->lock);
+	buf->data = NULL;
+	ring->mem = NULL;
+	ring->hdr = NULL;
+	spin_unlock_irq(&dmxdev->lock);
+	vfree(mem);
+}
+
+/* read() is not used along with mmap(), it only reports the errors */
+static ssize_t dvb_dmxdev_ring_read(struct dvb_ringbuffer *src)
+{
+	ssize_t ret = src->error;
+
+	src->error = 0;
+
+	return ret ? ret : -EBUSY;
+}
+
 static ssize_t dvb_dmxdev_buffer_read(struct dvb_ringbuffer *src,
 				      int non_blocking, char __user *buf,
 				      size_t count, loff_t *ppos)
@@ -156,6 +292,8 @@ static int dvb_dvr_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 		}
 		dvb_ringbuffer_init(&dmxdev->dvr_buffer, mem, DVR_BUFFER_SIZE);
+		dmxdev->dvr_ring.mem = NULL;
+		dmxdev->dvr_ring.hdr = NULL;
 		dvbdev->readers--;
 	}
 
@@ -195,14 +333,8 @@ static int dvb_dvr_release(struct inode *inode, struct file *file)
 	}
 	if ((file->f_flags & O_ACCMODE) == O_RDONLY) {
 		dvbdev->readers++;
-		if (dmxdev->dvr_buffer.data) {
-			void *mem = dmxdev->dvr_buffer.data;
-			mb();
-			spin_lock_irq(&dmxdev->lock);
-			dmxdev->dvr_buffer.data = NULL;
-			spin_unlock_irq(&dmxdev->lock);
-			vfree(mem);
-		}
+		dvb_dmxdev_buffer_free(dmxdev, &dmxdev->dvr_buffer,
+				       &dmxdev->dvr_ring);
 	}
 	/* TODO */
 	dvbdev->users--;
@@ -249,6 +381,9 @@ static ssize_t dvb_dvr_read(struct file *file, char __user *buf, size_t count,
 	if (dmxdev->exit)
 		return -ENODEV;
 
+	if (dmxdev->dvr_ring.hdr)
+		return dvb_dmxdev_ring_read(&dmxdev->dvr_buffer);
+
 	return dvb_dmxdev_buffer_read(&dmxdev->dvr_buffer,
 				      file->f_flags & O_NONBLOCK,
 				      buf, count, ppos);
@@ -267,6 +402,8 @@ static int dvb_dvr_set_buffer_size(struct dmxdev *dmxdev,
 		return 0;
 	if (!size)
 		return -EINVAL;
+	if (dmxdev->dvr_ring.mem)
+		return -EBUSY;
 
 	newmem = vmalloc(size);
 	if (!newmem)
@@ -306,7 +443,7 @@ static int dvb_dmxdev_set_buffer_size(struct dmxdev_filter *dmxdevfilter,
 		return 0;
 	if (!size)
 		return -EINVAL;
-	if (dmxdevfilter->state >= DMXDEV_STATE_GO)
+	if (dmxdevfilter->state >= DMXDEV_STATE_GO || dmxdevfilter->ring.mem)
 		return -EBUSY;
 
 	newmem = vmalloc(size);
@@ -359,7 +496,7 @@ static int dvb_dmxdev_section_callback(const u8 *buffer1, size_t buffer1_len,
 				       enum dmx_success success)
 {
 	struct dmxdev_filter *dmxdevfilter = filter->priv;
-	int ret;
+	int ret, wake = 1;
 
 	if (dmxdevfilter->buffer.error) {
 		wake_up(&dmxdevfilter->buffer.queue);
@@ -374,6 +511,13 @@ static int dvb_dmxdev_section_callback(const u8 *buffer1, size_t buffer1_len,
 	dprintk("dmxdev: section callback %02x %02x %02x %02x %02x %02x\n",
 		buffer1[0], buffer1[1],
 		buffer1[2], buffer1[3], buffer1[4], buffer1[5]);
+	if (dmxdevfilter->ring.hdr) {
+		wake = dvb_dmxdev_ring_write(&dmxdevfilter->buffer,
+					     dmxdevfilter->ring.hdr,
+					     buffer1, buffer1_len,
+					     buffer2, buffer2_len);
+		goto out;
+	}
 	ret = dvb_dmxdev_buffer_write(&dmxdevfilter->buffer, buffer1,
 				      buffer1_len);
 	if (ret == buffer1_len) {
@@ -384,10 +528,14 @@ static int dvb_dmxdev_section_callback(const u8 *buffer1, size_t buffer1_len,
 		dvb_ringbuffer_flush(&dmxdevfilter->buffer);
 		dmxdevfilter->buffer.error = ret;
 	}
-	if (dmxdevfilter->params.sec.flags & DMX_ONESHOT)
+out:
+	if (dmxdevfilter->params.sec.flags & DMX_ONESHOT) {
 		dmxdevfilter->state = DMXDEV_STATE_DONE;
+		wake = 1;
+	}
 	spin_unlock(&dmxdevfilter->dev->lock);
-	wake_up(&dmxdevfilter->buffer.queue);
+	if (wake)
+		wake_up(&dmxdevfilter->buffer.queue);
 	return 0;
 }
 
@@ -398,6 +546,7 @@ static int dvb_dmxdev_ts_callback(const u8 *buffer1, size_t buffer1_len,
 {
 	struct dmxdev_filter *dmxdevfilter = feed->priv;
 	struct dvb_ringbuffer *buffer;
+	struct dmx_ring *ring;
 	int ret;
 
 	spin_lock(&dmxdevfilter->dev->lock);
@@ -407,10 +556,21 @@ static int dvb_dmxdev_ts_callback(const u8 *buffer1, size_t buffer1_len,
 	}
 
 	if (dmxdevfilter->params.pes.output == DMX_OUT_TAP
-	    || dmxdevfilter->params.pes.output == DMX_OUT_TSDEMUX_TAP)
+	    || dmxdevfilter->params.pes.output == DMX_OUT_TSDEMUX_TAP) {
 		buffer = &dmxdevfilter->buffer;
-	else
+		ring = dmxdevfilter->ring.hdr;
+	} else {
 		buffer = &dmxdevfilter->dev->dvr_buffer;
+		ring = dmxdevfilter->dev->dvr_ring.hdr;
+	}
+	if (ring) {
+		ret = dvb_dmxdev_ring_write(buffer, ring, buffer1, buffer1_len,
+					    buffer2, buffer2_len);
+		spin_unlock(&dmxdevfilter->dev->lock);
+		if (ret)
+			wake_up(&buffer->queue);
+		return 0;
+	}
 	if (buffer->error) {
 		spin_unlock(&dmxdevfilter->dev->lock);
 		wake_up(&buffer->queue);
@@ -637,7 +797,9 @@ static int dvb_dmxdev_filter_start(struct dmxdev_filter *filter)
 		spin_unlock_irq(&filter->dev->lock);
 	}
 
-	dvb_ringbuffer_flush(&filter->buffer);
+	/* the data of a mapped buffer belong to the application */
+	if (!filter->ring.hdr)
+		dvb_ringbuffer_flush(&filter->buffer);
 
 	switch (filter->type) {
 	case DMXDEV_TYPE_SEC:
@@ -759,6 +921,8 @@ static int dvb_demux_open(struct inode *inode, struct file *file)
 	file->private_data = dmxdevfilter;
 
 	dvb_ringbuffer_init(&dmxdevfilter->buffer, NULL, 8192);
+	dmxdevfilter->ring.mem = NULL;
+	dmxdevfilter->ring.hdr = NULL;
 	dmxdevfilter->type = DMXDEV_TYPE_NONE;
 	dvb_dmxdev_filter_state_set(dmxdevfilter, DMXDEV_STATE_ALLOCATED);
 	init_timer(&dmxdevfilter->timer);
@@ -778,14 +942,8 @@ static int dvb_dmxdev_filter_free(struct dmxdev *dmxdev,
 	dvb_dmxdev_filter_stop(dmxdevfilter);
 	dvb_dmxdev_filter_reset(dmxdevfilter);
 
-	if (dmxdevfilter->buffer.data) {
-		void *mem = dmxdevfilter->buffer.data;
-
-		spin_lock_irq(&dmxdev->lock);
-		dmxdevfilter->buffer.data = NULL;
-		spin_unlock_irq(&dmxdev->lock);
-		vfree(mem);
-	}
+	dvb_dmxdev_buffer_free(dmxdev, &dmxdevfilter->buffer,
+			       &dmxdevfilter->ring);
 
 	dvb_dmxdev_filter_state_set(dmxdevfilter, DMXDEV_STATE_FREE);
 	wake_up(&dmxdevfilter->buffer.queue);
@@ -952,7 +1110,9 @@ dvb_demux_read(struct file *file, char __user *buf, size_t count,
 	if (mutex_lock_interruptible(&dmxdevfilter->mutex))
 		return -ERESTARTSYS;
 
-	if (dmxdevfilter->type == DMXDEV_TYPE_SEC)
+	if (dmxdevfilter->ring.hdr)
+		ret = dvb_dmxdev_ring_read(&dmxdevfilter->buffer);
+	else if (dmxdevfilter->type == DMXDEV_TYPE_SEC)
 		ret = dvb_dmxdev_read_sec(dmxdevfilter, file, buf, count, ppos);
 	else
 		ret = dvb_dmxdev_buffer_read(&dmxdevfilter->buffer,
@@ -1108,12 +1268,24 @@ static unsigned int dvb_demux_poll(struct file *file, poll_table *wait)
 	if (dmxdevfilter->buffer.error)
 		mask |= (POLLIN | POLLRDNORM | POLLPRI | POLLERR);
 
-	if (!dvb_ringbuffer_empty(&dmxdevfilter->buffer))
+	if (dmxdevfilter->ring.hdr) {
+		if (dvb_dmxdev_ring_ready(&dmxdevfilter->buffer,
+					  dmxdevfilter->ring.hdr))
+			mask |= (POLLIN | POLLRDNORM | POLLPRI);
+	} else if (!dvb_ringbuffer_empty(&dmxdevfilter->buffer))
 		mask |= (POLLIN | POLLRDNORM | POLLPRI);
 
 	return mask;
 }
 
+static int dvb_demux_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct dmxdev_filter *dmxdevfilter = file->private_data;
+
+	return dvb_dmxdev_ring_mmap(dmxdevfilter->dev, &dmxdevfilter->buffer,
+				    &dmxdevfilter->ring, vma);
+}
+
 static int dvb_demux_release(struct inode *inode, struct file *file)
 {
 	struct dmxdev_filter *dmxdevfilter = file->private_data;
@@ -1143,6 +1315,7 @@ static const struct file_operations dvb_demux_fops = {
 	.open = dvb_demux_open,
 	.release = dvb_demux_release,
 	.poll = dvb_demux_poll,
+	.mmap = dvb_demux_mmap,
 };
 
 static struct dvb_device dvbdev_demux = {
@@ -1196,7 +1369,11 @@ static unsigned int dvb_dvr_poll(struct file *file, poll_table *wait)
 		if (dmxdev->dvr_buffer.error)
 			mask |= (POLLIN | POLLRDNORM | POLLPRI | POLLERR);
 
-		if (!dvb_ringbuffer_empty(&dmxdev->dvr_buffer))
+		if (dmxdev->dvr_ring.hdr) {
+			if (dvb_dmxdev_ring_ready(&dmxdev->dvr_buffer,
+						  dmxdev->dvr_ring.hdr))
+				mask |= (POLLIN | POLLRDNORM | POLLPRI);
+		} else if (!dvb_ringbuffer_empty(&dmxdev->dvr_buffer))
 			mask |= (POLLIN | POLLRDNORM | POLLPRI);
 	} else
 		mask |= (POLLOUT | POLLWRNORM | POLLPRI);
@@ -1204,6 +1381,18 @@ static unsigned int dvb_dvr_poll(struct file *file, poll_table *wait)
 	return mask;
 }
 
+static int dvb_dvr_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct dvb_device *dvbdev = file->private_data;
+	struct dmxdev *dmxdev = dvbdev->priv;
+
+	if ((file->f_flags & O_ACCMODE) != O_RDONLY)
+		return -EINVAL;
+
+	return dvb_dmxdev_ring_mmap(dmxdev, &dmxdev->dvr_buffer,
+				    &dmxdev->dvr_ring, vma);
+}
+
 static const struct file_operations dvb_dvr_fops = {
 	.owner = THIS_MODULE,
 	.read = dvb_dvr_read,
@@ -1212,6 +1401,7 @@ static const struct file_operations dvb_dvr_fops = {
 	.open = dvb_dvr_open,
 	.release = dvb_dvr_release,
 	.poll = dvb_dvr_poll,
+	.mmap = dvb_dvr_mmap,
 };
 
 static struct dvb_device dvbdev_dvr = {
@@ -1247,6 +1437,8 @@ int dvb_dmxdev_init(struct dmxdev *dmxdev, struct dvb_adapter *dvb_adapter)
 			    dmxdev, DVB_DEVICE_DVR);
 
 	dvb_ringbuffer_init(&dmxdev->dvr_buffer, NULL, 8192);
+	dmxdev->dvr_ring.mem = NULL;
+	dmxdev->dvr_ring.hdr = NULL;
 
 	return 0;
 }
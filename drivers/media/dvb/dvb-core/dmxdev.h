@@ -53,6 +53,12 @@ enum dmxdev_state {
 	DMXDEV_STATE_TIMEDOUT
 };
 
+/* buffer shared with userspace through mmap() (see struct dmx_ring) */
+struct dmxdev_ring {
+	struct dmx_ring *hdr;	/* first page of the mapping */
+	void *mem;		/* vmalloc_user() area: header page + data */
+};
+
 struct dmxdev_feed {
 	u16 pid;
 	struct dmx_ts_feed *ts;
@@ -79,6 +85,7 @@ struct dmxdev_filter {
 	enum dmxdev_state state;
 	struct dmxdev *dev;
 	struct dvb_ringbuffer buffer;
+	struct dmxdev_ring ring;
 
 	struct mutex mutex;
 
@@ -104,6 +111,7 @@ struct dmxdev {
 	struct dmx_frontend *dvr_orig_fe;
 
 	struct dvb_ringbuffer dvr_buffer;
+	struct dmxdev_ring dvr_ring;
 #define DVR_BUFFER_SIZE (10*188*1024)
 
 	struct mutex mutex;
@@ -122,6 +122,44 @@ static inline int dvb_dmx_swfilter_payload(struct dvb_demux_feed *feed,
 	return feed->cb.ts(&buf[p], count, NULL, 0, &feed->feed.ts, DMX_OK);
 }
 
+/*
+ * Match the section against all the compiled filters of the feed, four
+ * bytes at a time; the section header is loaded once for all of them.
+ */
+static int dvb_dmx_swfilter_secmatch(struct dvb_demux_feed *feed)
+{
+	struct dmx_section_feed *sec = &feed->feed.sec;
+	struct dvb_demux_secmatch *m = feed->secmatch;
+	struct dvb_demux_secmatch *end = m + feed->nsecmatch;
+	u32 hdr[DVB_DEMUX_MASK_WORDS];
+	u32 xor, neq;
+	int i;
+
+	hdr[DVB_DEMUX_MASK_WORDS - 1] = 0;
+	memcpy(hdr, sec->secbuf, min_t(int, sec->seclen, DVB_DEMUX_MASK_MAX));
+	if (sec->seclen < DVB_DEMUX_MASK_MAX)
+		memset((u8 *)hdr + sec->seclen, 0,
+		       DVB_DEMUX_MASK_MAX - sec->seclen);
+
+	for (; m < end && sec->is_filtering; m++) {
+		neq = 0;
+		for (i = 0; i < DVB_DEMUX_MASK_WORDS; i++) {
+			xor = m->value[i] ^ hdr[i];
+			if (m->maskandmode[i] & xor)
+				break;
+			neq |= m->maskandnotmode[i] & xor;
+		}
+		if (i < DVB_DEMUX_MASK_WORDS || (m->doneq && !neq))
+			continue;
+
+		if (feed->cb.sec(sec->secbuf, sec->seclen, NULL, 0,
+				 &m->filter->filter, DMX_OK) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 static int dvb_dmx_swfilter_sectionfilter(struct dvb_demux_feed *feed,
 					  struct dvb_demux_filter *f)
 {
@@ -144,9 +182,40 @@ static int dvb_dmx_swfilter_sectionfilter(struct dvb_demux_feed *feed,
 			    NULL, 0, &f->filter, DMX_OK);
 }
 
-static inline int dvb_dmx_swfilter_section_feed(struct dvb_demux_feed *feed)
+/*
+ * Feeds on the same PID see the same section out of the same TS packet:
+ * the CRC is computed by the first one and the result is reused by the
+ * others. The key also includes the length and the CRC field.
+ */
+static u32 dvb_dmx_section_crc(struct dvb_demux_feed *feed)
 {
 	struct dvb_demux *demux = feed->demux;
+	struct dmx_section_feed *sec = &feed->feed.sec;
+	u32 crc_field;
+
+	if (sec->seclen < 4)
+		return demux->check_crc32(feed, sec->secbuf, sec->seclen);
+
+	memcpy(&crc_field, sec->secbuf + sec->seclen - 4, 4);
+
+	if (demux->crc_cache.pkt_seq == demux->pkt_seq &&
+	    demux->crc_cache.pid == feed->pid &&
+	    demux->crc_cache.seclen == sec->seclen &&
+	    demux->crc_cache.crc_field == crc_field)
+		return demux->crc_cache.crc;
+
+	demux->crc_cache.crc = demux->check_crc32(feed, sec->secbuf,
+						  sec->seclen);
+	demux->crc_cache.pkt_seq = demux->pkt_seq;
+	demux->crc_cache.pid = feed->pid;
+	demux->crc_cache.seclen = sec->seclen;
+	demux->crc_cache.crc_field = crc_field;
+
+	return demux->crc_cache.crc;
+}
+
+static inline int dvb_dmx_swfilter_section_feed(struct dvb_demux_feed *feed)
+{
 	struct dvb_demux_filter *f = feed->filter;
 	struct dmx_section_feed *sec = &feed->feed.sec;
 	int section_syntax_indicator;
@@ -160,14 +229,19 @@ static inline int dvb_dmx_swfilter_section_feed(struct dvb_demux_feed *feed)
 	if (sec->check_crc) {
 		section_syntax_indicator = ((sec->secbuf[1] & 0x80) != 0);
 		if (section_syntax_indicator &&
-		    demux->check_crc32(feed, sec->secbuf, sec->seclen))
+		    dvb_dmx_section_crc(feed))
 			return -1;
 	}
 
-	do {
-		if (dvb_dmx_swfilter_sectionfilter(feed, f) < 0)
+	if (feed->secmatch) {
+		if (dvb_dmx_swfilter_secmatch(feed) < 0)
 			return -1;
-	} while ((f = f->next) && sec->is_filtering);
+	} else {
+		do {
+			if (dvb_dmx_swfilter_sectionfilter(feed, f) < 0)
+				return -1;
+		} while ((f = f->next) && sec->is_filtering);
+	}
 
 	sec->seclen = 0;
 
@@ -387,6 +461,8 @@ static void dvb_dmx_swfilter_packet(struct dvb_demux *demux, const u8 *buf)
 	u16 pid = ts_pid(buf);
 	int dvr_done = 0;
 
+	demux->pkt_seq++;
+
 	if (dvb_demux_tscheck) {
 		if (!demux->cnt_storage)
 			demux->cnt_storage = vmalloc(MAX_PID + 1);
@@ -417,19 +493,20 @@ static void dvb_dmx_swfilter_packet(struct dvb_demux *demux, const u8 *buf)
 	};
 no_dvb_demux_tscheck:
 
-	list_for_each_entry(feed, &demux->feed_list, list_head) {
-		if ((feed->pid != pid) && (feed->pid != 0x2000))
-			continue;
-
+	for (feed = demux->pid_feed[pid]; feed; feed = feed->pid_next) {
 		/* copy each packet only once to the dvr device, even
 		 * if a PID is in multiple filters (e.g. video + PCR) */
 		if ((DVR_FEED(feed)) && (dvr_done++))
 			continue;
 
-		if (feed->pid == pid)
-			dvb_dmx_swfilter_packet_type(feed, buf);
-		else if (feed->pid == 0x2000)
-			feed->cb.ts(buf, 188, NULL, 0, &feed->feed.ts, DMX_OK);
+		dvb_dmx_swfilter_packet_type(feed, buf);
+	}
+
+	for (feed = demux->pid_feed[DMX_MAX_PID]; feed; feed = feed->pid_next) {
+		if ((DVR_FEED(feed)) && (dvr_done++))
+			continue;
+
+		feed->cb.ts(buf, 188, NULL, 0, &feed->feed.ts, DMX_OK);
 	}
 }
 
@@ -585,16 +662,42 @@ static int dvb_demux_feed_find(struct dvb_demux_feed *feed)
 	return 0;
 }
 
-static void dvb_demux_feed_add(struct dvb_demux_feed *feed)
+/* PID lookup chains, called with demux->lock held */
+static void dvb_demux_pid_link(struct dvb_demux_feed *feed)
+{
+	if (feed->pid <= DMX_MAX_PID) {
+		feed->pid_next = feed->demux->pid_feed[feed->pid];
+		feed->demux->pid_feed[feed->pid] = feed;
+	}
+}
+
+static void dvb_demux_pid_unlink(struct dvb_demux_feed *feed)
+{
+	if (feed->pid <= DMX_MAX_PID) {
+		struct dvb_demux_feed **p = &feed->demux->pid_feed[feed->pid];
+
+		while (*p && *p != feed)
+			p = &(*p)->pid_next;
+		if (*p)
+			*p = feed->pid_next;
+		feed->pid_next = NULL;
+	}
+}
+
+static void dvb_demux_feed_add(struct dvb_demux_feed *feed, u16 pid)
 {
 	spin_lock_irq(&feed->demux->lock);
 	if (dvb_demux_feed_find(feed)) {
-		printk(KERN_ERR "%s: feed already in list (type=%x state=%x pid=%x)\n",
-		       __func__, feed->type, feed->state, feed->pid);
+		/* set() called again: move the feed to its new PID chain */
+		dvb_demux_pid_unlink(feed);
+		feed->pid = pid;
+		dvb_demux_pid_link(feed);
 		goto out;
 	}
 
+	feed->pid = pid;
 	list_add(&feed->list_head, &feed->demux->feed_list);
+	dvb_demux_pid_link(feed);
 out:
 	spin_unlock_irq(&feed->demux->lock);
 }
@@ -609,6 +712,7 @@ static void dvb_demux_feed_del(struct dvb_demux_feed *feed)
 	}
 
 	list_del(&feed->list_head);
+	dvb_demux_pid_unlink(feed);
 out:
 	spin_unlock_irq(&feed->demux->lock);
 }
@@ -642,9 +746,9 @@ static int dmx_ts_feed_set(struct dmx_ts_feed *ts_feed, u16 pid, int ts_type,
 		demux->pids[pes_type] = pid;
 	}
 
-	dvb_demux_feed_add(feed);
+	/* the PID selects the lookup table entry of the feed */
+	dvb_demux_feed_add(feed, pid);
 
-	feed->pid = pid;
 	feed->buffer_size = circular_buffer_size;
 	feed->timeout = timeout;
 	feed->ts_type = ts_type;
@@ -854,9 +958,8 @@ static int dmx_section_feed_set(struct dmx_section_feed *feed,
 	if (mutex_lock_interruptible(&dvbdmx->mutex))
 		return -ERESTARTSYS;
 
-	dvb_demux_feed_add(dvbdmxfeed);
+	dvb_demux_feed_add(dvbdmxfeed, pid);
 
-	dvbdmxfeed->pid = pid;
 	dvbdmxfeed->buffer_size = circular_buffer_size;
 	dvbdmxfeed->feed.sec.check_crc = check_crc;
 
@@ -877,11 +980,16 @@ static int dmx_section_feed_set(struct dmx_section_feed *feed,
 
 static void prepare_secfilters(struct dvb_demux_feed *dvbdmxfeed)
 {
-	int i;
+	int i, n = 0;
 	struct dvb_demux_filter *f;
+	struct dvb_demux_secmatch *m;
 	struct dmx_section_filter *sf;
 	u8 mask, mode, doneq;
 
+	kfree(dvbdmxfeed->secmatch);
+	dvbdmxfeed->secmatch = NULL;
+	dvbdmxfeed->nsecmatch = 0;
+
 	if (!(f = dvbdmxfeed->filter))
 		return;
 	do {
@@ -894,7 +1002,25 @@ static void prepare_secfilters(struct dvb_demux_feed *dvbdmxfeed)
 			doneq |= f->maskandnotmode[i] = mask & ~mode;
 		}
 		f->doneq = doneq ? 1 : 0;
+		n++;
 	} while ((f = f->next));
+
+	/* Without the compiled table, the filters are matched byte-wise */
+	m = kcalloc(n, sizeof(*m), GFP_KERNEL);
+	if (!m)
+		return;
+
+	dvbdmxfeed->secmatch = m;
+	dvbdmxfeed->nsecmatch = n;
+
+	for (f = dvbdmxfeed->filter; f; f = f->next, m++) {
+		memcpy(m->value, f->filter.filter_value, DVB_DEMUX_MASK_MAX);
+		memcpy(m->maskandmode, f->maskandmode, DVB_DEMUX_MASK_MAX);
+		memcpy(m->maskandnotmode, f->maskandnotmode,
+		       DVB_DEMUX_MASK_MAX);
+		m->doneq = f->doneq;
+		m->filter = f;
+	}
 }
 
 static int dmx_section_feed_start_filtering(struct dmx_section_feed *feed)
@@ -1024,6 +1150,8 @@ static int dvbdmx_allocate_section_feed(struct dmx_demux *demux,
 	dvbdmxfeed->feed.sec.tsfeedp = 0;
 	dvbdmxfeed->filter = NULL;
 	dvbdmxfeed->buffer = NULL;
+	dvbdmxfeed->secmatch = NULL;
+	dvbdmxfeed->nsecmatch = 0;
 
 	(*feed) = &dvbdmxfeed->feed.sec;
 	(*feed)->is_filtering = 0;
@@ -1060,6 +1188,10 @@ static int dvbdmx_release_section_feed(struct dmx_demux *demux,
 
 	dvb_demux_feed_del(dvbdmxfeed);
 
+	kfree(dvbdmxfeed->secmatch);
+	dvbdmxfeed->secmatch = NULL;
+	dvbdmxfeed->nsecmatch = 0;
+
 	dvbdmxfeed->pid = 0xffff;
 
 	mutex_unlock(&dvbdmx->mutex);
@@ -1209,6 +1341,15 @@ int dvb_dmx_init(struct dvb_demux *dvbdemux)
 		vfree(dvbdemux->filter);
 		return -ENOMEM;
 	}
+	dvbdemux->pid_feed = vmalloc((DMX_MAX_PID + 1) *
+				     sizeof(struct dvb_demux_feed *));
+	if (!dvbdemux->pid_feed) {
+		vfree(dvbdemux->feed);
+		vfree(dvbdemux->filter);
+		return -ENOMEM;
+	}
+	memset(dvbdemux->pid_feed, 0,
+	       (DMX_MAX_PID + 1) * sizeof(struct dvb_demux_feed *));
 	for (i = 0; i < dvbdemux->filternum; i++) {
 		dvbdemux->filter[i].state = DMX_STATE_FREE;
 		dvbdemux->filter[i].index = i;
@@ -1267,6 +1408,7 @@ void dvb_dmx_release(struct dvb_demux *dvbdemux)
 	vfree(dvbdemux->cnt_storage);
 	vfree(dvbdemux->filter);
 	vfree(dvbdemux->feed);
+	vfree(dvbdemux->pid_feed);
 }
 
 EXPORT_SYMBOL(dvb_dmx_release);
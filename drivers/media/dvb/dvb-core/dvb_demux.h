@@ -41,6 +41,7 @@
 #define DMX_STATE_GO        4
 
 #define DVB_DEMUX_MASK_MAX 18
+#define DVB_DEMUX_MASK_WORDS ((DVB_DEMUX_MASK_MAX + 3) / 4)
 
 #define MAX_PID 0x1fff
 
@@ -62,6 +63,15 @@ struct dvb_demux_filter {
 
 #define DMX_FEED_ENTRY(pos) list_entry(pos, struct dvb_demux_feed, list_head)
 
+/* section filter compiled into word-wide masks (see prepare_secfilters) */
+struct dvb_demux_secmatch {
+	u32 value[DVB_DEMUX_MASK_WORDS];
+	u32 maskandmode[DVB_DEMUX_MASK_WORDS];
+	u32 maskandnotmode[DVB_DEMUX_MASK_WORDS];
+	int doneq;
+	struct dvb_demux_filter *filter;
+};
+
 struct dvb_demux_feed {
 	union {
 		struct dmx_ts_feed ts;
@@ -92,7 +102,11 @@ struct dvb_demux_feed {
 
 	u16 peslen;
 
+	struct dvb_demux_secmatch *secmatch;
+	int nsecmatch;
+
 	struct list_head list_head;
+	struct dvb_demux_feed *pid_next;	/* next feed on the same PID */
 	unsigned int index;	/* a unique index for each feed (can be used as hardware pid filter index) */
 };
 
@@ -124,6 +138,8 @@ struct dvb_demux {
 
 #define DMX_MAX_PID 0x2000
 	struct list_head feed_list;
+	/* feeds indexed by PID, entry DMX_MAX_PID holds the full TS feeds */
+	struct dvb_demux_feed **pid_feed;
 	u8 tsbuf[204];
 	int tsbufp;
 
@@ -131,6 +147,17 @@ struct dvb_demux {
 	spinlock_t lock;
 
 	uint8_t *cnt_storage; /* for TS continuity check */
+
+	/* result of the latest section CRC check, shared by the feeds
+	 * which receive the same section from the same TS packet */
+	u32 pkt_seq;
+	struct {
+		u32 pkt_seq;
+		u16 pid;
+		u16 seclen;
+		u32 crc_field;
+		u32 crc;
+	} crc_cache;
 };
 
 int dvb_dmx_init(struct dvb_demux *dvbdemux);
@@ -1714,6 +1714,9 @@ static void afm_erase_cmd(struct mtd_info *mtd, int page)
 static int afm_correct_ecc(struct mtd_info *mtd, unsigned char *buf,
 			   unsigned char *read_ecc, unsigned char *calc_ecc)
 {
+	struct nand_chip *chip = mtd->priv;
+	int status;
+
 	/* No error */
 	if ((read_ecc[0] ^ calc_ecc[0]) == 0 &&
 	    (read_ecc[1] ^ calc_ecc[1]) == 0 &&
@@ -1727,8 +1730,16 @@ static int afm_correct_ecc(struct mtd_info *mtd, unsigned char *buf,
 		return 0;
 
 	/* Use nand_ecc.c:nand_correct_data() function */
-	return nand_correct_data(mtd, buf, read_ecc, calc_ecc);
+	status = nand_correct_data(mtd, buf, read_ecc, calc_ecc);
+	if (status != -1)
+		return status;
+
+	/* Erased page, with a bit stuck at, or drifted to, 0? */
+	status = stm_ecc_check_erased(buf, read_ecc, 3, chip->ecc.size);
+	if (status == E_UN_CHK)
+		return -1;
 
+	return (status == E_NO_CHK) ? 0 : 1;
 }
 
 /* AFM: Read Page and OOB Data with ECC */
@@ -2373,6 +2384,8 @@ static int boot_correct_ecc(struct mtd_info *mtd, unsigned char *buf,
 	int status;
 
 	status = stm_ecc_correct(buf, read_ecc, calc_ecc, ECC_128);
+	if (status == E_UN_CHK)
+		status = stm_ecc_check_erased(buf, read_ecc, 4, ECC_128);
 
 	/* convert to MTD-compatible status */
 	if (status == E_NO_CHK)
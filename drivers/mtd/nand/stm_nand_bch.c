@@ -22,6 +22,7 @@
 #include <linux/device.h>
 #include <linux/platform_device.h>
 #include <linux/dma-mapping.h>
+#include <linux/erased_buf.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
 #include <linux/mtd/partitions.h>
@@ -41,6 +42,14 @@
 #define NANDI_BCH_MAX_BUF_LIST			8
 #define NANDI_BCH_BUF_LIST_SIZE			(4 * NANDI_BCH_MAX_BUF_LIST)
 
+/* Pages per chained sequence (at most NANDI_BCH_MAX_BUF_LIST) */
+#define NANDI_BCH_SEQ_PAGES			4
+
+/* Write nodes would all report their status through the same CHECK slot, so
+ * writes are issued one page per sequence.
+ */
+#define NANDI_BCH_WRITE_SEQ_PAGES		1
+
 /* BCH ECC sizes */
 static int bch_ecc_sizes[] = {
 	[BCH_18BIT_ECC] = 32,
@@ -105,6 +114,15 @@ struct nandi_info {
 	struct	mtd_partition 	*parts;		/* MTD partitions */
 };
 
+/* Chained multi-page sequence, in flight */
+struct bch_seq {
+	int			nr_pages;
+	enum dma_data_direction	dir;
+	dma_addr_t		buf_phys[NANDI_BCH_SEQ_PAGES];
+	dma_addr_t		list_phys;
+	dma_addr_t		prog_phys;
+};
+
 /* NANDi Controller (Hamming/BCH) */
 struct nandi_controller {
 	void __iomem		*base;		/* Controller base*/
@@ -128,6 +146,10 @@ struct nandi_controller {
 	uint8_t			*oob_buf;
 	uint32_t		*buf_list;
 
+	struct bch_prog		*seq_progs;	/* Chained sequence nodes */
+	uint8_t			*seq_buf[2];	/* Double bounce buffers */
+	struct bch_seq		seq;
+
 	int			cached_page;	/* page number of page in
 						 *  'page_buf' */
 
@@ -321,20 +343,43 @@ static uint8_t bch_erase_block(struct nandi_controller *nandi,
 	return status;
 }
 
-/* Attempt to establish if a page is empty (likely to have been erased), while
- * tolerating a number of bits stuck at, or drifted to, 0.
- */
-static int is_page_empty(uint8_t *data, uint32_t page_size, int max_bit_errors)
+/* Returns the number of ECC errors, or '-1' for uncorrectable error */
+static int bch_ecc_score(struct nandi_controller *nandi, uint32_t ecc_err,
+			 uint8_t *buf)
 {
-	int e = 0;
+	uint32_t page_size = nandi->info.mtd.writesize;
 
-	while (page_size--) {
-		e += hweight8(~*data++);
-		if (e > max_bit_errors)
-			return 0;
+	if (ecc_err != 0xff)
+		return (int)ecc_err;
+
+	/* Do we have a genuine uncorrectable ECC error, or is it just an
+	 * erased page?
+	 */
+	if (erased_buf_check(buf, page_size, nandi->sectors_per_page)) {
+		dev_dbg(nandi->dev, "%s: detected uncorrectable error, "
+			"but looks like an erased page\n", __func__);
+		return 0;
 	}
 
-	return 1;
+	return -1;
+}
+
+/* Update MTD ECC stats following a page read */
+static void bch_ecc_stats(struct nandi_controller *nandi, loff_t page_offs,
+			  int ecc_errs)
+{
+	if (ecc_errs < 0) {
+		/* Might be better to break/return here... but we follow
+		 * approach in nand_base.c:do_nand_read_ops()
+		 */
+		dev_err(nandi->dev, "%s: uncorrectable error at 0x%012llx\n",
+			__func__, page_offs);
+		nandi->info.mtd.ecc_stats.failed++;
+	} else if (ecc_errs) {
+		dev_info(nandi->dev, "%s: corrected %u error(s) at "
+			 "0x%012llx\n", __func__, ecc_errs, page_offs);
+		nandi->info.mtd.ecc_stats.corrected += ecc_errs;
+	}
 }
 
 /* Returns the number of ECC errors, or '-1' for uncorrectable error */
@@ -347,7 +392,6 @@ static int bch_read_page(struct nandi_controller *nandi,
 	unsigned long list_phys;
 	unsigned long buf_phys;
 	uint32_t ecc_err;
-	int ret = 0;
 
 	dev_dbg(nandi->dev, "%s: offs = 0x%012llx\n", __func__, offs);
 
@@ -388,22 +432,8 @@ static int bch_read_page(struct nandi_controller *nandi,
 
 	/* Use the maximum per-sector ECC count! */
 	ecc_err = readl(nandi->base + NANDBCH_ECC_SCORE_REG_A) & 0xff;
-	if (ecc_err == 0xff) {
-		/* Do we have a genuine uncorrectable ECC error, or is it just
-		 * an erased page?
-		 */
-		if (is_page_empty(buf, page_size, nandi->sectors_per_page)) {
-			dev_dbg(nandi->dev, "%s: detected uncorrectable error, "
-				"but looks like an erased page\n", __func__);
-			ret = 0;
-		} else {
-			ret = -1;
-		}
-	} else {
-		ret = (int)ecc_err;
-	}
 
-	return ret;
+	return bch_ecc_score(nandi, ecc_err, buf);
 }
 
 /* Returns the status of the NAND device following the write operation */
@@ -454,6 +484,233 @@ static uint8_t bch_write_page(struct nandi_controller *nandi,
 	return status;
 }
 
+/*
+ * Chained multi-page sequences
+ *
+ * Rather than loading one program per page into the sequencer registers, a
+ * chain of program 'nodes' is built in memory and fetched by the controller,
+ * one node per page, with one buffer-list entry per node.  Only the last node
+ * carries GEN_CFG_LAST_SEQ_NODE, and SEQNODESOVER is raised when the whole
+ * chain has completed.  The ECC score of read node 'n' is reported in byte
+ * 'n' of the ECC_SCORE A/B register pair.  The CHECK instruction of a write
+ * node has no such slot index, so write chains are limited to a single node.
+ */
+static void bch_start_seq(struct nandi_controller *nandi,
+			  struct bch_prog *template, loff_t offs,
+			  uint8_t **bufs, int nr_pages,
+			  enum dma_data_direction dir)
+{
+	uint32_t page_size = nandi->info.mtd.writesize;
+	struct bch_seq *seq = &nandi->seq;
+	struct bch_prog *prog;
+	int i;
+
+	dev_dbg(nandi->dev, "%s: %d page(s) @ 0x%012llx\n", __func__,
+		nr_pages, offs);
+
+	BUG_ON(nr_pages < 1 || nr_pages > NANDI_BCH_SEQ_PAGES);
+	BUG_ON(dir == DMA_TO_DEVICE && nr_pages > NANDI_BCH_WRITE_SEQ_PAGES);
+	BUG_ON(offs & (page_size - 1));
+
+	emiss_nandi_select(STM_NANDI_BCH);
+
+	nandi_enable_interrupts(nandi, NANDBCH_INT_SEQNODESOVER);
+	INIT_COMPLETION(nandi->seq_completed);
+
+	if (dir == DMA_FROM_DEVICE) {
+		/* Reset ECC stats */
+		writel(CFG_RESET_ECC_ALL | CFG_ENABLE_AFM,
+		       nandi->base + NANDBCH_CONTROLLER_CFG);
+		writel(CFG_ENABLE_AFM, nandi->base + NANDBCH_CONTROLLER_CFG);
+	}
+
+	memset(nandi->buf_list, 0x00, NANDI_BCH_BUF_LIST_SIZE);
+
+	for (i = 0; i < nr_pages; i++) {
+		BUG_ON((unsigned long)bufs[i] & (NANDI_BCH_DMA_ALIGNMENT - 1));
+
+		prog = &nandi->seq_progs[i];
+		memcpy(prog, template, sizeof(*prog));
+
+		prog->addr = (uint32_t)((offs >> (nandi->page_shift - 8)) &
+					0xffffff00);
+		prog->seq_cfg |= SEQ_CFG_SEQ_IDENT(i);
+		if (dir == DMA_FROM_DEVICE)
+			prog->seq[0] = BCH_ECC_SCORE(i);
+		if (i != nr_pages - 1)
+			prog->gen_cfg &= ~GEN_CFG_LAST_SEQ_NODE;
+
+		seq->buf_phys[i] = dma_map_single(NULL, bufs[i], page_size,
+						  dir);
+		nandi->buf_list[i] = seq->buf_phys[i] |
+			(nandi->sectors_per_page - 1);
+
+		offs += page_size;
+	}
+
+	seq->nr_pages = nr_pages;
+	seq->dir = dir;
+	seq->list_phys = dma_map_single(NULL, nandi->buf_list,
+					NANDI_BCH_BUF_LIST_SIZE,
+					DMA_TO_DEVICE);
+	seq->prog_phys = dma_map_single(NULL, nandi->seq_progs,
+					nr_pages * sizeof(struct bch_prog),
+					DMA_TO_DEVICE);
+
+	writel(seq->list_phys, nandi->base + NANDBCH_BUFFER_LIST_PTR);
+
+	/* Go! */
+	writel(seq->prog_phys, nandi->base + NANDBCH_SEQ_PTR_REG);
+}
+
+static void bch_finish_seq(struct nandi_controller *nandi)
+{
+	uint32_t page_size = nandi->info.mtd.writesize;
+	struct bch_seq *seq = &nandi->seq;
+	int i;
+
+	bch_wait_seq(nandi);
+
+	nandi_disable_interrupts(nandi, NANDBCH_INT_SEQNODESOVER);
+
+	dma_unmap_single(NULL, seq->prog_phys,
+			 seq->nr_pages * sizeof(struct bch_prog),
+			 DMA_TO_DEVICE);
+	dma_unmap_single(NULL, seq->list_phys, NANDI_BCH_BUF_LIST_SIZE,
+			 DMA_TO_DEVICE);
+	for (i = 0; i < seq->nr_pages; i++)
+		dma_unmap_single(NULL, seq->buf_phys[i], page_size, seq->dir);
+}
+
+/* Result byte of sequence node 'n', from register pair 'reg_a'/'reg_a + 4' */
+static uint8_t bch_seq_result(struct nandi_controller *nandi, uint32_t reg_a,
+			      int n)
+{
+	uint32_t val = readl(nandi->base + reg_a + ((n >> 2) << 2));
+
+	return (uint8_t)((val >> ((n & 3) * 8)) & 0xff);
+}
+
+/* Read 'nr_pages' whole pages, NANDI_BCH_SEQ_PAGES per sequence.  When
+ * bouncing, the previous batch is copied out while the next one is being
+ * read.
+ */
+static void bch_read_pages(struct nandi_controller *nandi, loff_t offs,
+			   int nr_pages, uint8_t *buf)
+{
+	uint32_t page_size = nandi->info.mtd.writesize;
+	uint8_t *bufs[NANDI_BCH_SEQ_PAGES];
+	uint8_t *copy_to = NULL;
+	size_t copy_len = 0;
+	int cur = 0;
+	int bounce;
+	int nr;
+	int i;
+
+	if (((unsigned long)buf & (NANDI_BCH_DMA_ALIGNMENT - 1)) ||
+	    !virt_addr_valid(buf)) /* vmalloc'd buffer! */
+		bounce = 1;
+	else
+		bounce = 0;
+
+	while (nr_pages || copy_len) {
+		nr = min(nr_pages, NANDI_BCH_SEQ_PAGES);
+
+		if (nr) {
+			for (i = 0; i < nr; i++)
+				bufs[i] = (bounce ? nandi->seq_buf[cur] : buf) +
+					i * page_size;
+			bch_start_seq(nandi, &bch_prog_read_page, offs,
+				      bufs, nr, DMA_FROM_DEVICE);
+		}
+
+		/* Hand back the previous batch while NAND is busy */
+		if (copy_len) {
+			memcpy(copy_to, nandi->seq_buf[!cur], copy_len);
+			copy_len = 0;
+		}
+
+		if (!nr)
+			break;
+
+		bch_finish_seq(nandi);
+
+		for (i = 0; i < nr; i++) {
+			uint32_t ecc_err = bch_seq_result(nandi,
+						NANDBCH_ECC_SCORE_REG_A, i);
+			bch_ecc_stats(nandi, offs + i * page_size,
+				      bch_ecc_score(nandi, ecc_err, bufs[i]));
+		}
+
+		if (bounce) {
+			copy_to = buf;
+			copy_len = nr * page_size;
+			cur = !cur;
+		}
+
+		offs += nr * page_size;
+		buf += nr * page_size;
+		nr_pages -= nr;
+	}
+}
+
+/* Write 'nr_pages' whole pages, NANDI_BCH_WRITE_SEQ_PAGES per sequence.  When
+ * bouncing, the next batch is copied in while the current one is being
+ * programmed.  Returns the number of pages written before a failure.
+ */
+static int bch_write_pages(struct nandi_controller *nandi, loff_t offs,
+			   int nr_pages, const uint8_t *buf)
+{
+	uint32_t page_size = nandi->info.mtd.writesize;
+	uint8_t *bufs[NANDI_BCH_WRITE_SEQ_PAGES];
+	int done = 0;
+	int cur = 0;
+	int bounce;
+	int nr, next;
+	int i;
+
+	if (((unsigned long)buf & (NANDI_BCH_DMA_ALIGNMENT - 1)) ||
+	    !virt_addr_valid(buf)) /* vmalloc'd buffer! */
+		bounce = 1;
+	else
+		bounce = 0;
+
+	nr = min(nr_pages, NANDI_BCH_WRITE_SEQ_PAGES);
+	if (bounce)
+		memcpy(nandi->seq_buf[cur], buf, nr * page_size);
+
+	while (nr) {
+		for (i = 0; i < nr; i++)
+			bufs[i] = (bounce ? nandi->seq_buf[cur] :
+				   (uint8_t *)buf) + i * page_size;
+		bch_start_seq(nandi, &bch_prog_write_page, offs,
+			      bufs, nr, DMA_TO_DEVICE);
+
+		/* Fill the other buffer while NAND is busy */
+		next = min(nr_pages - nr, NANDI_BCH_WRITE_SEQ_PAGES);
+		if (bounce && next)
+			memcpy(nandi->seq_buf[!cur], buf + nr * page_size,
+			       next * page_size);
+
+		bch_finish_seq(nandi);
+
+		for (i = 0; i < nr; i++) {
+			if (bch_seq_result(nandi, NANDBCH_CHECK_STATUS_REG_A,
+					   i) & NAND_STATUS_FAIL)
+				return done + i;
+		}
+
+		done += nr;
+		offs += nr * page_size;
+		buf += nr * page_size;
+		nr_pages -= nr;
+		nr = next;
+		cur = !cur;
+	}
+
+	return done;
+}
+
 /* Helper function for mtd_read, to handle multi-page or non-aligned reads */
 static int bch_read(struct nandi_controller *nandi,
 		    loff_t from, size_t len,
@@ -466,6 +723,7 @@ static int bch_read(struct nandi_controller *nandi,
 	int page_num;
 	uint32_t col_offs;
 	int ecc_errs;
+	int nr_pages;
 	size_t bytes;
 	uint8_t *p;
 
@@ -484,6 +742,22 @@ static int bch_read(struct nandi_controller *nandi,
 		*retlen = 0;
 
 	while (len > 0) {
+		/* Run of whole pages: chain them */
+		nr_pages = (int)(len >> nandi->page_shift);
+		if (col_offs == 0 && nr_pages > 1 &&
+		    page_num != nandi->cached_page) {
+			bch_read_pages(nandi, page_offs, nr_pages, buf);
+
+			bytes = nr_pages << nandi->page_shift;
+			buf += bytes;
+			len -= bytes;
+			if (retlen)
+				*retlen += bytes;
+			page_offs += bytes;
+			page_num += nr_pages;
+			continue;
+		}
+
 		bytes = min((page_size - col_offs), len);
 
 		if ((bytes != page_size) ||
@@ -499,23 +773,7 @@ static int bch_read(struct nandi_controller *nandi,
 			p = bounce ? nandi->page_buf : buf;
 
 			ecc_errs = bch_read_page(nandi, page_offs, p);
-			if (ecc_errs < 0) {
-				/* Might be better to break/return here... but
-				 * we follow approach in
-				 * nand_base.c:do_nand_read_ops()
-				 */
-				dev_err(nandi->dev, "%s: uncorrectable error "
-					"at 0x%012llx\n", __func__, page_offs);
-				nandi->info.mtd.ecc_stats.failed++;
-			} else {
-				if (ecc_errs) {
-					dev_info(nandi->dev, "%s: corrected %u "
-						 "error(s) at 0x%012llx\n",
-						 __func__, ecc_errs, page_offs);
-					nandi->info.mtd.ecc_stats.corrected +=
-						ecc_errs;
-				}
-			}
+			bch_ecc_stats(nandi, page_offs, ecc_errs);
 
 			if (bounce) {
 				nandi->cached_page = page_num;
@@ -551,8 +809,9 @@ static int bch_write(struct nandi_controller *nandi,
 		     size_t *retlen, const uint8_t *buf)
 {
 	uint32_t page_size = nandi->info.mtd.writesize;
-	int bounce;
-	const uint8_t *p = NULL;
+	int page_num = (int)(to >> nandi->page_shift);
+	int nr_pages = (int)(len >> nandi->page_shift);
+	int done;
 
 	dev_dbg(nandi->dev, "%s: %llu @ 0x%012llx\n", __func__,
 		(unsigned long long)len, to);
@@ -560,36 +819,17 @@ static int bch_write(struct nandi_controller *nandi,
 	BUG_ON(len & (page_size - 1));
 	BUG_ON(to & (page_size - 1));
 
-	if (((unsigned long)buf & (NANDI_BCH_DMA_ALIGNMENT - 1)) ||
-	    !virt_addr_valid(buf)) { /* vmalloc'd buffer! */
-		bounce = 1;
-	} else {
-		bounce = 0;
-	}
-
-	if (retlen)
-		*retlen = 0
-			;
-	while (len > 0) {
-
-		if (bounce) {
-			memcpy(nandi->page_buf, buf, page_size);
-			p = nandi->page_buf;
-			nandi->cached_page = -1;
-		} else {
-			p = buf;
-		}
+	if (nandi->cached_page >= page_num &&
+	    nandi->cached_page < page_num + nr_pages)
+		nandi->cached_page = -1;
 
-		if (bch_write_page(nandi, to, p) & NAND_STATUS_FAIL)
-			return -EIO;
+	done = bch_write_pages(nandi, to, nr_pages, buf);
 
-		to += page_size;
-		buf += page_size;
-		len -= page_size;
+	if (retlen)
+		*retlen = done << nandi->page_shift;
 
-		if (retlen)
-			*retlen += page_size;
-	}
+	if (done != nr_pages)
+		return -EIO;
 
 	return 0;
 }
@@ -2479,6 +2719,12 @@ static int __devinit stm_nand_bch_probe(struct platform_device *pdev)
 	/*	- BCH BUF list */
 	buf_size += NANDI_BCH_BUF_LIST_SIZE + NANDI_BCH_DMA_ALIGNMENT;
 
+	/*	- Chained sequence nodes, and double bounce buffers */
+	buf_size += NANDI_BCH_SEQ_PAGES * sizeof(struct bch_prog) +
+		NANDI_BCH_DMA_ALIGNMENT;
+	buf_size += 2 * NANDI_BCH_SEQ_PAGES * mtd->writesize +
+		NANDI_BCH_DMA_ALIGNMENT;
+
 	/* Allocate bufffer */
 	nandi->buf = devm_kzalloc(&pdev->dev, buf_size, GFP_KERNEL);
 	if (!nandi->buf) {
@@ -2493,6 +2739,14 @@ static int __devinit stm_nand_bch_probe(struct platform_device *pdev)
 				  NANDI_BCH_DMA_ALIGNMENT);
 	nandi->buf_list = (uint32_t *) PTR_ALIGN(bbt_info->bbt + bbt_buf_size,
 						 NANDI_BCH_DMA_ALIGNMENT);
+	nandi->seq_progs = (struct bch_prog *)
+		PTR_ALIGN((uint8_t *)nandi->buf_list + NANDI_BCH_BUF_LIST_SIZE,
+			  NANDI_BCH_DMA_ALIGNMENT);
+	nandi->seq_buf[0] = PTR_ALIGN((uint8_t *)(nandi->seq_progs +
+						  NANDI_BCH_SEQ_PAGES),
+				      NANDI_BCH_DMA_ALIGNMENT);
+	nandi->seq_buf[1] = nandi->seq_buf[0] +
+		NANDI_BCH_SEQ_PAGES * mtd->writesize;
 	nandi->cached_page = -1;
 
 	/* Load Flash-resident BBT */
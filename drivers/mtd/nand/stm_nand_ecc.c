@@ -22,6 +22,8 @@
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/string.h>
+#include <linux/erased_buf.h>
 #include "stm_nand_ecc.h"
 
 static const uint8_t byte_parity_table[] =   /* Parity look up table */
@@ -354,6 +356,41 @@ enum ecc_check stm_ecc_correct(uint8_t *p_data,
 }
 EXPORT_SYMBOL_GPL(stm_ecc_correct);
 
+/******************************************************************************/
+/* Check for an erased block, once ECC correction has failed.
+   "p_data" is a pointer to the data, of "size" bytes.
+   "old_ecc" is the ECC read from flash, of "ecc_bytes" bytes.
+
+   An erased block reads back as 0xff for both data and ECC, but a single bit
+   stuck at, or drifted to, 0 is tolerated (as many as ECC could correct).
+   Returns E_UN_CHK if the block is not erased.  Otherwise, the data is
+   restored to 0xff and E_NO_CHK, E_D1_CHK or E_C1_CHK is returned as for
+   stm_ecc_correct().
+ */
+enum ecc_check stm_ecc_check_erased(uint8_t *p_data,
+				    const uint8_t *old_ecc,
+				    int ecc_bytes,
+				    enum ecc_size size)
+{
+	int ecc_flips, data_flips;
+
+	ecc_flips = erased_buf_bitflips(old_ecc, ecc_bytes, 1);
+	if (ecc_flips < 0)
+		return E_UN_CHK;
+
+	data_flips = erased_buf_bitflips(p_data, size, 1 - ecc_flips);
+	if (data_flips < 0)
+		return E_UN_CHK;
+
+	if (data_flips) {
+		memset(p_data, 0xff, size);
+		return E_D1_CHK;
+	}
+
+	return ecc_flips ? E_C1_CHK : E_NO_CHK;
+}
+EXPORT_SYMBOL_GPL(stm_ecc_check_erased);
+
 /*****************************************************************************
  * The STMicroelectronics ECC engine requires S/W generated LP16 and LP17 bits.
  * The following code segment is based on nand_ecc.c:nand_calculate_ecc(),
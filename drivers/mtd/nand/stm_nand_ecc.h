@@ -145,6 +145,21 @@ enum ecc_check stm_ecc_correct(uint8_t *p_data,
 			       uint8_t *new_ecc,
 			       enum ecc_size size);
 
+/* Check for an erased block, once ECC correction has failed.
+   "p_data" is a pointer to the data, of "size" bytes.
+   "old_ecc" is the ECC read from flash, of "ecc_bytes" bytes.
+
+   An erased block reads back as 0xff for both data and ECC, but a single bit
+   stuck at, or drifted to, 0 is tolerated (as many as ECC could correct).
+   Returns E_UN_CHK if the block is not erased.  Otherwise, the data is
+   restored to 0xff and E_NO_CHK, E_D1_CHK or E_C1_CHK is returned as for
+   stm_ecc_correct().
+ */
+enum ecc_check stm_ecc_check_erased(uint8_t *p_data,
+				    const uint8_t *old_ecc,
+				    int ecc_bytes,
+				    enum ecc_size size);
+
 unsigned char stm_afm_lp1617(const unsigned char *buf);
 
 #endif /* ifndef STM_NAND_ECC_H */
@@ -51,6 +51,7 @@
 #include <linux/slab.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
+#include <linux/mtd/nand_ecc.h>
 #include <linux/dma-mapping.h>
 #include <asm/dma.h>
 #include <linux/clk.h>
@@ -62,6 +63,7 @@
 #include <linux/delay.h>
 
 #include "stm_nand_regs.h"
+#include "stm_nand_ecc.h"
 
 #ifdef CONFIG_MTD_PARTITIONS
 #include <linux/mtd/partitions.h>
@@ -70,7 +72,6 @@
 #define NAME	"stm-nand-flex"
 
 #ifdef CONFIG_STM_NAND_FLEX_BOOTMODESUPPORT
-#include "stm_nand_ecc.h"
 /* NAND_BOOT uses a different ECC scheme to that of NAND_FLEX/NAND_AFM.  In
  * order to support the NAND_BOOT partition we need to maintain 2 sets of
  * ECC-related paramters, and switch depending which partition we wish to
@@ -397,6 +398,25 @@ static int flex_verify_buf(struct mtd_info *mtd, const uint8_t *buf, int len)
 	return ret;
 }
 
+/* S/W ECC correct function, tolerating bit-flips in erased pages */
+static int flex_correct_ecc(struct mtd_info *mtd, unsigned char *buf,
+			    unsigned char *read_ecc, unsigned char *calc_ecc)
+{
+	struct nand_chip *chip = mtd->priv;
+	int status;
+
+	status = nand_correct_data(mtd, buf, read_ecc, calc_ecc);
+	if (status != -1)
+		return status;
+
+	/* Erased page, with a bit stuck at, or drifted to, 0? */
+	status = stm_ecc_check_erased(buf, read_ecc, 3, chip->ecc.size);
+	if (status == E_UN_CHK)
+		return -1;
+
+	return (status == E_NO_CHK) ? 0 : 1;
+}
+
 #ifdef CONFIG_STM_NAND_FLEX_BOOTMODESUPPORT
 /* The STMicroelectronics NAND boot-controller uses 3 bytes ECC per 128-byte
  * data record.  However, the ECC layout clashes with the factory-set bad-block
@@ -494,6 +514,8 @@ int boot_correct_ecc(struct mtd_info *mtd, unsigned char *buf,
 	int status;
 
 	status = stm_ecc_correct(buf, read_ecc, calc_ecc, ECC_128);
+	if (status == E_UN_CHK)
+		status = stm_ecc_check_erased(buf, read_ecc, 4, ECC_128);
 
 	/* convert to MTD-compatible status */
 	if (status == E_NO_CHK)
@@ -1116,6 +1138,9 @@ flex_init_bank(struct stm_nand_flex_controller *flex,
 		goto out2;
 	}
 
+	if (data->chip.ecc.mode == NAND_ECC_SOFT)
+		data->chip.ecc.correct = flex_correct_ecc;
+
 #ifdef CONFIG_STM_NAND_FLEX_BOOTMODESUPPORT
 	if (data->chip.ecc.mode == NAND_ECC_4BITONDIE) {
 		printk(KERN_ERR NAME ": boot-mode ECC not supported on "
@@ -577,6 +577,8 @@ static int attach_by_scanning(struct ubi_device *ubi)
 {
 	int err;
 	struct ubi_scan_info *si;
+	struct ubi_attach_stats *st = &ubi->attach_stats;
+	ktime_t t;
 
 	si = ubi_scan(ubi);
 	if (IS_ERR(si))
@@ -587,17 +589,23 @@ static int attach_by_scanning(struct ubi_device *ubi)
 	ubi->max_ec = si->max_ec;
 	ubi->mean_ec = si->mean_ec;
 
+	t = ktime_get();
 	err = ubi_read_volume_table(ubi, si);
 	if (err)
 		goto out_si;
+	st->vtbl_us = ktime_us_delta(ktime_get(), t);
 
+	t = ktime_get();
 	err = ubi_wl_init_scan(ubi, si);
 	if (err)
 		goto out_vtbl;
+	st->wl_us = ktime_us_delta(ktime_get(), t);
 
+	t = ktime_get();
 	err = ubi_eba_init_scan(ubi, si);
 	if (err)
 		goto out_wl;
+	st->eba_us = ktime_us_delta(ktime_get(), t);
 
 	ubi_scan_destroy_si(si);
 	return 0;
@@ -854,6 +862,7 @@ static int ubi_reboot_notifier(struct notifier_block *n, unsigned long state,
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 	ubi_sync(ubi->ubi_num);
+	ubi_update_fastmap(ubi);
 	return NOTIFY_DONE;
 }
 
@@ -876,6 +885,7 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 {
 	struct ubi_device *ubi;
 	int i, err, do_free = 1;
+	ktime_t start = ktime_get();
 
 	/*
 	 * Check if we already have the same MTD device attached.
@@ -975,18 +985,32 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 			goto out_detach;
 	}
 
+	/*
+	 * The fast attach snapshot is consumed at attach time, write a new one.
+	 * The device works without it, so failing to do so is not fatal.
+	 */
+	err = ubi_update_fastmap(ubi);
+	if (err)
+		ubi_warn("cannot write fast attach snapshot, error %d", err);
+
 	err = uif_init(ubi);
 	if (err)
 		goto out_nofree;
 
+	err = ubi_debugfs_init_dev(ubi);
+	if (err)
+		goto out_uif;
+
 	ubi->bgt_thread = kthread_create(ubi_thread, ubi, ubi->bgt_name);
 	if (IS_ERR(ubi->bgt_thread)) {
 		err = PTR_ERR(ubi->bgt_thread);
 		ubi_err("cannot spawn \"%s\", error %d", ubi->bgt_name,
 			err);
-		goto out_uif;
+		goto out_debugfs;
 	}
 
+	ubi->attach_stats.total_us = ktime_us_delta(ktime_get(), start);
+
 	ubi_msg("attached mtd%d to ubi%d", mtd->index, ubi_num);
 	ubi_msg("MTD device name:            \"%s\"", mtd->name);
 	ubi_msg("MTD device size:            %llu MiB", ubi->flash_size >> 20);
@@ -1003,6 +1027,10 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		ubi->beb_rsvd_pebs);
 	ubi_msg("max/mean erase counter: %d/%d", ubi->max_ec, ubi->mean_ec);
 	ubi_msg("image sequence number: %d", ubi->image_seq);
+	ubi_msg("attached in %lu ms, %d PEBs scanned in %lu ms",
+		ubi->attach_stats.total_us / 1000,
+		ubi->attach_stats.pebs_scanned,
+		ubi->attach_stats.scan_us / 1000);
 
 	/*
 	 * The below lock makes sure we do not race with 'ubi_thread()' which
@@ -1023,6 +1051,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	ubi_notify_all(ubi, UBI_VOLUME_ADDED, NULL);
 	return ubi_num;
 
+out_debugfs:
+	ubi_debugfs_exit_dev(ubi);
 out_uif:
 	uif_close(ubi);
 out_nofree:
@@ -1094,12 +1124,16 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 
+	/* Let the next attach be a fast one */
+	ubi_update_fastmap(ubi);
+
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
 	 * from freeing @ubi object.
 	 */
 	get_device(&ubi->dev);
 
+	ubi_debugfs_exit_dev(ubi);
 	uif_close(ubi);
 	ubi_wl_close(ubi);
 	free_internal_volumes(ubi);
@@ -1182,6 +1216,10 @@ static int __init ubi_init(void)
 	if (!ubi_wl_entry_slab)
 		goto out_dev_unreg;
 
+	err = ubi_debugfs_init();
+	if (err)
+		goto out_slab;
+
 	/* Attach MTD devices */
 	for (i = 0; i < mtd_devs; i++) {
 		struct mtd_dev_param *p = &mtd_dev_param[i];
@@ -1215,6 +1253,8 @@ out_detach:
 			ubi_detach_mtd_dev(ubi_devices[k]->ubi_num, 1);
 			mutex_unlock(&ubi_devices_mutex);
 		}
+	ubi_debugfs_exit();
+out_slab:
 	kmem_cache_destroy(ubi_wl_entry_slab);
 out_dev_unreg:
 	misc_deregister(&ubi_ctrl_cdev);
@@ -1238,6 +1278,7 @@ static void __exit ubi_exit(void)
 			ubi_detach_mtd_dev(ubi_devices[i]->ubi_num, 1);
 			mutex_unlock(&ubi_devices_mutex);
 		}
+	ubi_debugfs_exit();
 	kmem_cache_destroy(ubi_wl_entry_slab);
 	misc_deregister(&ubi_ctrl_cdev);
 	class_remove_file(ubi_class, &ubi_version);
@@ -26,6 +26,9 @@
 
 #ifdef CONFIG_MTD_UBI_DEBUG
 
+#include <linux/debugfs.h>
+#include <linux/math64.h>
+#include <linux/module.h>
 #include "ubi.h"
 
 /**
@@ -228,4 +231,130 @@ out:
 	return;
 }
 
+/*
+ * Root directory for UBI stuff in debugfs. Contains sub-directories which
+ * contain the stuff specific to particular UBI devices.
+ */
+static struct dentry *dfs_rootdir;
+
+/**
+ * ubi_debugfs_init - initialize debugfs file-system.
+ *
+ * UBI uses debugfs file-system to expose various debugging information to
+ * user-space. This function creates "ubi" directory in the debugfs
+ * file-system. Returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+int ubi_debugfs_init(void)
+{
+	dfs_rootdir = debugfs_create_dir("ubi", NULL);
+	if (IS_ERR(dfs_rootdir) || !dfs_rootdir) {
+		int err = dfs_rootdir ? PTR_ERR(dfs_rootdir) : -ENOMEM;
+
+		ubi_err("cannot create \"ubi\" debugfs directory, error %d",
+			err);
+		return err;
+	}
+
+	return 0;
+}
+
+/**
+ * ubi_debugfs_exit - remove the "ubi" directory from debugfs file-system.
+ */
+void ubi_debugfs_exit(void)
+{
+	debugfs_remove(dfs_rootdir);
+}
+
+static int open_debugfs_file(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static ssize_t read_attach_stats(struct file *file, char __user *user_buf,
+				 size_t count, loff_t *ppos)
+{
+	struct ubi_device *ubi = file->private_data;
+	const struct ubi_attach_stats *st = &ubi->attach_stats;
+	unsigned long pebs_per_sec = 0;
+	char buf[320];
+	int len;
+
+	if (st->scan_us)
+		pebs_per_sec = div_u64((u64)st->pebs_scanned * USEC_PER_SEC,
+				       st->scan_us);
+
+	len = snprintf(buf, sizeof(buf),
+		       "attach method:  %s\n"
+		       "PEBs scanned:   %d\n"
+		       "scan:           %lu us\n"
+		       "  header reads: %lu us\n"
+		       "  read stalls:  %lu us\n"
+		       "volume table:   %lu us\n"
+		       "wear-leveling:  %lu us\n"
+		       "EBA:            %lu us\n"
+		       "total:          %lu us\n"
+		       "scan rate:      %lu PEBs/s\n",
+		       st->fast ? "fast attach snapshot" : "full scan",
+		       st->pebs_scanned, st->scan_us, st->read_us,
+		       st->stall_us, st->vtbl_us, st->wl_us, st->eba_us,
+		       st->total_us, pebs_per_sec);
+
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static const struct file_operations dfs_attach_stats_fops = {
+	.open = open_debugfs_file,
+	.read = read_attach_stats,
+	.owner = THIS_MODULE,
+};
+
+/**
+ * ubi_debugfs_init_dev - initialize debugfs for an UBI device.
+ * @ubi: UBI device description object
+ *
+ * This function creates all debugfs files for UBI device @ubi. Returns zero in
+ * case of success and a negative error code in case of failure.
+ */
+int ubi_debugfs_init_dev(struct ubi_device *ubi)
+{
+	int err;
+	const char *fname;
+	struct dentry *dent;
+
+	ubi->dfs_dir = debugfs_create_dir(ubi->ubi_name, dfs_rootdir);
+	if (IS_ERR(ubi->dfs_dir) || !ubi->dfs_dir) {
+		err = ubi->dfs_dir ? PTR_ERR(ubi->dfs_dir) : -ENOMEM;
+		ubi_err("cannot create \"%s\" debugfs directory, error %d",
+			ubi->ubi_name, err);
+		ubi->dfs_dir = NULL;
+		return err;
+	}
+
+	fname = "attach_stats";
+	dent = debugfs_create_file(fname, S_IRUSR, ubi->dfs_dir, ubi,
+				   &dfs_attach_stats_fops);
+	if (IS_ERR(dent) || !dent) {
+		err = dent ? PTR_ERR(dent) : -ENOMEM;
+		ubi_err("cannot create \"%s\" debugfs file, error %d",
+			fname, err);
+		debugfs_remove_recursive(ubi->dfs_dir);
+		ubi->dfs_dir = NULL;
+		return err;
+	}
+
+	return 0;
+}
+
+/**
+ * ubi_debugfs_exit_dev - remove all debugfs files of an UBI device.
+ * @ubi: UBI device description object
+ */
+void ubi_debugfs_exit_dev(struct ubi_device *ubi)
+{
+	debugfs_remove_recursive(ubi->dfs_dir);
+}
+
 #endif /* CONFIG_MTD_UBI_DEBUG */
@@ -0,0 +1,412 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fast attach.
+ *
+ * Attaching an MTD device normally means reading the EC and VID headers of
+ * every physical eraseblock, which takes time proportional to the flash size.
+ * To avoid this, UBI may store a snapshot of its state on the flash media: the
+ * type, erase counter and LEB mapping of every physical eraseblock plus the
+ * volume characteristics which are otherwise collected from the VID headers.
+ *
+ * The snapshot consists of an anchor, which holds &struct ubi_fm_sb and is
+ * always one of the first %UBI_FM_MAX_START physical eraseblocks, and of up to
+ * %UBI_FM_MAX_BLOCKS data blocks. They belong to two internal volumes with the
+ * "delete" compatibility flag, so older UBI implementations simply erase them.
+ * The anchor is written last, so a snapshot is only valid once it is complete.
+ *
+ * The snapshot only describes the flash media correctly as long as nothing it
+ * records as free or used changes. The WL sub-system guarantees this:
+ *   o physical eraseblocks are handed out from a pool which is recorded in the
+ *     snapshot as "to be scanned", and the pool is only refilled when a new
+ *     snapshot is written;
+ *   o erasure of physical eraseblocks which may be recorded as used is
+ *     postponed until a new snapshot is written;
+ *   o the physical eraseblocks the next snapshot will be written to are
+ *     reserved in advance and are recorded as "to be scanned" as well.
+ * So at attach time only the physical eraseblocks recorded as "to be scanned"
+ * have to be read, and a logical eraseblock written after the snapshot was
+ * taken is found there with a higher sequence number than the recorded one.
+ *
+ * The snapshot is consumed at attach time: its anchor is erased and a new
+ * snapshot is written once the device is attached. Whenever something does
+ * not look right, UBI falls back to the full scan.
+ */
+
+#include <linux/crc32.h>
+#include <linux/err.h>
+#include <linux/vmalloc.h>
+#include "ubi.h"
+
+/**
+ * write_block - write one block of the snapshot.
+ * @ubi: UBI device description object
+ * @vid_hdr: VID header buffer to use
+ * @pnum: physical eraseblock to write to
+ * @vol_id: internal volume the block belongs to
+ * @lnum: logical eraseblock number of the block
+ * @buf: data to write
+ * @len: how many bytes to write, aligned to the minimal I/O unit size
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+static int write_block(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr,
+		       int pnum, int vol_id, int lnum, const void *buf, int len)
+{
+	int err;
+
+	vid_hdr->vol_type = UBI_FM_VOLUME_TYPE;
+	vid_hdr->compat = UBI_FM_VOLUME_COMPAT;
+	vid_hdr->vol_id = cpu_to_be32(vol_id);
+	vid_hdr->lnum = cpu_to_be32(lnum);
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
+
+	dbg_gen("write snapshot block %d:%d to PEB %d", vol_id, lnum, pnum);
+	err = ubi_io_write_vid_hdr(ubi, pnum, vid_hdr);
+	if (err)
+		return err;
+
+	return ubi_io_write_data(ubi, buf, pnum, 0, len);
+}
+
+/**
+ * ubi_update_fastmap - write a new fast attach snapshot.
+ * @ubi: UBI device description object
+ *
+ * This function writes a new snapshot of the WL and EBA sub-systems state and
+ * releases the erasures postponed until then. If the snapshot cannot be
+ * written, fast attach is disabled and the device keeps working as usual.
+ * Returns zero in case of success and a negative error code if the snapshot
+ * could not even be attempted.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	int err, i, data_size, block_count, sb_size;
+	struct ubi_fm_update *upd;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_fm_sb *sb;
+
+	mutex_lock(&ubi->fm_mutex);
+	if (!ubi->fm_enabled) {
+		mutex_unlock(&ubi->fm_mutex);
+		return 0;
+	}
+
+	if (ubi->ro_mode) {
+		mutex_unlock(&ubi->fm_mutex);
+		return -EROFS;
+	}
+
+	err = -ENOMEM;
+	upd = kmalloc(sizeof(struct ubi_fm_update), GFP_NOFS);
+	if (!upd)
+		goto out_unlock;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vid_hdr)
+		goto out_free_upd;
+
+	sb_size = ALIGN(UBI_FM_SB_SIZE, ubi->min_io_size);
+	sb = kzalloc(sb_size, GFP_NOFS);
+	if (!sb)
+		goto out_free_vid_hdr;
+
+	upd->pebs = ubi->fm_buf;
+	err = ubi_wl_fm_capture(ubi, upd);
+	if (err)
+		goto out_done;
+
+	data_size = ubi->peb_count * sizeof(struct ubi_fm_peb) +
+		    upd->vol_count * sizeof(struct ubi_fm_volume);
+	block_count = DIV_ROUND_UP(data_size, ubi->leb_size);
+	ubi_assert(block_count < upd->block_cnt);
+
+	for (i = 0; i < block_count; i++) {
+		int len = min_t(int, data_size - i * ubi->leb_size,
+				ubi->leb_size);
+
+		err = write_block(ubi, vid_hdr, upd->blocks[i + 1],
+				  UBI_FM_DATA_VOLUME_ID, i,
+				  ubi->fm_buf + i * ubi->leb_size,
+				  ALIGN(len, ubi->min_io_size));
+		if (err)
+			goto out_done;
+		sb->block_loc[i] = cpu_to_be32(upd->blocks[i + 1]);
+	}
+
+	sb->magic = cpu_to_be32(UBI_FM_SB_MAGIC);
+	sb->version = UBI_FM_FMT_VERSION;
+	sb->peb_count = cpu_to_be32(ubi->peb_count);
+	sb->vol_count = cpu_to_be32(upd->vol_count);
+	sb->data_size = cpu_to_be32(data_size);
+	sb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, ubi->fm_buf,
+					 data_size));
+	sb->block_count = cpu_to_be32(block_count);
+	sb->sqnum = cpu_to_be64(upd->sqnum);
+	sb->hdr_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, sb,
+					UBI_FM_SB_SIZE_CRC));
+
+	err = write_block(ubi, vid_hdr, upd->blocks[0], UBI_FM_SB_VOLUME_ID, 0,
+			  sb, sb_size);
+	if (!err)
+		dbg_gen("snapshot written, anchor PEB %d, %d volumes, "
+			"sqnum %llu", upd->blocks[0], upd->vol_count,
+			upd->sqnum);
+
+out_done:
+	ubi_wl_fm_done(ubi, upd, err);
+	err = 0;
+	kfree(sb);
+out_free_vid_hdr:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+out_free_upd:
+	kfree(upd);
+out_unlock:
+	mutex_unlock(&ubi->fm_mutex);
+	return err;
+}
+
+/**
+ * load_image - read and validate a fast attach snapshot.
+ * @ubi: UBI device description object
+ * @fmi: where to store the snapshot
+ * @anchor: the physical eraseblock holding the snapshot super block
+ * @anchor_sqnum: sequence number of the anchor VID header
+ * @vid_hdr: VID header buffer to use
+ *
+ * This function returns zero in case of success, %1 if the snapshot is
+ * invalid, and a negative error code in case of failure.
+ */
+static int load_image(struct ubi_device *ubi, struct ubi_fm_image *fmi,
+		      int anchor, unsigned long long anchor_sqnum,
+		      struct ubi_vid_hdr *vid_hdr)
+{
+	int err, i, data_size, block_count, vol_count;
+	unsigned long long sqnum;
+	struct ubi_ec_hdr *ech;
+	struct ubi_fm_sb *sb;
+	uint32_t crc;
+
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ech)
+		return -ENOMEM;
+
+	sb = kmalloc(UBI_FM_SB_SIZE, GFP_KERNEL);
+	if (!sb) {
+		err = -ENOMEM;
+		goto out_ech;
+	}
+
+	err = ubi_io_read_ec_hdr(ubi, anchor, ech, 0);
+	if (err < 0)
+		goto out_sb;
+	if ((err && err != UBI_IO_BITFLIPS) || ech->version != UBI_VERSION) {
+		err = 1;
+		goto out_sb;
+	}
+	fmi->anchor = anchor;
+	fmi->anchor_ec = be64_to_cpu(ech->ec);
+	ubi->image_seq = be32_to_cpu(ech->image_seq);
+
+	err = ubi_io_read_data(ubi, sb, anchor, 0, UBI_FM_SB_SIZE);
+	if (err == -EBADMSG) {
+		err = 1;
+		goto out_sb;
+	}
+	if (err && err != UBI_IO_BITFLIPS)
+		goto out_sb;
+
+	err = 1;
+	crc = crc32(UBI_CRC32_INIT, sb, UBI_FM_SB_SIZE_CRC);
+	if (be32_to_cpu(sb->magic) != UBI_FM_SB_MAGIC ||
+	    sb->version != UBI_FM_FMT_VERSION ||
+	    be32_to_cpu(sb->hdr_crc) != crc) {
+		dbg_msg("bad snapshot super block at PEB %d", anchor);
+		goto out_sb;
+	}
+
+	data_size = be32_to_cpu(sb->data_size);
+	block_count = be32_to_cpu(sb->block_count);
+	vol_count = be32_to_cpu(sb->vol_count);
+	sqnum = be64_to_cpu(sb->sqnum);
+	if (be32_to_cpu(sb->peb_count) != ubi->peb_count ||
+	    vol_count < 0 || vol_count > UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT ||
+	    block_count <= 0 || block_count > UBI_FM_MAX_BLOCKS ||
+	    data_size != ubi->peb_count * sizeof(struct ubi_fm_peb) +
+			 vol_count * sizeof(struct ubi_fm_volume) ||
+	    data_size > block_count * ubi->leb_size ||
+	    sqnum >= anchor_sqnum) {
+		ubi_warn("inconsistent snapshot super block at PEB %d",
+			 anchor);
+		goto out_sb;
+	}
+
+	err = -ENOMEM;
+	fmi->buf = vmalloc(block_count * ubi->leb_size);
+	if (!fmi->buf)
+		goto out_sb;
+
+	for (i = 0; i < block_count; i++) {
+		int pnum = be32_to_cpu(sb->block_loc[i]);
+		int len = min_t(int, data_size - i * ubi->leb_size,
+				ubi->leb_size);
+		unsigned long long blk_sqnum;
+
+		err = 1;
+		if (pnum < 0 || pnum >= ubi->peb_count)
+			goto out_buf;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err < 0)
+			goto out_buf;
+		if (err && err != UBI_IO_BITFLIPS) {
+			err = 1;
+			goto out_buf;
+		}
+
+		err = 1;
+		blk_sqnum = be64_to_cpu(vid_hdr->sqnum);
+		if (be32_to_cpu(vid_hdr->vol_id) != UBI_FM_DATA_VOLUME_ID ||
+		    be32_to_cpu(vid_hdr->lnum) != i ||
+		    blk_sqnum <= sqnum || blk_sqnum >= anchor_sqnum) {
+			dbg_msg("stale snapshot block at PEB %d", pnum);
+			goto out_buf;
+		}
+
+		err = ubi_io_read_data(ubi, fmi->buf + i * ubi->leb_size,
+				       pnum, 0, len);
+		if (err == -EBADMSG) {
+			err = 1;
+			goto out_buf;
+		}
+		if (err && err != UBI_IO_BITFLIPS)
+			goto out_buf;
+	}
+
+	err = 1;
+	crc = crc32(UBI_CRC32_INIT, fmi->buf, data_size);
+	if (be32_to_cpu(sb->data_crc) != crc) {
+		ubi_warn("bad snapshot data CRC %#08x, stored %#08x",
+			 crc, be32_to_cpu(sb->data_crc));
+		goto out_buf;
+	}
+
+	fmi->sqnum = sqnum;
+	fmi->peb_count = ubi->peb_count;
+	fmi->vol_count = vol_count;
+	fmi->pebs = fmi->buf;
+	fmi->vols = (struct ubi_fm_volume *)&fmi->pebs[ubi->peb_count];
+	kfree(sb);
+	kfree(ech);
+	return 0;
+
+out_buf:
+	vfree(fmi->buf);
+	fmi->buf = NULL;
+out_sb:
+	kfree(sb);
+out_ech:
+	kfree(ech);
+	return err;
+}
+
+/**
+ * ubi_fm_read - find and read the fast attach snapshot.
+ * @ubi: UBI device description object
+ * @fmi: where to store the snapshot
+ *
+ * This function looks for the most recent snapshot anchor among the first
+ * %UBI_FM_MAX_START physical eraseblocks and reads the snapshot. If the
+ * snapshot turns out to be invalid, all the anchors found are erased, unless
+ * the device is read-only, so that the full scan does not mistake them for
+ * anything else. Returns zero if the snapshot was read, %1 if there is no
+ * usable snapshot, and a negative error code in case of failure. The snapshot
+ * has to be freed with 'ubi_fm_free_image()'.
+ */
+int ubi_fm_read(struct ubi_device *ubi, struct ubi_fm_image *fmi)
+{
+	int err, pnum, i, max_start, anchor = -1, cnt = 0;
+	int found[UBI_FM_MAX_START];
+	unsigned long long sqnum, anchor_sqnum = 0;
+	struct ubi_vid_hdr *vid_hdr;
+
+	memset(fmi, 0, sizeof(struct ubi_fm_image));
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	max_start = min_t(int, UBI_FM_MAX_START, ubi->peb_count);
+	for (pnum = 0; pnum < max_start; pnum++) {
+		cond_resched();
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			goto out_free;
+		if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err < 0)
+			goto out_free;
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+		if (be32_to_cpu(vid_hdr->vol_id) != UBI_FM_SB_VOLUME_ID)
+			continue;
+
+		found[cnt++] = pnum;
+		sqnum = be64_to_cpu(vid_hdr->sqnum);
+		if (anchor == -1 || sqnum > anchor_sqnum) {
+			anchor = pnum;
+			anchor_sqnum = sqnum;
+		}
+	}
+
+	if (anchor == -1) {
+		dbg_msg("no fast attach snapshot found");
+		err = 1;
+		goto out_free;
+	}
+
+	err = load_image(ubi, fmi, anchor, anchor_sqnum, vid_hdr);
+	if (err <= 0)
+		goto out_free;
+
+	ubi_warn("invalid fast attach snapshot at PEB %d, scan the device",
+		 anchor);
+	for (i = 0; i < cnt && !ubi->ro_mode; i++) {
+		err = ubi_io_sync_erase(ubi, found[i], 0);
+		if (err < 0)
+			goto out_free;
+	}
+	ubi->image_seq = 0;
+	err = 1;
+
+out_free:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return err;
+}
+
+/**
+ * ubi_fm_free_image - free a fast attach snapshot read by 'ubi_fm_read()'.
+ * @fmi: the snapshot to free
+ */
+void ubi_fm_free_image(struct ubi_fm_image *fmi)
+{
+	vfree(fmi->buf);
+	fmi->buf = NULL;
+}
@@ -700,28 +700,46 @@ bad:
 int ubi_io_read_ec_hdr(struct ubi_device *ubi, int pnum,
 		       struct ubi_ec_hdr *ec_hdr, int verbose)
 {
-	int err, read_err = 0;
-	uint32_t crc, magic, hdr_crc;
+	int err;
 
 	dbg_io("read EC header from PEB %d", pnum);
 	ubi_assert(pnum >= 0 && pnum < ubi->peb_count);
 
 	err = ubi_io_read(ubi, ec_hdr, pnum, 0, UBI_EC_HDR_SIZE);
-	if (err) {
-		if (err != UBI_IO_BITFLIPS && err != -EBADMSG)
-			return err;
+	if (err && err != UBI_IO_BITFLIPS && err != -EBADMSG)
+		return err;
 
-		/*
-		 * We read all the data, but either a correctable bit-flip
-		 * occurred, or MTD reported about some data integrity error,
-		 * like an ECC error in case of NAND. The former is harmless,
-		 * the later may mean that the read data is corrupted. But we
-		 * have a CRC check-sum and we will detect this. If the EC
-		 * header is still OK, we just report this as there was a
-		 * bit-flip.
-		 */
-		read_err = err;
-	}
+	return ubi_io_check_ec_hdr(ubi, pnum, ec_hdr, err, verbose);
+}
+
+/**
+ * ubi_io_check_ec_hdr - check an erase counter header which has been read.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock the header was read from
+ * @ec_hdr: the erase counter header
+ * @read_err: what 'ubi_io_read()' returned (%0, %UBI_IO_BITFLIPS or
+ *            %-EBADMSG)
+ * @verbose: be verbose if the header is corrupted or was not found
+ *
+ * This function is the checking half of 'ubi_io_read_ec_hdr()', for callers
+ * which read the header themselves, and returns the same codes.
+ */
+int ubi_io_check_ec_hdr(struct ubi_device *ubi, int pnum,
+			struct ubi_ec_hdr *ec_hdr, int read_err, int verbose)
+{
+	int err;
+	uint32_t crc, magic, hdr_crc;
+
+	/*
+	 * All the data were read, but either a correctable bit-flip occurred,
+	 * or MTD reported about some data integrity error, like an ECC error
+	 * in case of NAND. The former is harmless, the later may mean that the
+	 * read data is corrupted. But we have a CRC check-sum and we will
+	 * detect this. If the EC header is still OK, we just report this as
+	 * there was a bit-flip.
+	 */
+	ubi_assert(!read_err || read_err == UBI_IO_BITFLIPS ||
+		   read_err == -EBADMSG);
 
 	magic = be32_to_cpu(ec_hdr->magic);
 	if (magic != UBI_EC_HDR_MAGIC) {
@@ -970,30 +988,65 @@ bad:
 int ubi_io_read_vid_hdr(struct ubi_device *ubi, int pnum,
 			struct ubi_vid_hdr *vid_hdr, int verbose)
 {
-	int err, read_err = 0;
-	uint32_t crc, magic, hdr_crc;
-	void *p;
+	int err;
 
 	dbg_io("read VID header from PEB %d", pnum);
 	ubi_assert(pnum >= 0 &&  pnum < ubi->peb_count);
 
-	p = (char *)vid_hdr - ubi->vid_hdr_shift;
-	err = ubi_io_read(ubi, p, pnum, ubi->vid_hdr_aloffset,
-			  ubi->vid_hdr_alsize);
-	if (err) {
-		if (err != UBI_IO_BITFLIPS && err != -EBADMSG)
-			return err;
+	err = ubi_io_read_vid_hdr_raw(ubi, pnum, vid_hdr);
+	if (err && err != UBI_IO_BITFLIPS && err != -EBADMSG)
+		return err;
 
-		/*
-		 * We read all the data, but either a correctable bit-flip
-		 * occurred, or MTD reported about some data integrity error,
-		 * like an ECC error in case of NAND. The former is harmless,
-		 * the later may mean the read data is corrupted. But we have a
-		 * CRC check-sum and we will identify this. If the VID header is
-		 * still OK, we just report this as there was a bit-flip.
-		 */
-		read_err = err;
-	}
+	return ubi_io_check_vid_hdr(ubi, pnum, vid_hdr, err, verbose);
+}
+
+/**
+ * ubi_io_read_vid_hdr_raw - read a volume identifier header without checking.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock number to read from
+ * @vid_hdr: &struct ubi_vid_hdr object where to store the header
+ *
+ * This function reads the volume identifier header from physical eraseblock
+ * @pnum, and returns what 'ubi_io_read()' returned. The header has to be
+ * checked with 'ubi_io_check_vid_hdr()' afterwards.
+ */
+int ubi_io_read_vid_hdr_raw(struct ubi_device *ubi, int pnum,
+			    struct ubi_vid_hdr *vid_hdr)
+{
+	void *p = (char *)vid_hdr - ubi->vid_hdr_shift;
+
+	return ubi_io_read(ubi, p, pnum, ubi->vid_hdr_aloffset,
+			   ubi->vid_hdr_alsize);
+}
+
+/**
+ * ubi_io_check_vid_hdr - check a volume identifier header which has been read.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock the header was read from
+ * @vid_hdr: the volume identifier header
+ * @read_err: what 'ubi_io_read()' returned (%0, %UBI_IO_BITFLIPS or
+ *            %-EBADMSG)
+ * @verbose: be verbose if the header is corrupted or wasn't found
+ *
+ * This function is the checking half of 'ubi_io_read_vid_hdr()', for callers
+ * which read the header themselves, and returns the same codes.
+ */
+int ubi_io_check_vid_hdr(struct ubi_device *ubi, int pnum,
+			 struct ubi_vid_hdr *vid_hdr, int read_err, int verbose)
+{
+	int err;
+	uint32_t crc, magic, hdr_crc;
+
+	/*
+	 * All the data were read, but either a correctable bit-flip occurred,
+	 * or MTD reported about some data integrity error, like an ECC error
+	 * in case of NAND. The former is harmless, the later may mean the read
+	 * data is corrupted. But we have a CRC check-sum and we will identify
+	 * this. If the VID header is still OK, we just report this as there
+	 * was a bit-flip.
+	 */
+	ubi_assert(!read_err || read_err == UBI_IO_BITFLIPS ||
+		   read_err == -EBADMSG);
 
 	magic = be32_to_cpu(vid_hdr->magic);
 	if (magic != UBI_VID_HDR_MAGIC) {
@@ -43,6 +43,7 @@
 #include <linux/err.h>
 #include <linux/crc32.h>
 #include <linux/math64.h>
+#include <linux/kthread.h>
 #include "ubi.h"
 
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
@@ -51,8 +52,7 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si);
 #define paranoid_check_si(ubi, si) 0
 #endif
 
-/* Temporary variables used during scanning */
-static struct ubi_ec_hdr *ech;
+/* Temporary variable used during scanning */
 static struct ubi_vid_hdr *vidh;
 
 /**
@@ -706,25 +706,302 @@ struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 	return ERR_PTR(-ENOSPC);
 }
 
+/*
+ * How many physical eraseblocks the header read-ahead may be ahead of
+ * scanning.
+ */
+#define SCAN_RA_PEBS 16
+
+/**
+ * struct scan_ra_slot - headers of a physical eraseblock read ahead.
+ * @pnum: physical eraseblock number
+ * @bad: what 'ubi_io_is_bad()' returned
+ * @ec_err: what 'ubi_io_read()' returned for the EC header
+ * @vid_err: what 'ubi_io_read()' returned for the VID header
+ * @vid_read: if the VID header was read
+ * @ec_hdr: the EC header
+ * @vid_hdr: the VID header
+ */
+struct scan_ra_slot {
+	int pnum;
+	int bad;
+	int ec_err;
+	int vid_err;
+	int vid_read;
+	struct ubi_ec_hdr *ec_hdr;
+	struct ubi_vid_hdr *vid_hdr;
+};
+
 /**
- * process_eb - read, check UBI headers, and add them to scanning information.
+ * struct scan_ra - header read-ahead.
  * @ubi: UBI device description object
- * @si: scanning information
+ * @map: bitmap of physical eraseblocks to read, %NULL means all of them
+ * @next: the physical eraseblock to look for the next one to read from
+ * @produced: how many slots were filled
+ * @consumed: how many slots were processed by scanning
+ * @thread: the reader thread, %NULL if the headers are read synchronously
+ * @lock: protects @produced and @consumed
+ * @wait: the reader and scanning wait here for each other
+ * @read_ns: time spent reading the headers
+ * @stall_ns: time scanning waited for the reader
+ * @slots: ring of @SCAN_RA_PEBS slots
+ *
+ * MTD has no asynchronous read interface, so the headers are read by a
+ * separate thread which keeps up to @SCAN_RA_PEBS physical eraseblocks ahead.
+ * Meanwhile scanning checks the headers already read and builds the
+ * scanning information, so the flash is kept busy all the time.
+ */
+struct scan_ra {
+	struct ubi_device *ubi;
+	const unsigned long *map;
+	int next;
+	unsigned int produced;
+	unsigned int consumed;
+	struct task_struct *thread;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	u64 read_ns;
+	u64 stall_ns;
+	struct scan_ra_slot slots[SCAN_RA_PEBS];
+};
+
+/**
+ * ra_next_pnum - find the next physical eraseblock to read ahead.
+ * @ra: header read-ahead
+ *
+ * This function returns the physical eraseblock number or %-1 if there are
+ * no more physical eraseblocks to read.
+ */
+static int ra_next_pnum(struct scan_ra *ra)
+{
+	int pnum = ra->next;
+
+	if (ra->map)
+		pnum = find_next_bit(ra->map, ra->ubi->peb_count, pnum);
+	if (pnum >= ra->ubi->peb_count)
+		return -1;
+	ra->next = pnum + 1;
+	return pnum;
+}
+
+/**
+ * ra_fill - read headers of a physical eraseblock to a slot.
+ * @ra: header read-ahead
+ * @slot: the slot to fill
+ * @pnum: physical eraseblock to read
+ *
+ * The headers are only read, checking them is left to 'process_eb()'. The VID
+ * header is not read if the EC header cannot be read or if the physical
+ * eraseblock looks empty.
+ */
+static void ra_fill(struct scan_ra *ra, struct scan_ra_slot *slot, int pnum)
+{
+	struct ubi_device *ubi = ra->ubi;
+	ktime_t start = ktime_get();
+	int err;
+
+	slot->pnum = pnum;
+	slot->ec_err = slot->vid_err = slot->vid_read = 0;
+	slot->bad = ubi_io_is_bad(ubi, pnum);
+	if (slot->bad)
+		goto out;
+
+	err = ubi_io_read(ubi, slot->ec_hdr, pnum, 0, UBI_EC_HDR_SIZE);
+	slot->ec_err = err;
+	if (err && err != UBI_IO_BITFLIPS && err != -EBADMSG)
+		goto out;
+	if (err != -EBADMSG && be32_to_cpu(slot->ec_hdr->magic) == 0xFFFFFFFF)
+		goto out;
+
+	slot->vid_err = ubi_io_read_vid_hdr_raw(ubi, pnum, slot->vid_hdr);
+	slot->vid_read = 1;
+
+out:
+	ra->read_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static int ra_has_room(struct scan_ra *ra)
+{
+	int ret;
+
+	spin_lock(&ra->lock);
+	ret = ra->produced - ra->consumed < SCAN_RA_PEBS;
+	spin_unlock(&ra->lock);
+	return ret;
+}
+
+static int ra_has_data(struct scan_ra *ra)
+{
+	int ret;
+
+	spin_lock(&ra->lock);
+	ret = ra->produced != ra->consumed;
+	spin_unlock(&ra->lock);
+	return ret;
+}
+
+/**
+ * scan_ra_thread - header read-ahead thread.
+ * @data: header read-ahead
+ */
+static int scan_ra_thread(void *data)
+{
+	struct scan_ra *ra = data;
+	int pnum;
+
+	while ((pnum = ra_next_pnum(ra)) >= 0) {
+		wait_event(ra->wait, ra_has_room(ra) || kthread_should_stop());
+		if (kthread_should_stop())
+			return 0;
+
+		ra_fill(ra, &ra->slots[ra->produced % SCAN_RA_PEBS], pnum);
+
+		spin_lock(&ra->lock);
+		ra->produced += 1;
+		spin_unlock(&ra->lock);
+		wake_up(&ra->wait);
+	}
+
+	/* Everything is read, wait for 'kthread_stop()' */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/**
+ * scan_ra_get - get headers of the next physical eraseblock.
+ * @ra: header read-ahead
  * @pnum: the physical eraseblock number
  *
+ * Physical eraseblocks have to be asked for in the order they are read ahead.
+ * Once the slot has been processed, it has to be given back with
+ * 'scan_ra_put()'.
+ */
+static struct scan_ra_slot *scan_ra_get(struct scan_ra *ra, int pnum)
+{
+	struct scan_ra_slot *slot = &ra->slots[ra->consumed % SCAN_RA_PEBS];
+
+	if (!ra->thread) {
+		ra_fill(ra, slot, pnum);
+		return slot;
+	}
+
+	if (!ra_has_data(ra)) {
+		ktime_t start = ktime_get();
+
+		wait_event(ra->wait, ra_has_data(ra));
+		ra->stall_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
+
+	ubi_assert(slot->pnum == pnum);
+	return slot;
+}
+
+/**
+ * scan_ra_put - give back a slot returned by 'scan_ra_get()'.
+ * @ra: header read-ahead
+ */
+static void scan_ra_put(struct scan_ra *ra)
+{
+	spin_lock(&ra->lock);
+	ra->consumed += 1;
+	spin_unlock(&ra->lock);
+	wake_up(&ra->wait);
+}
+
+/**
+ * scan_ra_stop - stop header read-ahead and account its statistics.
+ * @ra: header read-ahead
+ */
+static void scan_ra_stop(struct scan_ra *ra)
+{
+	struct ubi_device *ubi = ra->ubi;
+	int i;
+
+	if (ra->thread)
+		kthread_stop(ra->thread);
+
+	ubi->attach_stats.pebs_scanned += ra->consumed;
+	ubi->attach_stats.read_us += div_u64(ra->read_ns, NSEC_PER_USEC);
+	ubi->attach_stats.stall_us += div_u64(ra->stall_ns, NSEC_PER_USEC);
+
+	for (i = 0; i < SCAN_RA_PEBS; i++) {
+		kfree(ra->slots[i].ec_hdr);
+		if (ra->slots[i].vid_hdr)
+			ubi_free_vid_hdr(ubi, ra->slots[i].vid_hdr);
+	}
+	kfree(ra);
+}
+
+/**
+ * scan_ra_start - start reading headers ahead.
+ * @ubi: UBI device description object
+ * @map: bitmap of physical eraseblocks to read, %NULL means all of them
+ *
+ * If the reader thread cannot be started, the headers are read synchronously
+ * by 'scan_ra_get()'. This function returns the header read-ahead object or
+ * %NULL if there is no memory.
+ */
+static struct scan_ra *scan_ra_start(struct ubi_device *ubi,
+				     const unsigned long *map)
+{
+	int i;
+	struct scan_ra *ra;
+
+	ra = kzalloc(sizeof(struct scan_ra), GFP_KERNEL);
+	if (!ra)
+		return NULL;
+
+	ra->ubi = ubi;
+	ra->map = map;
+	spin_lock_init(&ra->lock);
+	init_waitqueue_head(&ra->wait);
+	for (i = 0; i < SCAN_RA_PEBS; i++) {
+		ra->slots[i].ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+		ra->slots[i].vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+		if (!ra->slots[i].ec_hdr || !ra->slots[i].vid_hdr) {
+			scan_ra_stop(ra);
+			return NULL;
+		}
+	}
+
+	ra->thread = kthread_run(scan_ra_thread, ra, "ubi_scan%d",
+				 ubi->ubi_num);
+	if (IS_ERR(ra->thread)) {
+		ubi_warn("cannot start header read-ahead, error %d",
+			 (int)PTR_ERR(ra->thread));
+		ra->thread = NULL;
+	}
+
+	return ra;
+}
+
+/**
+ * process_eb - check UBI headers, and add them to scanning information.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @slot: headers of the physical eraseblock, as read by 'ra_fill()'
+ *
  * This function returns a zero if the physical eraseblock was successfully
  * handled and a negative error code in case of failure.
  */
 static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
-		      int pnum)
+		      struct scan_ra_slot *slot)
 {
 	long long uninitialized_var(ec);
 	int err, bitflips = 0, vol_id, ec_corr = 0;
+	int pnum = slot->pnum;
+	struct ubi_ec_hdr *ec_hdr = slot->ec_hdr;
+	struct ubi_vid_hdr *vid_hdr = slot->vid_hdr;
 
 	dbg_bld("scan PEB %d", pnum);
 
 	/* Skip bad physical eraseblocks */
-	err = ubi_io_is_bad(ubi, pnum);
+	err = slot->bad;
 	if (err < 0)
 		return err;
 	else if (err) {
@@ -737,7 +1014,10 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		return 0;
 	}
 
-	err = ubi_io_read_ec_hdr(ubi, pnum, ech, 0);
+	err = slot->ec_err;
+	if (err && err != UBI_IO_BITFLIPS && err != -EBADMSG)
+		return err;
+	err = ubi_io_check_ec_hdr(ubi, pnum, ec_hdr, err, 0);
 	if (err < 0)
 		return err;
 	else if (err == UBI_IO_BITFLIPS)
@@ -761,13 +1041,13 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		int image_seq;
 
 		/* Make sure UBI version is OK */
-		if (ech->version != UBI_VERSION) {
+		if (ec_hdr->version != UBI_VERSION) {
 			ubi_err("this UBI version is %d, image version is %d",
-				UBI_VERSION, (int)ech->version);
+				UBI_VERSION, (int)ec_hdr->version);
 			return -EINVAL;
 		}
 
-		ec = be64_to_cpu(ech->ec);
+		ec = be64_to_cpu(ec_hdr->ec);
 		if (ec > UBI_MAX_ERASECOUNTER) {
 			/*
 			 * Erase counter overflow. The EC headers have 64 bits
@@ -778,7 +1058,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 			 */
 			ubi_err("erase counter overflow, max is %d",
 				UBI_MAX_ERASECOUNTER);
-			ubi_dbg_dump_ec_hdr(ech);
+			ubi_dbg_dump_ec_hdr(ec_hdr);
 			return -EINVAL;
 		}
 
@@ -793,21 +1073,28 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		 * sequence number, while other PEBs have non-zero sequence
 		 * number.
 		 */
-		image_seq = be32_to_cpu(ech->image_seq);
+		image_seq = be32_to_cpu(ec_hdr->image_seq);
 		if (!ubi->image_seq && image_seq)
 			ubi->image_seq = image_seq;
 		if (ubi->image_seq && image_seq &&
 		    ubi->image_seq != image_seq) {
 			ubi_err("bad image sequence number %d in PEB %d, "
 				"expected %d", image_seq, pnum, ubi->image_seq);
-			ubi_dbg_dump_ec_hdr(ech);
+			ubi_dbg_dump_ec_hdr(ec_hdr);
 			return -EINVAL;
 		}
 	}
 
 	/* OK, we've done with the EC header, let's look at the VID header */
 
-	err = ubi_io_read_vid_hdr(ubi, pnum, vidh, 0);
+	if (!slot->vid_read)
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+	else if (slot->vid_err && slot->vid_err != UBI_IO_BITFLIPS &&
+		 slot->vid_err != -EBADMSG)
+		err = slot->vid_err;
+	else
+		err = ubi_io_check_vid_hdr(ubi, pnum, vid_hdr, slot->vid_err,
+					   0);
 	if (err < 0)
 		return err;
 	else if (err == UBI_IO_BITFLIPS)
@@ -827,12 +1114,23 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		goto adjust_mean_ec;
 	}
 
-	vol_id = be32_to_cpu(vidh->vol_id);
+	vol_id = be32_to_cpu(vid_hdr->vol_id);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (vol_id == UBI_FM_SB_VOLUME_ID || vol_id == UBI_FM_DATA_VOLUME_ID) {
+		/* A block of an old fast attach snapshot */
+		dbg_bld("snapshot block %d:%d at PEB %d", vol_id,
+			be32_to_cpu(vid_hdr->lnum), pnum);
+		err = add_to_list(si, pnum, ec, &si->erase);
+		if (err)
+			return err;
+		goto adjust_mean_ec;
+	}
+#endif
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
-		int lnum = be32_to_cpu(vidh->lnum);
+		int lnum = be32_to_cpu(vid_hdr->lnum);
 
 		/* Unsupported internal volume */
-		switch (vidh->compat) {
+		switch (vid_hdr->compat) {
 		case UBI_COMPAT_DELETE:
 			ubi_msg("\"delete\" compatible internal volume %d:%d"
 				" found, remove it", vol_id, lnum);
@@ -867,7 +1165,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 	if (ec_corr)
 		ubi_warn("valid VID header but corrupted EC header at PEB %d",
 			 pnum);
-	err = ubi_scan_add_used(ubi, si, pnum, ec, vidh, bitflips);
+	err = ubi_scan_add_used(ubi, si, pnum, ec, vid_hdr, bitflips);
 	if (err)
 		return err;
 
@@ -885,23 +1183,18 @@ adjust_mean_ec:
 }
 
 /**
- * ubi_scan - scan an MTD device.
- * @ubi: UBI device description object
+ * alloc_si - allocate scanning information.
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it. In case of failure, an error code is returned.
+ * This function returns a pointer to the allocated scanning information
+ * object or %NULL in case of failure.
  */
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+static struct ubi_scan_info *alloc_si(void)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_scan_volume *sv;
-	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
 	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
 	if (!si)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	INIT_LIST_HEAD(&si->corr);
 	INIT_LIST_HEAD(&si->free);
@@ -909,23 +1202,251 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	INIT_LIST_HEAD(&si->alien);
 	si->volumes = RB_ROOT;
 	si->is_empty = 1;
+	return si;
+}
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * fm_vol_idx - get the index of a volume record in the snapshot lookup table.
+ * @vol_id: volume ID
+ *
+ * This function returns the index or %-1 if the volume ID is not valid.
+ */
+static int fm_vol_idx(int vol_id)
+{
+	if (vol_id == UBI_LAYOUT_VOLUME_ID)
+		return UBI_MAX_VOLUMES;
+	if (vol_id >= 0 && vol_id < UBI_MAX_VOLUMES)
+		return vol_id;
+	return -1;
+}
+
+/**
+ * scan_fast - build scanning information from the fast attach snapshot.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ *
+ * This function reads the fast attach snapshot and fills @si from it, only
+ * scanning the physical eraseblocks the snapshot does not describe. The
+ * snapshot is consumed: its anchor is erased before anything else is done,
+ * unless the device is read-only.
+ * Returns zero in case of success, %1 if the device has to be fully scanned,
+ * and a negative error code in case of failure. In the latter two cases @si
+ * may be partially filled.
+ */
+static int scan_fast(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int err, i, pnum;
+	struct ubi_fm_image fmi;
+	struct ubi_fm_volume **vols;
+	unsigned long *scan_map;
+	struct scan_ra *ra;
+
+	err = ubi_fm_read(ubi, &fmi);
+	if (err)
+		return err;
 
 	err = -ENOMEM;
-	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
-	if (!ech)
-		goto out_si;
+	vols = kcalloc(UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT,
+		       sizeof(struct ubi_fm_volume *), GFP_KERNEL);
+	if (!vols)
+		goto out_free;
+	scan_map = kcalloc(BITS_TO_LONGS(fmi.peb_count), sizeof(unsigned long),
+			   GFP_KERNEL);
+	if (!scan_map)
+		goto out_vols;
+
+	err = 1;
+	for (i = 0; i < fmi.vol_count; i++) {
+		int vol_id = be32_to_cpu(fmi.vols[i].vol_id);
+		int idx = fm_vol_idx(vol_id);
+
+		if (idx < 0) {
+			ubi_warn("bad volume %d in the snapshot", vol_id);
+			goto out_map;
+		}
+		vols[idx] = &fmi.vols[i];
+	}
 
-	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
-	if (!vidh)
-		goto out_ech;
+	for (pnum = 0; pnum < fmi.peb_count; pnum++) {
+		const struct ubi_fm_peb *rec = &fmi.pebs[pnum];
+		int idx = fm_vol_idx(be32_to_cpu(rec->vol_id));
+
+		if (rec->type > UBI_FM_PEB_ERASE ||
+		    (rec->type == UBI_FM_PEB_USED && (idx < 0 || !vols[idx]))) {
+			ubi_warn("bad record of PEB %d in the snapshot", pnum);
+			goto out_map;
+		}
+		if (rec->type == UBI_FM_PEB_SCAN)
+			__set_bit(pnum, scan_map);
+	}
+
+	/*
+	 * The anchor is recorded as to be scanned, and will be found empty. So
+	 * if we are interrupted from now on, the device is just fully scanned
+	 * next time. A read-only device cannot change, so the snapshot stays
+	 * valid and the anchor is simply scanned as the "delete" compatible
+	 * internal volume it is.
+	 */
+	if (!ubi->ro_mode) {
+		err = ubi_scan_erase_peb(ubi, si, fmi.anchor,
+					 fmi.anchor_ec + 1);
+		if (err)
+			goto out_map;
+	}
+
+	err = -ENOMEM;
+	ra = scan_ra_start(ubi, scan_map);
+	if (!ra)
+		goto out_map;
+
+	for (pnum = 0; pnum < fmi.peb_count; pnum++) {
+		const struct ubi_fm_peb *rec = &fmi.pebs[pnum];
+		const struct ubi_fm_volume *vol;
+		int ec = be32_to_cpu(rec->ec);
+		int vol_id, lnum, used_ebs;
 
-	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
 		cond_resched();
 
-		dbg_gen("process PEB %d", pnum);
-		err = process_eb(ubi, si, pnum);
+		if (rec->type == UBI_FM_PEB_SCAN) {
+			err = process_eb(ubi, si, scan_ra_get(ra, pnum));
+			scan_ra_put(ra);
+			if (err < 0)
+				goto out_ra;
+			continue;
+		}
+
+		err = ubi_io_is_bad(ubi, pnum);
 		if (err < 0)
+			goto out_ra;
+		if (err) {
+			si->bad_peb_count += 1;
+			continue;
+		}
+
+		switch (rec->type) {
+		case UBI_FM_PEB_FREE:
+			err = add_to_list(si, pnum, ec, &si->free);
+			break;
+		case UBI_FM_PEB_ERASE:
+			err = add_to_list(si, pnum, ec, &si->erase);
+			break;
+		case UBI_FM_PEB_USED:
+			vol_id = be32_to_cpu(rec->vol_id);
+			lnum = be32_to_cpu(rec->lnum);
+			vol = vols[fm_vol_idx(vol_id)];
+			used_ebs = be32_to_cpu(vol->used_ebs);
+
+			/*
+			 * Re-create the VID header as it was written. Its
+			 * sequence number is lower than the one of any copy
+			 * of this LEB written after the snapshot was taken.
+			 */
+			memset(vidh, 0, sizeof(struct ubi_vid_hdr));
+			vidh->vol_type = vol->vol_type;
+			vidh->compat = vol->compat;
+			vidh->vol_id = rec->vol_id;
+			vidh->lnum = rec->lnum;
+			vidh->data_pad = vol->data_pad;
+			if (vol->vol_type == UBI_VID_STATIC) {
+				vidh->used_ebs = vol->used_ebs;
+				if (lnum == used_ebs - 1)
+					vidh->data_size = vol->last_eb_bytes;
+			}
+			err = ubi_scan_add_used(ubi, si, pnum, ec, vidh, 0);
+			break;
+		}
+		if (err)
+			goto out_ra;
+
+		si->ec_sum += ec;
+		si->ec_count += 1;
+		if (ec > si->max_ec)
+			si->max_ec = ec;
+		if (ec < si->min_ec)
+			si->min_ec = ec;
+	}
+
+	si->is_empty = 0;
+	if (si->max_sqnum < fmi.sqnum)
+		si->max_sqnum = fmi.sqnum;
+	ubi_msg("attached from fast attach snapshot, anchor PEB %d",
+		fmi.anchor);
+	err = 0;
+
+out_ra:
+	scan_ra_stop(ra);
+out_map:
+	kfree(scan_map);
+out_vols:
+	kfree(vols);
+out_free:
+	ubi_fm_free_image(&fmi);
+	return err;
+}
+#endif
+
+/**
+ * ubi_scan - scan an MTD device.
+ * @ubi: UBI device description object
+ *
+ * This function does full scanning of an MTD device and returns complete
+ * information about it. In case of failure, an error code is returned.
+ */
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+{
+	int err, pnum, fast = 0;
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
+	struct ubi_scan_info *si;
+	struct scan_ra *ra;
+	ktime_t start = ktime_get();
+
+	memset(&ubi->attach_stats, 0, sizeof(struct ubi_attach_stats));
+
+	si = alloc_si();
+	if (!si)
+		return ERR_PTR(-ENOMEM);
+
+	err = -ENOMEM;
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vidh)
+		goto out_si;
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	err = scan_fast(ubi, si);
+	if (err < 0)
+		goto out_vidh;
+	if (err == 0)
+		fast = 1;
+	else {
+		/* Start over and scan the whole device */
+		ubi_scan_destroy_si(si);
+		si = alloc_si();
+		if (!si) {
+			ubi_free_vid_hdr(ubi, vidh);
+			return ERR_PTR(-ENOMEM);
+		}
+	}
+#endif
+
+	if (!fast) {
+		err = -ENOMEM;
+		ra = scan_ra_start(ubi, NULL);
+		if (!ra)
 			goto out_vidh;
+
+		for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+			cond_resched();
+
+			dbg_gen("process PEB %d", pnum);
+			err = process_eb(ubi, si, scan_ra_get(ra, pnum));
+			scan_ra_put(ra);
+			if (err < 0)
+				goto out_ra;
+		}
+		scan_ra_stop(ra);
 	}
 
 	dbg_msg("scanning is finished");
@@ -973,7 +1494,11 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 		if (seb->ec == UBI_SCAN_UNKNOWN_EC)
 			seb->ec = si->mean_ec;
 
-	err = paranoid_check_si(ubi, si);
+	/*
+	 * The logical eraseblocks taken from the fast attach snapshot have no
+	 * sequence numbers, which the paranoid check would complain about.
+	 */
+	err = fast ? 0 : paranoid_check_si(ubi, si);
 	if (err) {
 		if (err > 0)
 			err = -EINVAL;
@@ -981,14 +1506,15 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	}
 
 	ubi_free_vid_hdr(ubi, vidh);
-	kfree(ech);
 
+	ubi->attach_stats.fast = fast;
+	ubi->attach_stats.scan_us = ktime_us_delta(ktime_get(), start);
 	return si;
 
+out_ra:
+	scan_ra_stop(ra);
 out_vidh:
 	ubi_free_vid_hdr(ubi, vidh);
-out_ech:
-	kfree(ech);
 out_si:
 	ubi_scan_destroy_si(si);
 	return ERR_PTR(err);
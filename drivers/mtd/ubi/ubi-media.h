@@ -312,7 +312,51 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
-/* The maximum number of volumes per one UBI device */
+/*
+ * The fast attach volumes contain the snapshot of the PEB table. They are not
+ * real volumes and are not counted in %UBI_INT_VOL_COUNT. They are "delete"
+ * compatible, so UBI implementations which do not support fast attach just
+ * erase them.
+ */
+#define UBI_FM_SB_VOLUME_ID      (UBI_LAYOUT_VOLUME_ID + 1)
+#define UBI_FM_DATA_VOLUME_ID    (UBI_LAYOUT_VOLUME_ID + 2)
+#define UBI_FM_VOLUME_TYPE       UBI_VID_DYNAMIC
+#define UBI_FM_VOLUME_COMPAT     UBI_COMPAT_DELETE
+
+/* Fast attach snapshot super block magic number (ASCII "UBIf") */
+#define UBI_FM_SB_MAGIC 0x55424966
+
+/* The version of the fast attach snapshot format */
+#define UBI_FM_FMT_VERSION 1
+
+/*
+ * The snapshot super block is always stored in one of the first
+ * %UBI_FM_MAX_START physical eraseblocks.
+ */
+#define UBI_FM_MAX_START 64
+
+/* The maximum number of physical eraseblocks the snapshot data may occupy */
+#define UBI_FM_MAX_BLOCKS 32
+
+/* Size of the snapshot super block, with and without the ending CRC */
+#define UBI_FM_SB_SIZE     sizeof(struct ubi_fm_sb)
+#define UBI_FM_SB_SIZE_CRC (UBI_FM_SB_SIZE - sizeof(__be32))
+
+/*
+ * Physical eraseblock types used in the fast attach snapshot.
+ *
+ * @UBI_FM_PEB_SCAN: the state of the PEB is unknown, it has to be scanned
+ * @UBI_FM_PEB_FREE: the PEB is free
+ * @UBI_FM_PEB_USED: the PEB is mapped to the recorded logical eraseblock
+ * @UBI_FM_PEB_ERASE: the PEB has to be erased
+ */
+enum {
+	UBI_FM_PEB_SCAN = 0,
+	UBI_FM_PEB_FREE,
+	UBI_FM_PEB_USED,
+	UBI_FM_PEB_ERASE
+};
+
 #define UBI_MAX_VOLUMES 128
 
 /* The maximum volume name length */
@@ -375,4 +419,87 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __attribute__ ((packed));
 
+/**
+ * struct ubi_fm_sb - fast attach snapshot super block.
+ * @magic: snapshot super block magic number (%UBI_FM_SB_MAGIC)
+ * @version: version of the snapshot format (%UBI_FM_FMT_VERSION)
+ * @padding1: reserved for future, zeroes
+ * @peb_count: number of &struct ubi_fm_peb records
+ * @vol_count: number of &struct ubi_fm_volume records
+ * @data_size: size of the snapshot data in bytes
+ * @data_crc: CRC32 checksum of the snapshot data
+ * @block_count: number of physical eraseblocks the snapshot data occupies
+ * @sqnum: the global sequence number at the time the snapshot was taken
+ * @block_loc: physical eraseblocks containing the snapshot data
+ * @padding2: reserved for future, zeroes
+ * @hdr_crc: super block CRC checksum
+ *
+ * The fast attach snapshot describes the state of every physical eraseblock
+ * of the UBI device at some point in time. The super block is stored at the
+ * beginning of the "anchor" physical eraseblock, which belongs to the
+ * %UBI_FM_SB_VOLUME_ID internal volume and is always one of the first
+ * %UBI_FM_MAX_START physical eraseblocks. The snapshot data is stored in
+ * @block_count logical eraseblocks of the %UBI_FM_DATA_VOLUME_ID volume, the
+ * n-th one being logical eraseblock n. The data consists of @peb_count
+ * &struct ubi_fm_peb records, one per physical eraseblock, followed by
+ * @vol_count &struct ubi_fm_volume records.
+ */
+struct ubi_fm_sb {
+	__be32  magic;
+	__u8    version;
+	__u8    padding1[3];
+	__be32  peb_count;
+	__be32  vol_count;
+	__be32  data_size;
+	__be32  data_crc;
+	__be32  block_count;
+	__be64  sqnum;
+	__be32  block_loc[UBI_FM_MAX_BLOCKS];
+	__u8    padding2[24];
+	__be32  hdr_crc;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_peb - fast attach snapshot record of a physical eraseblock.
+ * @ec: erase counter (not used for %UBI_FM_PEB_SCAN eraseblocks)
+ * @vol_id: ID of the volume this eraseblock belongs to
+ *          (%UBI_FM_PEB_USED only)
+ * @lnum: logical eraseblock number (%UBI_FM_PEB_USED only)
+ * @type: the physical eraseblock type (%UBI_FM_PEB_SCAN, etc)
+ * @padding: reserved for future, zeroes
+ */
+struct ubi_fm_peb {
+	__be32  ec;
+	__be32  vol_id;
+	__be32  lnum;
+	__u8    type;
+	__u8    padding[3];
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_volume - fast attach snapshot record of a volume.
+ * @vol_id: volume ID
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @compat: compatibility flags of the volume
+ * @padding1: reserved for future, zeroes
+ * @used_ebs: number of used logical eraseblocks (static volumes only)
+ * @data_pad: how many bytes at the end of logical eraseblocks are not used
+ * @last_eb_bytes: how many bytes are stored in the last logical eraseblock
+ *                 (static volumes only)
+ * @padding2: reserved for future, zeroes
+ *
+ * The records describe the volumes the same way the VID headers of their
+ * logical eraseblocks do, so that attaching does not have to read them.
+ */
+struct ubi_fm_volume {
+	__be32  vol_id;
+	__u8    vol_type;
+	__u8    compat;
+	__u8    padding1[2];
+	__be32  used_ebs;
+	__be32  data_pad;
+	__be32  last_eb_bytes;
+	__u8    padding2[4];
+} __attribute__ ((packed));
+
 #endif /* !__UBI_MEDIA_H__ */
@@ -288,6 +288,30 @@ struct ubi_volume_desc {
 
 struct ubi_wl_entry;
 
+/**
+ * struct ubi_attach_stats - statistics of the last attachment.
+ * @fast: if the device was attached from the fast attach snapshot
+ * @pebs_scanned: how many physical eraseblocks had their headers read
+ * @scan_us: time spent in 'ubi_scan()', in microseconds
+ * @read_us: time the header read-ahead spent reading the flash
+ * @stall_us: time scanning waited for headers to be read
+ * @vtbl_us: time spent reading the volume table
+ * @wl_us: time spent initializing the wear-leveling sub-system
+ * @eba_us: time spent initializing the EBA sub-system
+ * @total_us: time the whole attachment took
+ */
+struct ubi_attach_stats {
+	int fast;
+	int pebs_scanned;
+	unsigned long scan_us;
+	unsigned long read_us;
+	unsigned long stall_us;
+	unsigned long vtbl_us;
+	unsigned long wl_us;
+	unsigned long eba_us;
+	unsigned long total_us;
+};
+
 /**
  * struct ubi_device - UBI device description structure
  * @dev: UBI device object to use the the Linux device model
@@ -351,6 +375,24 @@ struct ubi_wl_entry;
  * @bgt_name: background thread name
  * @reboot_notifier: notifier to terminate background thread before rebooting
  *
+ * @fm_enabled: if the fast attach snapshot is maintained
+ * @fm_blocks: number of physical eraseblocks a snapshot occupies (the anchor
+ *             included)
+ * @fm_size: size of the snapshot data in bytes
+ * @fm_buf: buffer the snapshot data is prepared in
+ * @fm_pool_size: how many free physical eraseblocks are handed to the pool by
+ *                each snapshot
+ * @fm_pool: RB-tree of free physical eraseblocks which may be used until the
+ *           next snapshot is written
+ * @fm_deferred: list of erase works postponed until the next snapshot
+ * @fm_cur: physical eraseblocks holding the current snapshot
+ * @fm_cur_cnt: number of entries in @fm_cur
+ * @fm_next: physical eraseblocks reserved for the next snapshot
+ * @fm_next_cnt: number of entries in @fm_next
+ * @fm_mutex: serializes snapshot updates
+ * @fm_eba_sem: makes EBA table changes and the return of the old physical
+ *              eraseblock atomic with respect to taking a snapshot
+ *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
  * @peb_size: physical eraseblock size
@@ -382,6 +424,9 @@ struct ubi_wl_entry;
  * @ckvol_mutex: serializes static volume checking when opening
  * @dbg_peb_buf: buffer of PEB size used for debugging
  * @dbg_buf_mutex: protects @dbg_peb_buf
+ *
+ * @attach_stats: statistics of the attachment
+ * @dfs_dir: debugfs directory of this UBI device
  */
 struct ubi_device {
 	struct cdev cdev;
@@ -437,6 +482,23 @@ struct ubi_device {
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
 	struct notifier_block reboot_notifier;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	/* Fast attach stuff */
+	int fm_enabled;
+	int fm_blocks;
+	int fm_size;
+	void *fm_buf;
+	int fm_pool_size;
+	struct rb_root fm_pool;
+	struct list_head fm_deferred;
+	struct ubi_wl_entry *fm_cur[UBI_FM_MAX_BLOCKS + 1];
+	int fm_cur_cnt;
+	struct ubi_wl_entry *fm_next[UBI_FM_MAX_BLOCKS + 1];
+	int fm_next_cnt;
+	struct mutex fm_mutex;
+	struct rw_semaphore fm_eba_sem;
+#endif
+
 	/* I/O sub-system's stuff */
 	long long flash_size;
 	int peb_count;
@@ -467,6 +529,57 @@ struct ubi_device {
 	void *dbg_peb_buf;
 	struct mutex dbg_buf_mutex;
 #endif
+
+	struct ubi_attach_stats attach_stats;
+#ifdef CONFIG_MTD_UBI_DEBUG
+	struct dentry *dfs_dir;
+#endif
+};
+
+/**
+ * struct ubi_fm_image - fast attach snapshot read from the flash media.
+ * @anchor: physical eraseblock holding the snapshot super block
+ * @anchor_ec: erase counter of @anchor
+ * @sqnum: global sequence number at the time the snapshot was taken
+ * @peb_count: number of records in @pebs
+ * @vol_count: number of records in @vols
+ * @pebs: physical eraseblock records
+ * @vols: volume records
+ * @buf: the buffer @pebs and @vols are stored in
+ */
+struct ubi_fm_image {
+	int anchor;
+	int anchor_ec;
+	unsigned long long sqnum;
+	int peb_count;
+	int vol_count;
+	struct ubi_fm_peb *pebs;
+	struct ubi_fm_volume *vols;
+	void *buf;
+};
+
+/**
+ * struct ubi_fm_update - state of a fast attach snapshot being written.
+ * @pebs: physical eraseblock records, followed by the volume records
+ * @vol_count: number of volume records
+ * @sqnum: global sequence number at the time the snapshot was taken
+ * @blocks: physical eraseblocks the snapshot is written to, anchor first
+ * @block_cnt: number of elements in @blocks
+ * @resv: physical eraseblocks reserved for the snapshot after this one
+ * @resv_cnt: number of elements in @resv
+ * @pool: free physical eraseblocks handed out once the snapshot is written
+ * @release: erase works postponed until the snapshot is written
+ */
+struct ubi_fm_update {
+	struct ubi_fm_peb *pebs;
+	int vol_count;
+	unsigned long long sqnum;
+	int blocks[UBI_FM_MAX_BLOCKS + 1];
+	int block_cnt;
+	struct ubi_wl_entry *resv[UBI_FM_MAX_BLOCKS + 1];
+	int resv_cnt;
+	struct rb_root pool;
+	struct list_head release;
 };
 
 extern struct kmem_cache *ubi_wl_entry_slab;
@@ -523,6 +636,7 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		     struct ubi_vid_hdr *vid_hdr);
 int ubi_eba_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
 
 /* wl.c */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype);
@@ -532,6 +646,34 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+int ubi_wl_fm_capture(struct ubi_device *ubi, struct ubi_fm_update *upd);
+void ubi_wl_fm_done(struct ubi_device *ubi, struct ubi_fm_update *upd,
+		    int err);
+
+/* fastmap.c */
+int ubi_fm_read(struct ubi_device *ubi, struct ubi_fm_image *fmi);
+void ubi_fm_free_image(struct ubi_fm_image *fmi);
+int ubi_update_fastmap(struct ubi_device *ubi);
+
+static inline void ubi_fm_eba_lock(struct ubi_device *ubi)
+{
+	down_read(&ubi->fm_eba_sem);
+}
+
+static inline void ubi_fm_eba_unlock(struct ubi_device *ubi)
+{
+	up_read(&ubi->fm_eba_sem);
+}
+#else
+static inline int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	return 0;
+}
+
+static inline void ubi_fm_eba_lock(struct ubi_device *ubi) {}
+static inline void ubi_fm_eba_unlock(struct ubi_device *ubi) {}
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -543,10 +685,17 @@ int ubi_io_is_bad(const struct ubi_device *ubi, int pnum);
 int ubi_io_mark_bad(const struct ubi_device *ubi, int pnum);
 int ubi_io_read_ec_hdr(struct ubi_device *ubi, int pnum,
 		       struct ubi_ec_hdr *ec_hdr, int verbose);
+int ubi_io_check_ec_hdr(struct ubi_device *ubi, int pnum,
+			struct ubi_ec_hdr *ec_hdr, int read_err, int verbose);
 int ubi_io_write_ec_hdr(struct ubi_device *ubi, int pnum,
 			struct ubi_ec_hdr *ec_hdr);
 int ubi_io_read_vid_hdr(struct ubi_device *ubi, int pnum,
 			struct ubi_vid_hdr *vid_hdr, int verbose);
+int ubi_io_read_vid_hdr_raw(struct ubi_device *ubi, int pnum,
+			    struct ubi_vid_hdr *vid_hdr);
+int ubi_io_check_vid_hdr(struct ubi_device *ubi, int pnum,
+			 struct ubi_vid_hdr *vid_hdr, int read_err,
+			 int verbose);
 int ubi_io_write_vid_hdr(struct ubi_device *ubi, int pnum,
 			 struct ubi_vid_hdr *vid_hdr);
 
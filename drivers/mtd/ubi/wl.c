@@ -109,6 +109,7 @@
 #include <linux/crc32.h>
 #include <linux/freezer.h>
 #include <linux/kthread.h>
+#include <linux/vmalloc.h>
 #include "ubi.h"
 
 /* Number of physical eraseblocks reserved for wear-leveling purposes */
@@ -172,6 +173,23 @@ static int paranoid_check_in_pq(struct ubi_device *ubi, struct ubi_wl_entry *e);
 #define paranoid_check_in_pq(ubi, e) 0
 #endif
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * free_root - get the RB-tree free physical eraseblocks are taken from.
+ * @ubi: UBI device description object
+ *
+ * When the fast attach snapshot is maintained, the @ubi->free tree must stay
+ * as recorded in the snapshot, so physical eraseblocks are only taken from
+ * the pool the last snapshot handed out. @ubi->wl_lock has to be locked.
+ */
+static struct rb_root *free_root(struct ubi_device *ubi)
+{
+	return ubi->fm_enabled ? &ubi->fm_pool : &ubi->free;
+}
+#else
+#define free_root(ubi) (&(ubi)->free)
+#endif
+
 /**
  * wl_tree_add - add a wear-leveling entry to a WL RB-tree.
  * @e: the wear-leveling entry to add
@@ -388,13 +406,29 @@ int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
 {
 	int err, medium_ec;
 	struct ubi_wl_entry *e, *first, *last;
+	struct rb_root *root;
 
 	ubi_assert(dtype == UBI_LONGTERM || dtype == UBI_SHORTTERM ||
 		   dtype == UBI_UNKNOWN);
 
 retry:
 	spin_lock(&ubi->wl_lock);
-	if (!ubi->free.rb_node) {
+	root = free_root(ubi);
+	if (!root->rb_node) {
+#ifdef CONFIG_MTD_UBI_FASTMAP
+		if (ubi->fm_enabled && (ubi->free.rb_node ||
+					!list_empty(&ubi->fm_deferred))) {
+			/*
+			 * The pool is exhausted. Writing a new snapshot
+			 * refills it and releases the postponed erasures.
+			 */
+			spin_unlock(&ubi->wl_lock);
+			err = ubi_update_fastmap(ubi);
+			if (err)
+				return err;
+			goto retry;
+		}
+#endif
 		if (ubi->works_count == 0) {
 			ubi_assert(list_empty(&ubi->works));
 			ubi_err("no free eraseblocks");
@@ -417,7 +451,7 @@ retry:
 		 * bounded by the the lowest erase counter plus
 		 * %WL_FREE_MAX_DIFF.
 		 */
-		e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e = find_wl_entry(root, WL_FREE_MAX_DIFF);
 		break;
 	case UBI_UNKNOWN:
 		/*
@@ -426,16 +460,14 @@ retry:
 		 * eraseblock with erase counter greater or equivalent than the
 		 * lowest erase counter plus %WL_FREE_MAX_DIFF.
 		 */
-		first = rb_entry(rb_first(&ubi->free), struct ubi_wl_entry,
-					u.rb);
-		last = rb_entry(rb_last(&ubi->free), struct ubi_wl_entry, u.rb);
+		first = rb_entry(rb_first(root), struct ubi_wl_entry, u.rb);
+		last = rb_entry(rb_last(root), struct ubi_wl_entry, u.rb);
 
 		if (last->ec - first->ec < WL_FREE_MAX_DIFF)
-			e = rb_entry(ubi->free.rb_node,
-					struct ubi_wl_entry, u.rb);
+			e = rb_entry(root->rb_node, struct ubi_wl_entry, u.rb);
 		else {
 			medium_ec = (first->ec + WL_FREE_MAX_DIFF)/2;
-			e = find_wl_entry(&ubi->free, medium_ec);
+			e = find_wl_entry(root, medium_ec);
 		}
 		break;
 	case UBI_SHORTTERM:
@@ -443,19 +475,19 @@ retry:
 		 * For short term data we pick a physical eraseblock with the
 		 * lowest erase counter as we expect it will be erased soon.
 		 */
-		e = rb_entry(rb_first(&ubi->free), struct ubi_wl_entry, u.rb);
+		e = rb_entry(rb_first(root), struct ubi_wl_entry, u.rb);
 		break;
 	default:
 		BUG();
 	}
 
-	paranoid_check_in_wl_tree(e, &ubi->free);
+	paranoid_check_in_wl_tree(e, root);
 
 	/*
 	 * Move the physical eraseblock to the protection queue where it will
 	 * be protected from being moved for some time.
 	 */
-	rb_erase(&e->u.rb, &ubi->free);
+	rb_erase(&e->u.rb, root);
 	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
 	prot_queue_add(ubi, e);
 	spin_unlock(&ubi->wl_lock);
@@ -650,6 +682,51 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	return 0;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * defer_erase - schedule erasure of a PEB which may still be in a snapshot.
+ * @ubi: UBI device description object
+ * @e: the WL entry of the physical eraseblock to erase
+ * @torture: if the physical eraseblock has to be tortured
+ *
+ * The last fast attach snapshot may still refer to the data in @e, so it may
+ * only be erased once a newer snapshot has been written. While fast attach is
+ * enabled, the erase work is parked in @ubi->fm_deferred and is released by
+ * 'ubi_wl_fm_done()'. This function returns zero in case of success and a
+ * %-ENOMEM in case of failure.
+ */
+static int defer_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		       int torture)
+{
+	struct ubi_work *wl_wrk;
+
+	wl_wrk = kmalloc(sizeof(struct ubi_work), GFP_NOFS);
+	if (!wl_wrk)
+		return -ENOMEM;
+
+	wl_wrk->func = &erase_worker;
+	wl_wrk->e = e;
+	wl_wrk->torture = torture;
+
+	spin_lock(&ubi->wl_lock);
+	if (ubi->fm_enabled) {
+		dbg_wl("defer erasure of PEB %d, EC %d, torture %d",
+		       e->pnum, e->ec, torture);
+		list_add_tail(&wl_wrk->list, &ubi->fm_deferred);
+		spin_unlock(&ubi->wl_lock);
+		return 0;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	dbg_wl("schedule erasure of PEB %d, EC %d, torture %d",
+	       e->pnum, e->ec, torture);
+	schedule_ubi_work(ubi, wl_wrk);
+	return 0;
+}
+#else
+#define defer_erase(ubi, e, torture) schedule_erase(ubi, e, torture)
+#endif
+
 /**
  * wear_leveling_worker - wear-leveling worker function.
  * @ubi: UBI device description object
@@ -681,7 +758,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	ubi_assert(!ubi->move_from && !ubi->move_to);
 	ubi_assert(!ubi->move_to_put);
 
-	if (!ubi->free.rb_node ||
+	if (!free_root(ubi)->rb_node ||
 	    (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
 		/*
 		 * No free physical eraseblocks? Well, they must be waiting in
@@ -694,7 +771,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * triggered again.
 		 */
 		dbg_wl("cancel WL, a list is empty: free %d, used %d",
-		       !ubi->free.rb_node, !ubi->used.rb_node);
+		       !free_root(ubi)->rb_node, !ubi->used.rb_node);
 		goto out_cancel;
 	}
 
@@ -705,7 +782,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * counters differ much enough, start wear-leveling.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_entry(free_root(ubi), WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD)) {
 			dbg_wl("no WL needed: min used EC %d, max free EC %d",
@@ -720,14 +797,14 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		/* Perform scrubbing */
 		scrubbing = 1;
 		e1 = rb_entry(rb_first(&ubi->scrub), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_entry(free_root(ubi), WL_FREE_MAX_DIFF);
 		paranoid_check_in_wl_tree(e1, &ubi->scrub);
 		rb_erase(&e1->u.rb, &ubi->scrub);
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
-	paranoid_check_in_wl_tree(e2, &ubi->free);
-	rb_erase(&e2->u.rb, &ubi->free);
+	paranoid_check_in_wl_tree(e2, free_root(ubi));
+	rb_erase(&e2->u.rb, free_root(ubi));
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -831,7 +908,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	ubi->move_to_put = ubi->wl_scheduled = 0;
 	spin_unlock(&ubi->wl_lock);
 
-	err = schedule_erase(ubi, e1, 0);
+	err = defer_erase(ubi, e1, 0);
 	if (err) {
 		kmem_cache_free(ubi_wl_entry_slab, e1);
 		if (e2)
@@ -846,7 +923,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 */
 		dbg_wl("PEB %d (LEB %d:%d) was put meanwhile, erase",
 		       e2->pnum, vol_id, lnum);
-		err = schedule_erase(ubi, e2, 0);
+		err = defer_erase(ubi, e2, 0);
 		if (err) {
 			kmem_cache_free(ubi_wl_entry_slab, e2);
 			goto out_ro;
@@ -948,7 +1025,7 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	 * the WL worker has to be scheduled anyway.
 	 */
 	if (!ubi->scrub.rb_node) {
-		if (!ubi->used.rb_node || !ubi->free.rb_node)
+		if (!ubi->used.rb_node || !free_root(ubi)->rb_node)
 			/* No physical eraseblocks - no deal */
 			goto out_unlock;
 
@@ -959,7 +1036,7 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		 * %UBI_WL_THRESHOLD.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_entry(free_root(ubi), WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
@@ -1184,7 +1261,7 @@ retry:
 	}
 	spin_unlock(&ubi->wl_lock);
 
-	err = schedule_erase(ubi, e, torture);
+	err = defer_erase(ubi, e, torture);
 	if (err) {
 		spin_lock(&ubi->wl_lock);
 		wl_tree_add(e, &ubi->used);
@@ -1267,6 +1344,18 @@ int ubi_wl_flush(struct ubi_device *ubi)
 {
 	int err;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	/*
+	 * Erasures postponed for the fast attach snapshot are only released
+	 * by writing a new snapshot, and callers expect them to be done.
+	 */
+	if (ubi->fm_enabled && !list_empty(&ubi->fm_deferred)) {
+		err = ubi_update_fastmap(ubi);
+		if (err)
+			return err;
+	}
+#endif
+
 	/*
 	 * Erase while the pending works queue is not empty, but not more than
 	 * the number of currently pending works.
@@ -1299,6 +1388,321 @@ int ubi_wl_flush(struct ubi_device *ubi)
 	return 0;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * fm_draw - take physical eraseblocks for a fast attach snapshot.
+ * @ubi: UBI device description object
+ * @blocks: where to store the taken WL entries
+ *
+ * This function takes @ubi->fm_blocks physical eraseblocks out of the free
+ * tree. The first one is the anchor, which has to be one of the first
+ * %UBI_FM_MAX_START physical eraseblocks to be found at attach time. Returns
+ * zero in case of success and %-ENOSPC if there are not enough free physical
+ * eraseblocks, in which case the free tree is left untouched. @ubi->wl_lock
+ * has to be locked.
+ */
+static int fm_draw(struct ubi_device *ubi, struct ubi_wl_entry **blocks)
+{
+	int i;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e = NULL;
+
+	for (rb = rb_first(&ubi->free); rb; rb = rb_next(rb)) {
+		e = rb_entry(rb, struct ubi_wl_entry, u.rb);
+		if (e->pnum < UBI_FM_MAX_START)
+			break;
+	}
+	if (!rb)
+		return -ENOSPC;
+
+	rb_erase(&e->u.rb, &ubi->free);
+	blocks[0] = e;
+
+	for (i = 1; i < ubi->fm_blocks; i++) {
+		if (!ubi->free.rb_node) {
+			while (--i >= 0)
+				wl_tree_add(blocks[i], &ubi->free);
+			return -ENOSPC;
+		}
+		e = rb_entry(rb_first(&ubi->free), struct ubi_wl_entry, u.rb);
+		rb_erase(&e->u.rb, &ubi->free);
+		blocks[i] = e;
+	}
+
+	return 0;
+}
+
+/**
+ * fm_mark - set the snapshot record of a physical eraseblock.
+ * @pebs: physical eraseblock records
+ * @e: the WL entry of the physical eraseblock
+ * @type: the record type (%UBI_FM_PEB_SCAN, %UBI_FM_PEB_FREE, etc)
+ */
+static void fm_mark(struct ubi_fm_peb *pebs, struct ubi_wl_entry *e, int type)
+{
+	struct ubi_fm_peb *rec = &pebs[e->pnum];
+
+	rec->ec = cpu_to_be32(e->ec);
+	rec->type = type;
+}
+
+/**
+ * ubi_wl_fm_capture - capture the state of the WL and EBA sub-systems.
+ * @ubi: UBI device description object
+ * @upd: the snapshot being written
+ *
+ * This function fills the physical eraseblock and volume records of @upd,
+ * which has to have @upd->pebs pointing to a large enough buffer, and picks
+ * the physical eraseblocks the snapshot will be written to. Physical
+ * eraseblocks which may change after this point are recorded as
+ * %UBI_FM_PEB_SCAN, so attaching from the snapshot reads their headers.
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure. In both cases 'ubi_wl_fm_done()' has to be called
+ * afterwards. Must be called with @ubi->fm_mutex locked.
+ */
+int ubi_wl_fm_capture(struct ubi_device *ubi, struct ubi_fm_update *upd)
+{
+	int err, i, lnum, pnum;
+	struct ubi_fm_peb *pebs = upd->pebs;
+	struct ubi_fm_volume *vols;
+	struct ubi_wl_entry *e;
+	struct rb_node *rb;
+
+	upd->block_cnt = upd->resv_cnt = upd->vol_count = 0;
+	upd->pool = RB_ROOT;
+	INIT_LIST_HEAD(&upd->release);
+
+	if (ubi->fm_next_cnt == 0) {
+		/*
+		 * No physical eraseblocks were reserved by the previous
+		 * snapshot, so take them from the free tree, waiting for
+		 * pending erasures if needed.
+		 */
+		while (1) {
+			spin_lock(&ubi->wl_lock);
+			err = fm_draw(ubi, ubi->fm_next);
+			if (!err || ubi->works_count == 0) {
+				spin_unlock(&ubi->wl_lock);
+				break;
+			}
+			spin_unlock(&ubi->wl_lock);
+
+			err = do_work(ubi);
+			if (err)
+				return err;
+		}
+		if (err)
+			return err;
+		ubi->fm_next_cnt = ubi->fm_blocks;
+
+		/*
+		 * These physical eraseblocks are free in the current snapshot,
+		 * so it must not be used if we are interrupted while writing
+		 * to them. Invalidate it by erasing its anchor.
+		 */
+		if (ubi->fm_cur_cnt) {
+			err = sync_erase(ubi, ubi->fm_cur[0], 0);
+			if (err)
+				return err;
+		}
+	}
+
+	for (i = 0; i < ubi->fm_next_cnt; i++)
+		upd->blocks[i] = ubi->fm_next[i]->pnum;
+	upd->block_cnt = ubi->fm_next_cnt;
+
+	/*
+	 * Block LEB re-mapping so that no physical eraseblock is returned to
+	 * the WL sub-system while it is still recorded as used.
+	 */
+	down_write(&ubi->fm_eba_sem);
+
+	spin_lock(&ubi->ltree_lock);
+	upd->sqnum = ubi->global_sqnum;
+	spin_unlock(&ubi->ltree_lock);
+
+	spin_lock(&ubi->volumes_lock);
+	spin_lock(&ubi->wl_lock);
+
+	/*
+	 * Physical eraseblocks which are not in any tree or list are being
+	 * moved, erased, or are waiting for erasure.
+	 */
+	memset(pebs, 0, ubi->peb_count * sizeof(struct ubi_fm_peb));
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		e = ubi->lookuptbl[pnum];
+		if (e)
+			fm_mark(pebs, e, UBI_FM_PEB_ERASE);
+		else
+			pebs[pnum].type = UBI_FM_PEB_SCAN;
+	}
+
+	ubi_rb_for_each_entry(rb, e, &ubi->used, u.rb)
+		fm_mark(pebs, e, UBI_FM_PEB_SCAN);
+	ubi_rb_for_each_entry(rb, e, &ubi->scrub, u.rb)
+		fm_mark(pebs, e, UBI_FM_PEB_SCAN);
+	ubi_rb_for_each_entry(rb, e, &ubi->erroneous, u.rb)
+		fm_mark(pebs, e, UBI_FM_PEB_SCAN);
+	ubi_rb_for_each_entry(rb, e, &ubi->fm_pool, u.rb)
+		fm_mark(pebs, e, UBI_FM_PEB_SCAN);
+	for (i = 0; i < UBI_PROT_QUEUE_LEN; i++)
+		list_for_each_entry(e, &ubi->pq[i], u.list)
+			fm_mark(pebs, e, UBI_FM_PEB_SCAN);
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		fm_mark(pebs, e, UBI_FM_PEB_FREE);
+	for (i = 0; i < ubi->fm_cur_cnt; i++)
+		fm_mark(pebs, ubi->fm_cur[i], UBI_FM_PEB_SCAN);
+	for (i = 0; i < ubi->fm_next_cnt; i++)
+		fm_mark(pebs, ubi->fm_next[i], UBI_FM_PEB_SCAN);
+
+	/*
+	 * Reserve the physical eraseblocks for the next snapshot. If there are
+	 * not enough of them, the next snapshot will have to invalidate this
+	 * one before it is written.
+	 */
+	if (!fm_draw(ubi, upd->resv)) {
+		upd->resv_cnt = ubi->fm_blocks;
+		for (i = 0; i < upd->resv_cnt; i++)
+			fm_mark(pebs, upd->resv[i], UBI_FM_PEB_SCAN);
+	}
+
+	/* Refill the pool, mixing low and high erase counters */
+	if (!ubi->fm_pool.rb_node)
+		for (i = 0; i < ubi->fm_pool_size && ubi->free.rb_node; i++) {
+			if (i & 1)
+				e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+			else
+				e = rb_entry(rb_first(&ubi->free),
+					     struct ubi_wl_entry, u.rb);
+			rb_erase(&e->u.rb, &ubi->free);
+			wl_tree_add(e, &upd->pool);
+			fm_mark(pebs, e, UBI_FM_PEB_SCAN);
+		}
+
+	list_splice_init(&ubi->fm_deferred, &upd->release);
+	spin_unlock(&ubi->wl_lock);
+
+	vols = (struct ubi_fm_volume *)&pebs[ubi->peb_count];
+	for (i = 0; i < UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+		struct ubi_fm_volume *rec;
+
+		if (!vol)
+			continue;
+
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			struct ubi_fm_peb *peb_rec;
+
+			pnum = vol->eba_tbl[lnum];
+			if (pnum < 0)
+				continue;
+
+			peb_rec = &pebs[pnum];
+			peb_rec->type = UBI_FM_PEB_USED;
+			peb_rec->vol_id = cpu_to_be32(vol->vol_id);
+			peb_rec->lnum = cpu_to_be32(lnum);
+		}
+
+		rec = &vols[upd->vol_count++];
+		memset(rec, 0, sizeof(struct ubi_fm_volume));
+		rec->vol_id = cpu_to_be32(vol->vol_id);
+		if (vol->vol_type == UBI_DYNAMIC_VOLUME)
+			rec->vol_type = UBI_VID_DYNAMIC;
+		else
+			rec->vol_type = UBI_VID_STATIC;
+		if (vol->vol_id == UBI_LAYOUT_VOLUME_ID)
+			rec->compat = UBI_LAYOUT_VOLUME_COMPAT;
+		rec->used_ebs = cpu_to_be32(vol->used_ebs);
+		rec->data_pad = cpu_to_be32(vol->data_pad);
+		rec->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+	}
+	spin_unlock(&ubi->volumes_lock);
+	up_write(&ubi->fm_eba_sem);
+
+	return 0;
+}
+
+/**
+ * ubi_wl_fm_done - finish writing a fast attach snapshot.
+ * @ubi: UBI device description object
+ * @upd: the snapshot which was written
+ * @err: zero if the snapshot was written successfully
+ *
+ * If the snapshot was written, this function releases the physical
+ * eraseblocks of the previous one, the new pool and the postponed erasures.
+ * Otherwise fast attach is disabled, in which case the snapshots on the flash
+ * media are invalidated and everything is returned to the WL sub-system.
+ * Must be called with @ubi->fm_mutex locked.
+ */
+void ubi_wl_fm_done(struct ubi_device *ubi, struct ubi_fm_update *upd, int err)
+{
+	int i, count = 0;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+	struct ubi_work *wrk;
+	LIST_HEAD(release);
+
+	if (err) {
+		ubi_warn("cannot write fast attach snapshot, error %d, "
+			 "disable fast attach", err);
+		if (ubi->fm_cur_cnt && sync_erase(ubi, ubi->fm_cur[0], 0))
+			ubi_ro_mode(ubi);
+		if (ubi->fm_next_cnt && sync_erase(ubi, ubi->fm_next[0], 0))
+			ubi_ro_mode(ubi);
+	}
+
+	for (i = 0; i < ubi->fm_cur_cnt; i++)
+		if (schedule_erase(ubi, ubi->fm_cur[i], 0)) {
+			kmem_cache_free(ubi_wl_entry_slab, ubi->fm_cur[i]);
+			ubi_ro_mode(ubi);
+		}
+
+	if (!err) {
+		memcpy(ubi->fm_cur, ubi->fm_next, sizeof(ubi->fm_next));
+		ubi->fm_cur_cnt = ubi->fm_next_cnt;
+		memcpy(ubi->fm_next, upd->resv, sizeof(upd->resv));
+		ubi->fm_next_cnt = upd->resv_cnt;
+	} else {
+		for (i = 0; i < ubi->fm_next_cnt; i++)
+			if (schedule_erase(ubi, ubi->fm_next[i], 0)) {
+				kmem_cache_free(ubi_wl_entry_slab,
+						ubi->fm_next[i]);
+				ubi_ro_mode(ubi);
+			}
+		ubi->fm_cur_cnt = ubi->fm_next_cnt = 0;
+	}
+
+	spin_lock(&ubi->wl_lock);
+	if (err) {
+		ubi->fm_enabled = 0;
+		for (i = 0; i < upd->resv_cnt; i++)
+			wl_tree_add(upd->resv[i], &ubi->free);
+		while ((rb = rb_first(&ubi->fm_pool))) {
+			e = rb_entry(rb, struct ubi_wl_entry, u.rb);
+			rb_erase(rb, &ubi->fm_pool);
+			wl_tree_add(e, &ubi->free);
+		}
+		list_splice_init(&ubi->fm_deferred, &upd->release);
+	}
+
+	while ((rb = rb_first(&upd->pool))) {
+		e = rb_entry(rb, struct ubi_wl_entry, u.rb);
+		rb_erase(rb, &upd->pool);
+		wl_tree_add(e, err ? &ubi->free : &ubi->fm_pool);
+	}
+
+	list_for_each_entry(wrk, &upd->release, list)
+		count += 1;
+	list_splice_tail_init(&upd->release, &ubi->works);
+	ubi->works_count += count;
+	if (count && ubi->thread_enabled)
+		wake_up_process(ubi->bgt_thread);
+	spin_unlock(&ubi->wl_lock);
+}
+
+#endif
+
 /**
  * tree_destroy - destroy an RB-tree.
  * @root: the root of the tree to destroy
@@ -1330,6 +1734,83 @@ static void tree_destroy(struct rb_root *root)
 	}
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * fm_init - set up fast attach.
+ * @ubi: UBI device description object
+ *
+ * This function reserves the physical eraseblocks for two snapshots, the
+ * current one and the next one. If there are not enough of them, fast attach
+ * is not used, and neither is it on read-only devices, where no snapshot can be
+ * written. Returns zero in case of success and %-ENOMEM in case of failure.
+ */
+static int fm_init(struct ubi_device *ubi)
+{
+	ubi->fm_pool = RB_ROOT;
+	INIT_LIST_HEAD(&ubi->fm_deferred);
+	mutex_init(&ubi->fm_mutex);
+	init_rwsem(&ubi->fm_eba_sem);
+
+	if (ubi->ro_mode) {
+		ubi_msg("read-only mode, fast attach disabled");
+		return 0;
+	}
+
+	ubi->fm_size = ubi->peb_count * sizeof(struct ubi_fm_peb) +
+		       (ubi->vtbl_slots + UBI_INT_VOL_COUNT) *
+		       sizeof(struct ubi_fm_volume);
+	ubi->fm_blocks = DIV_ROUND_UP(ubi->fm_size, ubi->leb_size) + 1;
+	ubi->fm_pool_size = ubi->peb_count / 20;
+	if (ubi->fm_pool_size < 1)
+		ubi->fm_pool_size = 1;
+	else if (ubi->fm_pool_size > 256)
+		ubi->fm_pool_size = 256;
+
+	if (ubi->fm_blocks - 1 > UBI_FM_MAX_BLOCKS ||
+	    ubi->avail_pebs < 2 * ubi->fm_blocks) {
+		ubi_warn("no room for fast attach snapshot (%d PEBs needed, "
+			 "%d available), fast attach disabled",
+			 2 * ubi->fm_blocks, ubi->avail_pebs);
+		return 0;
+	}
+
+	ubi->fm_buf = vmalloc((ubi->fm_blocks - 1) * ubi->leb_size);
+	if (!ubi->fm_buf)
+		return -ENOMEM;
+
+	ubi->avail_pebs -= 2 * ubi->fm_blocks;
+	ubi->rsvd_pebs += 2 * ubi->fm_blocks;
+	ubi->fm_enabled = 1;
+	return 0;
+}
+
+/**
+ * fm_close - release fast attach resources.
+ * @ubi: UBI device description object
+ */
+static void fm_close(struct ubi_device *ubi)
+{
+	int i;
+	struct ubi_work *wrk, *tmp;
+
+	list_for_each_entry_safe(wrk, tmp, &ubi->fm_deferred, list) {
+		list_del(&wrk->list);
+		wrk->func(ubi, wrk, 1);
+	}
+	for (i = 0; i < ubi->fm_cur_cnt; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->fm_cur[i]);
+	for (i = 0; i < ubi->fm_next_cnt; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->fm_next[i]);
+	ubi->fm_cur_cnt = ubi->fm_next_cnt = 0;
+	tree_destroy(&ubi->fm_pool);
+	vfree(ubi->fm_buf);
+	ubi->fm_buf = NULL;
+}
+#else
+#define fm_init(ubi) 0
+#define fm_close(ubi)
+#endif
+
 /**
  * ubi_thread - UBI background thread.
  * @u: the UBI device description object pointer
@@ -1438,6 +1919,9 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		INIT_LIST_HEAD(&ubi->pq[i]);
 	ubi->pq_head = 0;
 
+	if (fm_init(ubi))
+		goto out_free;
+
 	list_for_each_entry_safe(seb, tmp, &si->erase, u.list) {
 		cond_resched();
 
@@ -1524,6 +2008,7 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 
 out_free:
 	cancel_pending(ubi);
+	fm_close(ubi);
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
@@ -1556,6 +2041,7 @@ void ubi_wl_close(struct ubi_device *ubi)
 {
 	dbg_wl("close the WL sub-system");
 	cancel_pending(ubi);
+	fm_close(ubi);
 	protection_queue_destroy(ubi);
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->erroneous);
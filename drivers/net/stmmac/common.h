@@ -94,6 +94,11 @@ struct stmmac_extra_stats {
 	unsigned long rx_pkt_n;
 	unsigned long poll_n;
 	unsigned long sched_timer_n;
+	unsigned long tx_tso_frames;
+	unsigned long tx_tso_segs;
+	unsigned long rx_copybreak;
+	unsigned long rx_page_reuse;
+	unsigned long rx_page_alloc;
 	unsigned long normal_irq_n;
 	unsigned long mmc_tx_irq_n;
 	unsigned long mmc_rx_irq_n;
@@ -277,6 +282,8 @@ struct stmmac_dma_ops {
 			      struct stmmac_extra_stats *x);
 	/* If supported then get the optional core features */
 	unsigned int (*get_hw_feature) (void __iomem *ioaddr);
+	/* Program the RX interrupt watchdog timer (units of 256 CSR clocks) */
+	void (*rx_watchdog) (void __iomem *ioaddr, u32 riwt);
 };
 
 struct stmmac_ops {
@@ -29,21 +29,51 @@
 #include "stmmac_timer.h"
 #endif
 
+/* RX buffer in page mode: each page is split in two halves which are
+ * alternately given to the DMA, while the other one is (possibly) still
+ * attached to a socket buffer owned by the stack. */
+struct stmmac_rx_page {
+	struct page *page;
+	dma_addr_t dma;		/* mapping of the whole page */
+	unsigned int offset;	/* half currently owned by the DMA */
+	unsigned int sync_len[2];	/* bytes read by the CPU in each half */
+};
+
+/* RX interrupt coalescing (ethtool -C); the RX watchdog delay is
+ * either fixed (usecs) or chosen from the packet rate measured every
+ * sample_interval seconds when adaptive is set. */
+struct stmmac_rx_coal {
+	u32 usecs;
+	u32 adaptive;
+	u32 usecs_low;
+	u32 usecs_high;
+	u32 pkt_rate_low;
+	u32 pkt_rate_high;
+	u32 sample_interval;
+	unsigned long last_rx;
+	unsigned long last_tx;
+};
+
 struct stmmac_priv {
 	/* Frequently used values are kept adjacent for cache effect */
 	struct dma_desc *dma_tx ____cacheline_aligned;
 	dma_addr_t dma_tx_phy;
 	struct sk_buff **tx_skbuff;
+	u8 *tx_map;
 	unsigned int cur_tx;
 	unsigned int dirty_tx;
 	unsigned int dma_tx_size;
-	int tx_coalesce;
+	unsigned int tx_coal_frames;
+	unsigned int tx_coal_cur;
+	unsigned int tx_count_frames;
+	unsigned int tx_coal_usecs;
 
 	struct dma_desc *dma_rx ;
 	unsigned int cur_rx;
 	unsigned int dirty_rx;
 	struct sk_buff **rx_skbuff;
 	dma_addr_t *rx_skbuff_dma;
+	struct stmmac_rx_page *rx_page;
 	struct sk_buff_head rx_recycle;
 
 	struct net_device *dev;
@@ -60,6 +90,10 @@ struct stmmac_priv {
 	int rx_coe;
 	int no_csum_insertion;
 
+	/* TSO headers, one slot per TX descriptor */
+	char *tso_hdr;
+	dma_addr_t tso_hdr_phy;
+
 	struct phy_device *phydev;
 	int oldlink;
 	int speed;
@@ -88,8 +122,27 @@ struct stmmac_priv {
 	bool tx_path_in_lpi_mode;
 	bool eee_enabled;
 	int lpi_irq;
+	struct timer_list tx_coal_timer;
+	/* RX interrupt watchdog (GMAC only) */
+	int use_riwt;
+	u32 rx_riwt;
+	struct stmmac_rx_coal rx_coal;
+	struct timer_list rx_coal_timer;
 };
 
+/* How the buffer of a TX descriptor has been mapped (see stmmac_tx_unmap) */
+enum stmmac_tx_map {
+	STMMAC_TX_MAP_SINGLE = 0,
+	STMMAC_TX_MAP_PAGE,
+	STMMAC_TX_MAP_NONE,	/* TSO header, coherent memory */
+};
+
+#define STMMAC_TSO_HDR_SIZE	128
+
+/* DMA RX watchdog range, in units of 256 CSR clock cycles */
+#define STMMAC_RIWT_MIN		1
+#define STMMAC_RIWT_MAX		0xff
+
 extern int phyaddr;
 
 extern int stmmac_mdio_unregister(struct net_device *ndev);
@@ -108,4 +161,8 @@ struct stmmac_priv *stmmac_dvr_probe(struct device *device,
 				     void __iomem *addr);
 void stmmac_disable_eee_mode(struct stmmac_priv *priv);
 bool stmmac_eee_init(struct stmmac_priv *priv);
+u32 stmmac_riwt2usec(struct stmmac_priv *priv, u32 riwt);
+u32 stmmac_usec2riwt(struct stmmac_priv *priv, u32 usecs);
+void stmmac_set_rx_coalesce(struct stmmac_priv *priv, u32 usecs);
+void stmmac_start_coal(struct stmmac_priv *priv);
 
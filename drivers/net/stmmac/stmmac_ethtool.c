@@ -90,6 +90,11 @@ static const struct stmmac_stats stmmac_gstrings_stats[] = {
 	STMMAC_STAT(rx_pkt_n),
 	STMMAC_STAT(poll_n),
 	STMMAC_STAT(sched_timer_n),
+	STMMAC_STAT(tx_tso_frames),
+	STMMAC_STAT(tx_tso_segs),
+	STMMAC_STAT(rx_copybreak),
+	STMMAC_STAT(rx_page_reuse),
+	STMMAC_STAT(rx_page_alloc),
 	STMMAC_STAT(normal_irq_n),
 	STMMAC_STAT(normal_irq_n),
 	STMMAC_STAT(mmc_tx_irq_n),
@@ -514,6 +519,80 @@ static int ethtool_op_set_eee(struct net_device *dev, struct ethtool_value *eee)
 	return 0;
 }
 
+static int stmmac_get_coalesce(struct net_device *dev,
+			       struct ethtool_coalesce *ec)
+{
+	struct stmmac_priv *priv = netdev_priv(dev);
+	struct stmmac_rx_coal *c = &priv->rx_coal;
+
+	ec->tx_max_coalesced_frames = priv->tx_coal_frames;
+	ec->tx_coalesce_usecs = priv->tx_coal_usecs;
+
+	ec->use_adaptive_rx_coalesce = c->adaptive;
+	ec->use_adaptive_tx_coalesce = c->adaptive;
+	ec->pkt_rate_low = c->pkt_rate_low;
+	ec->pkt_rate_high = c->pkt_rate_high;
+	ec->rate_sample_interval = c->sample_interval;
+
+	/* The RX interrupt delay can only be tuned through the watchdog */
+	if (priv->use_riwt) {
+		ec->rx_coalesce_usecs = c->usecs;
+		ec->rx_coalesce_usecs_low = c->usecs_low;
+		ec->rx_coalesce_usecs_high = c->usecs_high;
+	}
+
+	return 0;
+}
+
+static int stmmac_set_coalesce(struct net_device *dev,
+			       struct ethtool_coalesce *ec)
+{
+	struct stmmac_priv *priv = netdev_priv(dev);
+	struct stmmac_rx_coal *c = &priv->rx_coal;
+	u32 max_usecs;
+
+	/* Frame based RX coalescing is not available on these cores */
+	if (ec->rx_max_coalesced_frames || ec->rx_max_coalesced_frames_low ||
+	    ec->rx_max_coalesced_frames_high)
+		return -EOPNOTSUPP;
+
+	if (!ec->tx_max_coalesced_frames || !ec->tx_coalesce_usecs ||
+	    ec->tx_max_coalesced_frames > priv->dma_tx_size / 2)
+		return -EINVAL;
+
+	if (ec->use_adaptive_rx_coalesce != ec->use_adaptive_tx_coalesce)
+		return -EINVAL;
+
+	if (ec->use_adaptive_rx_coalesce &&
+	    (ec->pkt_rate_low >= ec->pkt_rate_high ||
+	     !ec->rate_sample_interval))
+		return -EINVAL;
+
+	if (priv->use_riwt) {
+		max_usecs = stmmac_riwt2usec(priv, STMMAC_RIWT_MAX);
+		if (ec->rx_coalesce_usecs > max_usecs ||
+		    ec->rx_coalesce_usecs_low > ec->rx_coalesce_usecs_high ||
+		    ec->rx_coalesce_usecs_high > max_usecs)
+			return -EINVAL;
+		c->usecs = ec->rx_coalesce_usecs;
+		c->usecs_low = ec->rx_coalesce_usecs_low;
+		c->usecs_high = ec->rx_coalesce_usecs_high;
+	} else if (ec->rx_coalesce_usecs || ec->rx_coalesce_usecs_low ||
+		   ec->rx_coalesce_usecs_high)
+		return -EOPNOTSUPP;
+
+	priv->tx_coal_frames = ec->tx_max_coalesced_frames;
+	priv->tx_coal_usecs = ec->tx_coalesce_usecs;
+	c->adaptive = ec->use_adaptive_rx_coalesce;
+	c->pkt_rate_low = ec->pkt_rate_low;
+	c->pkt_rate_high = ec->pkt_rate_high;
+	c->sample_interval = ec->rate_sample_interval;
+
+	stmmac_start_coal(priv);
+
+	return 0;
+}
+
 static struct ethtool_ops stmmac_ethtool_ops = {
 	.begin = stmmac_check_if_running,
 	.get_drvinfo = stmmac_ethtool_getdrvinfo,
@@ -540,6 +619,8 @@ static struct ethtool_ops stmmac_ethtool_ops = {
 	.set_tso = ethtool_op_set_tso,
 	.get_eee = ethtool_op_get_eee,
 	.set_eee = ethtool_op_set_eee,
+	.get_coalesce = stmmac_get_coalesce,
+	.set_coalesce = stmmac_set_coalesce,
 };
 
 void stmmac_set_ethtool_ops(struct net_device *netdev)
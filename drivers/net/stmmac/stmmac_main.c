@@ -127,6 +127,17 @@ static int buf_sz = DMA_BUFFER_SIZE;
 module_param(buf_sz, int, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(buf_sz, "DMA buffer size");
 
+/* Frames up to this size are copied into a new skb, so that the RX
+ * buffer can be given back to the DMA as it is */
+#define STMMAC_RX_COPYBREAK	256
+static int rx_copybreak = STMMAC_RX_COPYBREAK;
+module_param(rx_copybreak, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rx_copybreak, "Copy only frames shorter than this size");
+
+/* In page mode, bytes copied into the skb linear area (the rest of the
+ * frame is attached as a page fragment) */
+#define STMMAC_RX_HDR_LEN	128
+
 static const u32 default_msg_level = (NETIF_MSG_DRV | NETIF_MSG_PROBE |
 				      NETIF_MSG_LINK | NETIF_MSG_IFUP |
 				      NETIF_MSG_IFDOWN | NETIF_MSG_TIMER);
@@ -136,6 +147,23 @@ module_param(eee_timer, int, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(eee_timer, "LPI tx expiration time in msec");
 #define STMMAC_LPI_TIMER(x) (jiffies + msecs_to_jiffies(x))
 
+/* Interrupt coalescing defaults (see ethtool -C). On TX, the completion
+ * interrupt is raised every tx_frames frames; a timer cleans the ring
+ * if the traffic stops before. On the GMAC, the RX interrupt is driven
+ * by the DMA RX watchdog, tuned from the packet rate. */
+#define STMMAC_TX_FRAMES	16
+#define STMMAC_COAL_TX_TIMER	1000
+#define STMMAC_COAL_TIMER(x) (jiffies + usecs_to_jiffies(x))
+static int tx_frames = STMMAC_TX_FRAMES;
+module_param(tx_frames, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(tx_frames, "Number of frames per TX completion interrupt");
+
+#define STMMAC_RX_COAL_USECS	50
+#define STMMAC_RX_COAL_LOW	10
+#define STMMAC_RX_COAL_HIGH	200
+#define STMMAC_PKT_RATE_LOW	1000
+#define STMMAC_PKT_RATE_HIGH	20000
+
 static irqreturn_t stmmac_interrupt(int irq, void *dev_id);
 static netdev_tx_t stmmac_xmit(struct sk_buff *skb, struct net_device *dev);
 #ifdef CONFIG_STMMAC_DEBUG_FS
@@ -164,6 +192,8 @@ static void stmmac_verify_args(void)
 		flow_ctrl = FLOW_OFF;
 	if (unlikely((pause < 0) || (pause > 0xffff)))
 		pause = PAUSE_TIME;
+	if (unlikely(tx_frames <= 0))
+		tx_frames = STMMAC_TX_FRAMES;
 }
 
 #if defined(STMMAC_XMIT_DEBUG) || defined(STMMAC_RX_DEBUG)
@@ -467,14 +497,49 @@ static int stmmac_set_bfsize(int mtu, int bufsize)
 	return ret;
 }
 
+/**
+ * stmmac_rx_page_alloc
+ * @priv: private driver structure
+ * @rp: RX page slot to fill
+ * Description: it allocates and maps a new page for the RX ring. The page
+ * stays mapped for as long as it is recycled by the driver.
+ */
+static int stmmac_rx_page_alloc(struct stmmac_priv *priv,
+				struct stmmac_rx_page *rp, gfp_t gfp)
+{
+	rp->page = alloc_page(gfp);
+	if (unlikely(rp->page == NULL))
+		return -ENOMEM;
+
+	rp->dma = dma_map_page(priv->device, rp->page, 0, PAGE_SIZE,
+			       DMA_FROM_DEVICE);
+	rp->offset = 0;
+	rp->sync_len[0] = 0;
+	rp->sync_len[1] = 0;
+	priv->xstats.rx_page_alloc++;
+
+	return 0;
+}
+
+static void stmmac_rx_page_free(struct stmmac_priv *priv,
+				struct stmmac_rx_page *rp)
+{
+	if (rp->page) {
+		dma_unmap_page(priv->device, rp->dma, PAGE_SIZE,
+			       DMA_FROM_DEVICE);
+		put_page(rp->page);
+		rp->page = NULL;
+	}
+}
+
 /**
  * init_dma_desc_rings - init the RX/TX descriptor rings
  * @dev: net device structure
  * Description:  this function initializes the DMA RX/TX descriptors
  * and allocates the socket buffers. It suppors the chained and ring
- * modes.
+ * modes. It returns 0 or -ENOMEM, in which case nothing is left allocated.
  */
-static void init_dma_desc_rings(struct net_device *dev)
+static int init_dma_desc_rings(struct net_device *dev)
 {
 	int i;
 	struct stmmac_priv *priv = netdev_priv(dev);
@@ -499,13 +564,16 @@ static void init_dma_desc_rings(struct net_device *dev)
 	if (likely(priv->tm->enable))
 		dis_ic = 1;
 #endif
+	/* Same when the RX interrupt comes from the DMA watchdog */
+	if (priv->use_riwt)
+		dis_ic = 1;
 
 	DBG(probe, INFO, "stmmac: txsize %d, rxsize %d, bfsize %d\n",
 	    txsize, rxsize, bfsize);
 
 	priv->rx_skbuff_dma = kmalloc(rxsize * sizeof(dma_addr_t), GFP_KERNEL);
 	priv->rx_skbuff =
-	    kmalloc(sizeof(struct sk_buff *) * rxsize, GFP_KERNEL);
+	    kzalloc(sizeof(struct sk_buff *) * rxsize, GFP_KERNEL);
 	priv->dma_rx =
 	    (struct dma_desc *)dma_alloc_coherent(priv->device,
 						  rxsize *
@@ -514,6 +582,7 @@ static void init_dma_desc_rings(struct net_device *dev)
 						  GFP_KERNEL);
 	priv->tx_skbuff = kmalloc(sizeof(struct sk_buff *) * txsize,
 				       GFP_KERNEL);
+	priv->tx_map = kzalloc(txsize, GFP_KERNEL);
 	priv->dma_tx =
 	    (struct dma_desc *)dma_alloc_coherent(priv->device,
 						  txsize *
@@ -521,9 +590,24 @@ static void init_dma_desc_rings(struct net_device *dev)
 						  &priv->dma_tx_phy,
 						  GFP_KERNEL);
 
-	if ((priv->dma_rx == NULL) || (priv->dma_tx == NULL)) {
+	if ((priv->rx_skbuff_dma == NULL) || (priv->rx_skbuff == NULL) ||
+	    (priv->tx_skbuff == NULL) || (priv->tx_map == NULL) ||
+	    (priv->dma_rx == NULL) || (priv->dma_tx == NULL)) {
 		pr_err("%s:ERROR allocating the DMA Tx/Rx desc\n", __func__);
-		return;
+		goto err_free;
+	}
+
+	/* Headers of the TSO segments are built here, so the payload
+	 * can be sent straight from the original socket buffer */
+	priv->tso_hdr = NULL;
+	if (priv->dev->features & NETIF_F_TSO) {
+		priv->tso_hdr = dma_alloc_coherent(priv->device,
+						   txsize * STMMAC_TSO_HDR_SIZE,
+						   &priv->tso_hdr_phy,
+						   GFP_KERNEL);
+		if (priv->tso_hdr == NULL)
+			pr_warning("%s: no memory for TSO headers, using "
+				   "software segmentation\n", dev->name);
 	}
 
 	DBG(probe, INFO, "stmmac (%s) DMA desc: virt addr (Rx %p, "
@@ -532,12 +616,36 @@ static void init_dma_desc_rings(struct net_device *dev)
 	    (unsigned int)priv->dma_rx_phy, (unsigned int)priv->dma_tx_phy);
 
 	/* RX INITIALIZATION */
+	/* When two buffers fit in one page the RX ring works in page mode:
+	 * pages are recycled by the driver and stay mapped. */
+	priv->rx_page = NULL;
+	if (!des3_as_data_buf && (bfsize <= PAGE_SIZE / 2)) {
+		priv->rx_page = kcalloc(rxsize, sizeof(struct stmmac_rx_page),
+					GFP_KERNEL);
+		if (priv->rx_page == NULL)
+			pr_warning("%s: RX page mode not available\n",
+				   dev->name);
+	}
+
 	DBG(probe, INFO, "stmmac: SKB addresses:\n"
 			 "skb\t\tskb data\tdma data\n");
 
 	for (i = 0; i < rxsize; i++) {
 		struct dma_desc *p = priv->dma_rx + i;
 
+		if (priv->rx_page) {
+			struct stmmac_rx_page *rp = priv->rx_page + i;
+
+			priv->rx_skbuff[i] = NULL;
+			if (stmmac_rx_page_alloc(priv, rp, GFP_KERNEL)) {
+				pr_err("%s: Rx init fails; no page\n",
+				       __func__);
+				break;
+			}
+			p->des2 = rp->dma;
+			continue;
+		}
+
 		skb = __netdev_alloc_skb(dev, bfsize + NET_IP_ALIGN,
 					 GFP_KERNEL);
 		if (unlikely(skb == NULL)) {
@@ -585,6 +693,23 @@ static void init_dma_desc_rings(struct net_device *dev)
 		pr_info("TX descriptor ring:\n");
 		display_ring(priv->dma_tx, txsize);
 	}
+
+	return 0;
+
+err_free:
+	if (priv->dma_tx)
+		dma_free_coherent(priv->device, txsize * sizeof(struct dma_desc),
+				  priv->dma_tx, priv->dma_tx_phy);
+	if (priv->dma_rx)
+		dma_free_coherent(priv->device, rxsize * sizeof(struct dma_desc),
+				  priv->dma_rx, priv->dma_rx_phy);
+	kfree(priv->rx_skbuff_dma);
+	kfree(priv->rx_skbuff);
+	kfree(priv->tx_skbuff);
+	kfree(priv->tx_map);
+	priv->tx_map = NULL;
+
+	return -ENOMEM;
 }
 
 static void dma_free_rx_skbufs(struct stmmac_priv *priv)
@@ -592,6 +717,8 @@ static void dma_free_rx_skbufs(struct stmmac_priv *priv)
 	int i;
 
 	for (i = 0; i < priv->dma_rx_size; i++) {
+		if (priv->rx_page)
+			stmmac_rx_page_free(priv, priv->rx_page + i);
 		if (priv->rx_skbuff[i]) {
 			dma_unmap_single(priv->device, priv->rx_skbuff_dma[i],
 					 priv->dma_buf_sz, DMA_FROM_DEVICE);
@@ -601,17 +728,43 @@ static void dma_free_rx_skbufs(struct stmmac_priv *priv)
 	}
 }
 
+/**
+ * stmmac_tx_unmap
+ * @priv: private driver structure
+ * @entry: TX descriptor index
+ * Description: it releases the DMA mapping of the buffer attached to
+ * the TX descriptor, according to the way it has been mapped.
+ */
+static void stmmac_tx_unmap(struct stmmac_priv *priv, unsigned int entry)
+{
+	struct dma_desc *p = priv->dma_tx + entry;
+
+	if (!p->des2)
+		return;
+
+	switch (priv->tx_map[entry]) {
+	case STMMAC_TX_MAP_PAGE:
+		dma_unmap_page(priv->device, p->des2,
+			       priv->hw->desc->get_tx_len(p), DMA_TO_DEVICE);
+		break;
+	case STMMAC_TX_MAP_NONE:
+		break;
+	default:
+		dma_unmap_single(priv->device, p->des2,
+				 priv->hw->desc->get_tx_len(p), DMA_TO_DEVICE);
+		break;
+	}
+	p->des2 = 0;
+	priv->tx_map[entry] = STMMAC_TX_MAP_SINGLE;
+}
+
 static void dma_free_tx_skbufs(struct stmmac_priv *priv)
 {
 	int i;
 
 	for (i = 0; i < priv->dma_tx_size; i++) {
+		stmmac_tx_unmap(priv, i);
 		if (priv->tx_skbuff[i] != NULL) {
-			struct dma_desc *p = priv->dma_tx + i;
-			if (p->des2)
-				dma_unmap_single(priv->device, p->des2,
-						 priv->hw->desc->get_tx_len(p),
-						 DMA_TO_DEVICE);
 			dev_kfree_skb_any(priv->tx_skbuff[i]);
 			priv->tx_skbuff[i] = NULL;
 		}
@@ -632,9 +785,15 @@ static void free_dma_desc_resources(struct stmmac_priv *priv)
 	dma_free_coherent(priv->device,
 			  priv->dma_rx_size * sizeof(struct dma_desc),
 			  priv->dma_rx, priv->dma_rx_phy);
+	if (priv->tso_hdr)
+		dma_free_coherent(priv->device,
+				  priv->dma_tx_size * STMMAC_TSO_HDR_SIZE,
+				  priv->tso_hdr, priv->tso_hdr_phy);
 	kfree(priv->rx_skbuff_dma);
 	kfree(priv->rx_skbuff);
+	kfree(priv->rx_page);
 	kfree(priv->tx_skbuff);
+	kfree(priv->tx_map);
 }
 
 /**
@@ -698,10 +857,7 @@ static void stmmac_tx(struct stmmac_priv *priv)
 		TX_DBG("%s: curr %d, dirty %d\n", __func__,
 			priv->cur_tx, priv->dirty_tx);
 
-		if (likely(p->des2))
-			dma_unmap_single(priv->device, p->des2,
-					 priv->hw->desc->get_tx_len(p),
-					 DMA_TO_DEVICE);
+		stmmac_tx_unmap(priv, entry);
 		priv->hw->ring->clean_desc3(p);
 
 		if (likely(skb != NULL)) {
@@ -710,7 +866,8 @@ static void stmmac_tx(struct stmmac_priv *priv)
 			 * we add this skb back into the pool,
 			 * if it's the right size.
 			 */
-			if ((skb_queue_len(&priv->rx_recycle) <
+			if (!priv->rx_page &&
+			    (skb_queue_len(&priv->rx_recycle) <
 				priv->dma_rx_size) &&
 				skb_recycle_check(skb, priv->dma_buf_sz))
 				__skb_queue_head(&priv->rx_recycle, skb);
@@ -742,6 +899,147 @@ static void stmmac_tx(struct stmmac_priv *priv)
 	spin_unlock(&priv->tx_lock);
 }
 
+/* Upper bound (MHz) of the CSR clock range encoded by plat->clk_csr,
+ * used to convert the RIWT units (256 CSR clock cycles) into usecs. */
+static const u32 stmmac_csr_mhz[] = { 100, 150, 35, 60, 250, 300 };
+
+static u32 stmmac_csr_clk(struct stmmac_priv *priv)
+{
+	int csr = priv->plat->clk_csr;
+
+	if (csr < 0 || csr >= ARRAY_SIZE(stmmac_csr_mhz))
+		return 100;
+	return stmmac_csr_mhz[csr];
+}
+
+u32 stmmac_usec2riwt(struct stmmac_priv *priv, u32 usecs)
+{
+	u32 riwt = (usecs * stmmac_csr_clk(priv)) / 256;
+
+	return clamp_t(u32, riwt, STMMAC_RIWT_MIN, STMMAC_RIWT_MAX);
+}
+
+u32 stmmac_riwt2usec(struct stmmac_priv *priv, u32 riwt)
+{
+	return (riwt * 256) / stmmac_csr_clk(priv);
+}
+
+/**
+ * stmmac_set_rx_coalesce
+ * @priv: private device pointer
+ * @usecs: RX interrupt delay
+ * Description: program the DMA RX watchdog. The RX descriptors are
+ *  initialised without the interrupt on completion in this mode, so
+ *  the watchdog is never left at zero (that would stop the RX IRQ).
+ */
+void stmmac_set_rx_coalesce(struct stmmac_priv *priv, u32 usecs)
+{
+	u32 riwt = stmmac_usec2riwt(priv, usecs);
+
+	if (riwt != priv->rx_riwt) {
+		priv->rx_riwt = riwt;
+		priv->hw->dma->rx_watchdog(priv->ioaddr, riwt);
+	}
+}
+
+/* Pick the RX delay linearly between the low and high values */
+static u32 stmmac_rx_coal_usecs(struct stmmac_rx_coal *c, u32 rate)
+{
+	u64 usecs;
+
+	if (rate <= c->pkt_rate_low || c->pkt_rate_high <= c->pkt_rate_low)
+		return c->usecs_low;
+	if (rate >= c->pkt_rate_high)
+		return c->usecs_high;
+
+	usecs = (u64)(c->usecs_high - c->usecs_low) * (rate - c->pkt_rate_low);
+	do_div(usecs, c->pkt_rate_high - c->pkt_rate_low);
+
+	return c->usecs_low + (u32)usecs;
+}
+
+/**
+ * stmmac_rx_coal_timer
+ * @arg : data hook
+ * Description:
+ *  adaptive coalescing: sample the RX/TX packet rate and retune the RX
+ *  watchdog and the TX interrupt frequency. At low rate every frame
+ *  raises its own interrupt (low latency), at high rate the interrupts
+ *  are batched.
+ */
+static void stmmac_rx_coal_timer(unsigned long arg)
+{
+	struct stmmac_priv *priv = (struct stmmac_priv *)arg;
+	struct stmmac_rx_coal *c = &priv->rx_coal;
+	struct net_device_stats *stats = &priv->dev->stats;
+	u32 interval = max_t(u32, c->sample_interval, 1);
+	u32 rx_rate, tx_rate;
+
+	rx_rate = (stats->rx_packets - c->last_rx) / interval;
+	tx_rate = (stats->tx_packets - c->last_tx) / interval;
+	c->last_rx = stats->rx_packets;
+	c->last_tx = stats->tx_packets;
+
+	if (!c->adaptive)
+		return;
+
+	if (priv->use_riwt)
+		stmmac_set_rx_coalesce(priv, stmmac_rx_coal_usecs(c, rx_rate));
+
+	if (tx_rate < c->pkt_rate_low)
+		priv->tx_coal_cur = 1;
+	else
+		priv->tx_coal_cur = priv->tx_coal_frames;
+
+	mod_timer(&priv->rx_coal_timer, jiffies + interval * HZ);
+}
+
+/**
+ * stmmac_start_coal
+ * @priv: private device pointer
+ * Description: apply the current coalescing parameters; the adaptive
+ *  sampling is (re)started when enabled.
+ */
+void stmmac_start_coal(struct stmmac_priv *priv)
+{
+	struct stmmac_rx_coal *c = &priv->rx_coal;
+
+	del_timer_sync(&priv->rx_coal_timer);
+
+	priv->tx_coal_cur = priv->tx_coal_frames;
+	if (priv->use_riwt)
+		stmmac_set_rx_coalesce(priv, c->adaptive ? c->usecs_low :
+				       c->usecs);
+
+	if (c->adaptive) {
+		c->last_rx = priv->dev->stats.rx_packets;
+		c->last_tx = priv->dev->stats.tx_packets;
+		mod_timer(&priv->rx_coal_timer,
+			  jiffies + max_t(u32, c->sample_interval, 1) * HZ);
+	}
+}
+
+/* TX ring cleaning when no completion interrupt is expected soon */
+static void stmmac_tx_coal_timer(unsigned long arg)
+{
+	struct stmmac_priv *priv = (struct stmmac_priv *)arg;
+
+	stmmac_tx(priv);
+}
+
+/* Raise the TX completion interrupt only every tx_coal_cur frames */
+static inline void stmmac_tx_coal(struct stmmac_priv *priv,
+				  struct dma_desc *desc)
+{
+	if (++priv->tx_count_frames < priv->tx_coal_cur) {
+		priv->hw->desc->clear_tx_ic(desc);
+		if (!timer_pending(&priv->tx_coal_timer))
+			mod_timer(&priv->tx_coal_timer,
+				  STMMAC_COAL_TIMER(priv->tx_coal_usecs));
+	} else
+		priv->tx_count_frames = 0;
+}
+
 static inline void stmmac_enable_irq(struct stmmac_priv *priv)
 {
 #ifdef CONFIG_STMMAC_TIMER
@@ -1016,6 +1314,15 @@ static int stmmac_open(struct net_device *dev)
 	} else
 		priv->tm->enable = 1;
 #endif
+	/* The RX watchdog is only available on the GMAC and it is not
+	 * used along with the external timer. */
+	priv->use_riwt = priv->plat->has_gmac && priv->hw->dma->rx_watchdog;
+#ifdef CONFIG_STMMAC_TIMER
+	if (priv->tm->enable)
+		priv->use_riwt = 0;
+#endif
+	priv->rx_riwt = 0;
+
 	ret = stmmac_init_phy(dev);
 	if (unlikely(ret)) {
 		pr_err("%s: Cannot attach to PHY (error: %d)\n", __func__, ret);
@@ -1026,14 +1333,16 @@ static int stmmac_open(struct net_device *dev)
 	priv->dma_tx_size = STMMAC_ALIGN(dma_txsize);
 	priv->dma_rx_size = STMMAC_ALIGN(dma_rxsize);
 	priv->dma_buf_sz = STMMAC_ALIGN(buf_sz);
-	init_dma_desc_rings(dev);
+	ret = init_dma_desc_rings(dev);
+	if (ret < 0)
+		goto open_error;
 
 	/* DMA initialization and SW reset */
 	ret = priv->hw->dma->init(priv->ioaddr, priv->plat->pbl,
 				  priv->dma_tx_phy, priv->dma_rx_phy);
 	if (ret < 0) {
 		pr_err("%s: DMA initialization failed\n", __func__);
-		goto open_error;
+		goto open_error_rings;
 	}
 
 	/* Copy the MAC addr into the HW  */
@@ -1052,7 +1361,7 @@ static int stmmac_open(struct net_device *dev)
 	if (unlikely(ret < 0)) {
 		pr_err("%s: ERROR: allocating the IRQ %d (error: %d)\n",
 		       __func__, dev->irq, ret);
-		goto open_error;
+		goto open_error_rings;
 	}
 
 	/* Request the Wake IRQ in case of another line is used for WoL */
@@ -1089,6 +1398,10 @@ static int stmmac_open(struct net_device *dev)
 
 	stmmac_mmc_setup(priv);
 
+	/* Interrupt coalescing (RX watchdog set after the DMA reset) */
+	priv->tx_count_frames = 0;
+	stmmac_start_coal(priv);
+
 #ifdef CONFIG_STMMAC_DEBUG_FS
 	ret = stmmac_init_fs(dev);
 	if (ret < 0)
@@ -1128,6 +1441,9 @@ open_error_lpiirq:
 open_error_wolirq:
 	free_irq(dev->irq, dev);
 
+open_error_rings:
+	free_dma_desc_resources(priv);
+
 open_error:
 #ifdef CONFIG_STMMAC_TIMER
 	kfree(priv->tm);
@@ -1150,6 +1466,7 @@ static int stmmac_release(struct net_device *dev)
 
 	if (priv->eee_enabled)
 		del_timer_sync(&priv->eee_ctrl_timer);
+	del_timer_sync(&priv->rx_coal_timer);
 
 	/* Stop and disconnect the PHY */
 	if (priv->phydev) {
@@ -1167,6 +1484,7 @@ static int stmmac_release(struct net_device *dev)
 		kfree(priv->tm);
 #endif
 	napi_disable(&priv->napi);
+	del_timer_sync(&priv->tx_coal_timer);
 	skb_queue_purge(&priv->rx_recycle);
 
 	/* Free the IRQ lines */
@@ -1236,6 +1554,179 @@ sw_tso_end:
 	return NETDEV_TX_OK;
 }
 
+/**
+ * stmmac_tso_xmit:
+ * @priv: private driver structure
+ * @skb : the TCPv4 GSO socket buffer
+ * Description: segmentation offload for the cores with TX checksum
+ * insertion. For every segment the MAC/IP/TCP headers are rebuilt in a
+ * coherent slot reserved for the descriptor and the payload is mapped
+ * straight from the linear area and the fragments of the original skb.
+ * The COE then computes both the IP and the TCP checksums.
+ */
+static netdev_tx_t stmmac_tso_xmit(struct stmmac_priv *priv,
+				   struct sk_buff *skb)
+{
+	struct skb_shared_info *shinfo = skb_shinfo(skb);
+	unsigned int txsize = priv->dma_tx_size;
+	int ip_off = skb_network_offset(skb);
+	int tcp_off = skb_transport_offset(skb);
+	int hdr_len = tcp_off + tcp_hdrlen(skb);
+	int payload = skb->len - hdr_len;
+	int max_len, needed, seg;
+	int src_frag = -1;
+	int src_off = hdr_len;
+	int src_len = skb_headlen(skb) - hdr_len;
+	unsigned int entry = 0;
+	struct dma_desc *desc = NULL, *first = NULL;
+	u16 ip_id = ntohs(ip_hdr(skb)->id);
+	u32 seq = ntohl(tcp_hdr(skb)->seq);
+
+	/* Keep every buffer within the first descriptor buffer so
+	 * that this works in both ring and chained modes */
+	if (priv->plat->enh_desc)
+		max_len = BUF_SIZE_4KiB;
+	else
+		max_len = BUF_SIZE_2KiB - 1;
+
+	/* One header per segment, plus the payload pieces: a segment
+	 * takes one piece per max_len bytes, every segment boundary can
+	 * split one more source buffer, and every source buffer is
+	 * itself cut at max_len */
+	needed = shinfo->gso_segs *
+			(1 + DIV_ROUND_UP(shinfo->gso_size, max_len)) +
+		 shinfo->nr_frags * DIV_ROUND_UP(PAGE_SIZE, max_len) + 1 +
+		 DIV_ROUND_UP(skb_headlen(skb), max_len);
+
+	/* That would never fit in the ring, however long we waited */
+	if (unlikely(needed >= txsize)) {
+		if (shinfo->gso_segs < txsize)
+			return stmmac_sw_tso(priv, skb);
+		priv->dev->stats.tx_dropped++;
+		dev_kfree_skb(skb);
+		return NETDEV_TX_OK;
+	}
+
+	spin_lock(&priv->tx_lock);
+
+	if (unlikely(stmmac_tx_avail(priv) < needed)) {
+		netif_stop_queue(priv->dev);
+		spin_unlock(&priv->tx_lock);
+		return NETDEV_TX_BUSY;
+	}
+
+	for (seg = 0; payload > 0; seg++) {
+		int seg_len = min(payload, (int)shinfo->gso_size);
+		char *hdr;
+		struct iphdr *iph;
+		struct tcphdr *th;
+
+		entry = priv->cur_tx % txsize;
+		desc = priv->dma_tx + entry;
+		hdr = priv->tso_hdr + entry * STMMAC_TSO_HDR_SIZE;
+
+		memcpy(hdr, skb->data, hdr_len);
+		iph = (struct iphdr *)(hdr + ip_off);
+		iph->tot_len = htons(hdr_len - ip_off + seg_len);
+		iph->id = htons(ip_id + seg);
+		iph->check = 0;
+		th = (struct tcphdr *)(hdr + tcp_off);
+		th->seq = htonl(seq);
+		th->check = 0;
+		if (seg)
+			th->cwr = 0;
+		if (payload > seg_len) {
+			th->fin = 0;
+			th->psh = 0;
+		}
+
+		desc->des2 = priv->tso_hdr_phy + entry * STMMAC_TSO_HDR_SIZE;
+		priv->tx_map[entry] = STMMAC_TX_MAP_NONE;
+		priv->tx_skbuff[entry] = NULL;
+		priv->hw->desc->prepare_tx_desc(desc, 1, hdr_len, 1);
+		if (first == NULL)
+			first = desc;
+		else {
+			wmb();
+			priv->hw->desc->set_tx_owner(desc);
+		}
+		priv->cur_tx++;
+
+		payload -= seg_len;
+		seq += seg_len;
+
+		while (seg_len > 0) {
+			int len;
+
+			while (src_len == 0) {
+				src_frag++;
+				src_off = shinfo->frags[src_frag].page_offset;
+				src_len = shinfo->frags[src_frag].size;
+			}
+			len = min(min(seg_len, src_len), max_len);
+
+			entry = priv->cur_tx % txsize;
+			desc = priv->dma_tx + entry;
+
+			if (src_frag < 0) {
+				desc->des2 = dma_map_single(priv->device,
+							    skb->data + src_off,
+							    len, DMA_TO_DEVICE);
+				priv->tx_map[entry] = STMMAC_TX_MAP_SINGLE;
+			} else {
+				desc->des2 = dma_map_page(priv->device,
+						shinfo->frags[src_frag].page,
+						src_off, len, DMA_TO_DEVICE);
+				priv->tx_map[entry] = STMMAC_TX_MAP_PAGE;
+			}
+			priv->tx_skbuff[entry] = NULL;
+			priv->hw->desc->prepare_tx_desc(desc, 0, len, 1);
+			wmb();
+			priv->hw->desc->set_tx_owner(desc);
+			priv->cur_tx++;
+
+			src_off += len;
+			src_len -= len;
+			seg_len -= len;
+		}
+
+		/* Interrupt on completion only for the latest segment */
+		priv->hw->desc->close_tx_desc(desc);
+		if (payload)
+			priv->hw->desc->clear_tx_ic(desc);
+	}
+	stmmac_tx_coal(priv, desc);
+
+#ifdef CONFIG_STMMAC_TIMER
+	/* Clean IC while using timer */
+	if (likely(priv->tm->enable))
+		priv->hw->desc->clear_tx_ic(desc);
+#endif
+	/* The skb is released once its latest segment has gone */
+	priv->tx_skbuff[entry] = skb;
+
+	wmb();
+
+	/* To avoid raise condition */
+	priv->hw->desc->set_tx_owner(first);
+
+	priv->xstats.tx_tso_frames++;
+	priv->xstats.tx_tso_segs += seg;
+
+	if (unlikely(stmmac_tx_avail(priv) <= (MAX_SKB_FRAGS + 1))) {
+		TX_DBG("%s: stop transmitted packets\n", __func__);
+		netif_stop_queue(priv->dev);
+	}
+
+	priv->dev->stats.tx_bytes += skb->len + (seg - 1) * hdr_len;
+
+	priv->hw->dma->enable_dma_transmission(priv->ioaddr);
+
+	spin_unlock(&priv->tx_lock);
+
+	return NETDEV_TX_OK;
+}
+
 /**
  *  stmmac_xmit:
  *  @skb : the socket buffer
@@ -1276,8 +1767,14 @@ static netdev_tx_t stmmac_xmit(struct sk_buff *skb, struct net_device *dev)
 		       !skb_is_gso(skb) ? "isn't" : "is");
 #endif
 
-	if (unlikely(skb_is_gso(skb)))
+	if (unlikely(skb_is_gso(skb))) {
+		if (priv->tso_hdr && !priv->no_csum_insertion &&
+		    (skb_shinfo(skb)->gso_type & SKB_GSO_TCPV4) &&
+		    (skb_transport_offset(skb) + tcp_hdrlen(skb) <=
+		     STMMAC_TSO_HDR_SIZE))
+			return stmmac_tso_xmit(priv, skb);
 		return stmmac_sw_tso(priv, skb);
+	}
 
 	spin_lock(&priv->tx_lock);
 
@@ -1321,6 +1818,7 @@ static netdev_tx_t stmmac_xmit(struct sk_buff *skb, struct net_device *dev)
 		desc->des2 = dma_map_page(priv->device, frag->page,
 					  frag->page_offset,
 					  len, DMA_TO_DEVICE);
+		priv->tx_map[entry] = STMMAC_TX_MAP_PAGE;
 		priv->tx_skbuff[entry] = NULL;
 		priv->hw->desc->prepare_tx_desc(desc, 0, len, csum_insertion);
 		wmb();
@@ -1329,6 +1827,7 @@ static netdev_tx_t stmmac_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	/* Interrupt on completition only for the latest segment */
 	priv->hw->desc->close_tx_desc(desc);
+	stmmac_tx_coal(priv, desc);
 
 #ifdef CONFIG_STMMAC_TIMER
 	/* Clean IC while using timer */
@@ -1376,7 +1875,24 @@ static inline void stmmac_rx_refill(struct stmmac_priv *priv)
 
 	for (; priv->cur_rx - priv->dirty_rx > 0; priv->dirty_rx++) {
 		unsigned int entry = priv->dirty_rx % rxsize;
-		if (likely(priv->rx_skbuff[entry] == NULL)) {
+
+		if (priv->rx_page) {
+			struct stmmac_rx_page *rp = priv->rx_page + entry;
+			int half = rp->offset ? 1 : 0;
+
+			if (unlikely(rp->page == NULL)) {
+				if (stmmac_rx_page_alloc(priv, rp, GFP_ATOMIC))
+					break;
+			} else if (rp->sync_len[half]) {
+				/* Only the lines touched by the CPU have
+				 * to be given back to the device */
+				dma_sync_single_for_device(priv->device,
+					rp->dma + rp->offset,
+					rp->sync_len[half], DMA_FROM_DEVICE);
+				rp->sync_len[half] = 0;
+			}
+			(p + entry)->des2 = rp->dma + rp->offset;
+		} else if (likely(priv->rx_skbuff[entry] == NULL)) {
 			struct sk_buff *skb;
 
 			skb = __skb_dequeue(&priv->rx_recycle);
@@ -1404,6 +1920,63 @@ static inline void stmmac_rx_refill(struct stmmac_priv *priv)
 	}
 }
 
+/**
+ * stmmac_rx_page_skb
+ * @priv: private driver structure
+ * @entry: RX descriptor index
+ * @frame_len: length of the received frame
+ * Description: it builds the socket buffer for a frame received in page
+ * mode. Short frames are copied and the buffer is left in place, longer
+ * ones get their headers copied and the rest attached as a page fragment;
+ * the other half of the page is then used for the next frame if the stack
+ * has already released it.
+ */
+static struct sk_buff *stmmac_rx_page_skb(struct stmmac_priv *priv,
+					  unsigned int entry, int frame_len)
+{
+	struct stmmac_rx_page *rp = priv->rx_page + entry;
+	void *data = page_address(rp->page) + rp->offset;
+	int half = rp->offset ? 1 : 0;
+	struct sk_buff *skb;
+	int hlen;
+
+	dma_sync_single_for_cpu(priv->device, rp->dma + rp->offset,
+				frame_len, DMA_FROM_DEVICE);
+	rp->sync_len[half] = frame_len;
+	prefetch(data);
+
+	if (frame_len <= rx_copybreak)
+		hlen = frame_len;
+	else
+		hlen = min(frame_len, STMMAC_RX_HDR_LEN);
+
+	skb = netdev_alloc_skb_ip_align(priv->dev, hlen);
+	if (unlikely(skb == NULL))
+		return NULL;
+
+	memcpy(skb_put(skb, hlen), data, hlen);
+	if (hlen == frame_len) {
+		priv->xstats.rx_copybreak++;
+		return skb;
+	}
+
+	get_page(rp->page);
+	skb_add_rx_frag(skb, 0, rp->page, rp->offset + hlen,
+			frame_len - hlen);
+
+	if (page_count(rp->page) == 2) {
+		/* Only this skb and the ring use the page: flip */
+		rp->offset ^= PAGE_SIZE / 2;
+		priv->xstats.rx_page_reuse++;
+	} else {
+		/* The other half is still in use; leave the page
+		 * to the stack, a new one will be allocated */
+		stmmac_rx_page_free(priv, rp);
+	}
+
+	return skb;
+}
+
 static int stmmac_rx(struct stmmac_priv *priv, int limit)
 {
 	unsigned int rxsize = priv->dma_rx_size;
@@ -1451,20 +2024,36 @@ static int stmmac_rx(struct stmmac_priv *priv, int limit)
 				pr_debug("\tdesc: %p [entry %d] buff=0x%x\n",
 					p, entry, p->des2);
 #endif
-			skb = priv->rx_skbuff[entry];
-			if (unlikely(!skb)) {
-				pr_err("%s: Inconsistent Rx descriptor chain\n",
-					priv->dev->name);
-				priv->dev->stats.rx_dropped++;
-				break;
+			if (priv->rx_page) {
+				if (unlikely(!priv->rx_page[entry].page)) {
+					pr_err("%s: Inconsistent Rx descriptor "
+					       "chain\n", priv->dev->name);
+					priv->dev->stats.rx_dropped++;
+					break;
+				}
+				skb = stmmac_rx_page_skb(priv, entry,
+							 frame_len);
+				if (unlikely(!skb)) {
+					priv->dev->stats.rx_dropped++;
+					goto next;
+				}
+			} else {
+				skb = priv->rx_skbuff[entry];
+				if (unlikely(!skb)) {
+					pr_err("%s: Inconsistent Rx descriptor "
+					       "chain\n", priv->dev->name);
+					priv->dev->stats.rx_dropped++;
+					break;
+				}
+				prefetch(skb->data - NET_IP_ALIGN);
+				priv->rx_skbuff[entry] = NULL;
+
+				skb_put(skb, frame_len);
+				dma_unmap_single(priv->device,
+						 priv->rx_skbuff_dma[entry],
+						 priv->dma_buf_sz,
+						 DMA_FROM_DEVICE);
 			}
-			prefetch(skb->data - NET_IP_ALIGN);
-			priv->rx_skbuff[entry] = NULL;
-
-			skb_put(skb, frame_len);
-			dma_unmap_single(priv->device,
-					 priv->rx_skbuff_dma[entry],
-					 priv->dma_buf_sz, DMA_FROM_DEVICE);
 #ifdef STMMAC_RX_DEBUG
 			if (netif_msg_pktdata(priv)) {
 				pr_info(" frame received (%dbytes)", frame_len);
@@ -1486,6 +2075,7 @@ static int stmmac_rx(struct stmmac_priv *priv, int limit)
 			priv->dev->stats.rx_bytes += frame_len;
 			priv->dev->last_rx = jiffies;
 		}
+next:
 		entry = next_entry;
 		p = p_next;	/* use prefetched values */
 	}
@@ -2036,6 +2626,9 @@ struct stmmac_priv *stmmac_dvr_probe(struct device *device,
 
 	ndev->features |= NETIF_F_SG | NETIF_F_HIGHDMA |
 		NETIF_F_IP_CSUM | NETIF_F_IPV6_CSUM;
+	/* The TX COE is needed to build the TSO segments in HW */
+	if (priv->plat->tx_coe)
+		ndev->features |= NETIF_F_TSO;
 	ndev->watchdog_timeo = msecs_to_jiffies(watchdog);
 #ifdef STMMAC_VLAN_TAG_USED
 	/* Both mac100 and gmac support receive VLAN tag detection */
@@ -2048,6 +2641,23 @@ struct stmmac_priv *stmmac_dvr_probe(struct device *device,
 
 	netif_napi_add(ndev, &priv->napi, stmmac_poll, 64);
 
+	/* Interrupt coalescing defaults */
+	priv->tx_coal_frames = tx_frames;
+	priv->tx_coal_usecs = STMMAC_COAL_TX_TIMER;
+	priv->rx_coal.usecs = STMMAC_RX_COAL_USECS;
+	priv->rx_coal.adaptive = 1;
+	priv->rx_coal.usecs_low = STMMAC_RX_COAL_LOW;
+	priv->rx_coal.usecs_high = STMMAC_RX_COAL_HIGH;
+	priv->rx_coal.pkt_rate_low = STMMAC_PKT_RATE_LOW;
+	priv->rx_coal.pkt_rate_high = STMMAC_PKT_RATE_HIGH;
+	priv->rx_coal.sample_interval = 1;
+	init_timer(&priv->tx_coal_timer);
+	priv->tx_coal_timer.function = stmmac_tx_coal_timer;
+	priv->tx_coal_timer.data = (unsigned long)priv;
+	init_timer(&priv->rx_coal_timer);
+	priv->rx_coal_timer.function = stmmac_rx_coal_timer;
+	priv->rx_coal_timer.data = (unsigned long)priv;
+
 	spin_lock_init(&priv->lock);
 	spin_lock_init(&priv->tx_lock);
 
@@ -2114,6 +2724,8 @@ int stmmac_suspend(struct net_device *ndev)
 	if (likely(priv->tm->enable))
 		dis_ic = 1;
 #endif
+	if (priv->use_riwt)
+		dis_ic = 1;
 	napi_disable(&priv->napi);
 
 	/* Stop TX/RX DMA */
@@ -2131,6 +2743,11 @@ int stmmac_suspend(struct net_device *ndev)
 		stmmac_set_mac(priv->ioaddr, false);
 
 	spin_unlock(&priv->lock);
+
+	/* Nothing can re-arm them now that the queue and NAPI are stopped */
+	del_timer_sync(&priv->rx_coal_timer);
+	del_timer_sync(&priv->tx_coal_timer);
+
 	return 0;
 }
 
@@ -2168,6 +2785,8 @@ int stmmac_resume(struct net_device *ndev)
 
 	spin_unlock(&priv->lock);
 
+	stmmac_start_coal(priv);
+
 	if (priv->phydev)
 		phy_start(priv->phydev);
 
@@ -2232,6 +2851,10 @@ static int __init stmmac_cmdline_opt(char *str)
 		} else if (!strncmp(opt, "pause:", 6)) {
 			if (strict_strtoul(opt + 6, 0, (unsigned long *)&pause))
 				goto err;
+		} else if (!strncmp(opt, "tx_frames:", 10)) {
+			if (strict_strtoul(opt + 10, 0,
+					   (unsigned long *)&tx_frames))
+				goto err;
 #ifdef CONFIG_STMMAC_TIMER
 		} else if (!strncmp(opt, "tmrate:", 7)) {
 			if (strict_strtoul(opt + 7, 0,
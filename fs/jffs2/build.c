@@ -84,6 +84,24 @@ static void jffs2_build_inode_pass1(struct jffs2_sb_info *c,
 	}
 }
 
+/* Inodes whose nodes were all taken from trusted summaries need not be
+   CRC-checked by the GC thread before it can start collecting garbage */
+static void jffs2_build_trust_inode(struct jffs2_sb_info *c,
+				    struct jffs2_inode_cache *ic)
+{
+	struct jffs2_raw_node_ref *raw;
+
+	if (!ic->pino_nlink || ic->state != INO_STATE_UNCHECKED)
+		return;
+
+	for (raw = ic->nodes; raw != (void *)ic; raw = raw->next_in_ino) {
+		if (ref_flags(raw) == REF_UNCHECKED)
+			return;
+	}
+
+	ic->state = INO_STATE_CHECKEDABSENT;
+}
+
 /* Scan plan:
  - Scan physical nodes. Build map of inodes/dirents. Allocate inocaches as we go
  - Scan directory tree from top down, setting nlink in inocaches
@@ -162,6 +180,8 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 			jffs2_free_full_dirent(fd);
 		}
 		ic->scan_dents = NULL;
+		if (c->mount_opts.trust_summary)
+			jffs2_build_trust_inode(c, ic);
 		cond_resched();
 	}
 	jffs2_build_xattr_subsystem(c);
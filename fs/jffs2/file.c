@@ -38,10 +38,30 @@ int jffs2_fsync(struct file *filp, struct dentry *dentry, int datasync)
 	return 0;
 }
 
+static int jffs2_open(struct inode *inode, struct file *filp)
+{
+	int ret;
+
+	ret = generic_file_open(inode, filp);
+	if (ret)
+		return ret;
+
+	/* Keep the fragtree in core for as long as the file is open */
+	return jffs2_frags_get(JFFS2_SB_INFO(inode->i_sb),
+			       JFFS2_INODE_INFO(inode));
+}
+
+static int jffs2_release(struct inode *inode, struct file *filp)
+{
+	jffs2_frags_put(JFFS2_SB_INFO(inode->i_sb), JFFS2_INODE_INFO(inode));
+	return 0;
+}
+
 const struct file_operations jffs2_file_operations =
 {
 	.llseek =	generic_file_llseek,
-	.open =		generic_file_open,
+	.open =		jffs2_open,
+	.release =	jffs2_release,
  	.read =		do_sync_read,
  	.aio_read =	generic_file_aio_read,
  	.write =	do_sync_write,
@@ -14,6 +14,7 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/list.h>
+#include <linux/mm.h>
 #include <linux/mtd/mtd.h>
 #include <linux/pagemap.h>
 #include <linux/slab.h>
@@ -21,9 +22,12 @@
 #include <linux/vfs.h>
 #include <linux/crc32.h>
 #include <linux/smp_lock.h>
+#include <linux/parser.h>
 #include "nodelist.h"
 
 static int jffs2_flash_setup(struct jffs2_sb_info *c);
+static void jffs2_frags_mark_cold(struct jffs2_inode_info *f);
+static void jffs2_frags_unlist(struct jffs2_inode_info *f);
 
 int jffs2_do_setattr (struct inode *inode, struct iattr *iattr)
 {
@@ -85,6 +89,15 @@ int jffs2_do_setattr (struct inode *inode, struct iattr *iattr)
 		return ret;
 	}
 	mutex_lock(&f->sem);
+	ret = jffs2_build_frags(c, f);
+	if (ret) {
+		jffs2_complete_reservation(c);
+		jffs2_free_raw_inode(ri);
+		mutex_unlock(&f->sem);
+		if (S_ISLNK(inode->i_mode))
+			kfree(mdata);
+		return ret;
+	}
 	ivalid = iattr->ia_valid;
 
 	ri->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
@@ -234,6 +247,7 @@ void jffs2_clear_inode (struct inode *inode)
 	struct jffs2_inode_info *f = JFFS2_INODE_INFO(inode);
 
 	D1(printk(KERN_DEBUG "jffs2_clear_inode(): ino #%lu mode %o\n", inode->i_ino, inode->i_mode));
+	jffs2_frags_unlist(f);
 	jffs2_do_clear_inode(c, f);
 }
 
@@ -340,6 +354,7 @@ struct inode *jffs2_iget(struct super_block *sb, unsigned long ino)
 		printk(KERN_WARNING "jffs2_read_inode(): Bogus imode %o for ino %lu\n", inode->i_mode, (unsigned long)inode->i_ino);
 	}
 
+	jffs2_frags_mark_cold(f);
 	mutex_unlock(&f->sem);
 
 	D1(printk(KERN_DEBUG "jffs2_read_inode() returning\n"));
@@ -377,9 +392,56 @@ void jffs2_dirty_inode(struct inode *inode)
 	jffs2_do_setattr(inode, &iattr);
 }
 
+enum {
+	Opt_trust_summary,
+	Opt_err,
+};
+
+static const match_table_t tokens = {
+	{Opt_trust_summary, "trust_summary"},
+	{Opt_err, NULL},
+};
+
+static int jffs2_parse_options(struct jffs2_mount_opts *opts, char *data)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *p;
+
+	if (!data)
+		return 0;
+
+	while ((p = strsep(&data, ","))) {
+		if (!*p)
+			continue;
+
+		switch (match_token(p, tokens, args)) {
+		case Opt_trust_summary:
+			if (!jffs2_sum_active()) {
+				printk(KERN_ERR "jffs2: trust_summary needs CONFIG_JFFS2_SUMMARY\n");
+				return -EINVAL;
+			}
+			opts->trust_summary = true;
+			break;
+		default:
+			printk(KERN_ERR "jffs2: unrecognized mount option \"%s\"\n", p);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
 int jffs2_remount_fs (struct super_block *sb, int *flags, char *data)
 {
 	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
+	struct jffs2_mount_opts opts = c->mount_opts;
+	int ret;
+
+	/* trust_summary only matters for the scan at mount time, so the
+	   options are checked but the mounted ones are left alone */
+	ret = jffs2_parse_options(&opts, data);
+	if (ret)
+		return ret;
 
 	if (c->flags & JFFS2_SB_FLAG_RO && !(sb->s_flags & MS_RDONLY))
 		return -EROFS;
@@ -480,6 +542,10 @@ int jffs2_do_fill_super(struct super_block *sb, void *data, int silent)
 
 	c = JFFS2_SB_INFO(sb);
 
+	ret = jffs2_parse_options(&c->mount_opts, data);
+	if (ret)
+		return ret;
+
 #ifndef CONFIG_JFFS2_FS_WRITEBUFFER
 	if (c->mtd->type == MTD_NANDFLASH) {
 		printk(KERN_ERR "jffs2: Cannot operate on NAND flash unless jffs2 NAND support is compiled in.\n");
@@ -720,3 +786,166 @@ void jffs2_flash_cleanup(struct jffs2_sb_info *c) {
 		jffs2_ubivol_cleanup(c);
 	}
 }
+
+/*
+ * The fragtree of a regular file which nobody has open is kept on a global
+ * LRU list of cold inodes. Under memory pressure the shrinker walks the list
+ * and frees those fragtrees; the raw node refs stay, so the fragtree can be
+ * rebuilt from them by jffs2_build_frags() on the next open, GC or setattr.
+ * Both dropping and rebuilding happen under c->alloc_sem, which keeps them
+ * out of the way of the wbuf recovery code.
+ */
+static LIST_HEAD(jffs2_cold_inodes);
+static DEFINE_SPINLOCK(jffs2_cold_lock);
+static int jffs2_nr_cold;
+
+/* Called with f->sem held */
+static void jffs2_frags_mark_cold(struct jffs2_inode_info *f)
+{
+	if (!S_ISREG(OFNI_EDONI_2SFFJ(f)->i_mode) || f->frag_users ||
+	    f->frags_dropped || !f->inocache || !f->inocache->pino_nlink)
+		return;
+
+	spin_lock(&jffs2_cold_lock);
+	if (list_empty(&f->cold_list)) {
+		list_add_tail(&f->cold_list, &jffs2_cold_inodes);
+		jffs2_nr_cold++;
+	}
+	spin_unlock(&jffs2_cold_lock);
+}
+
+static void jffs2_frags_unlist(struct jffs2_inode_info *f)
+{
+	spin_lock(&jffs2_cold_lock);
+	if (!list_empty(&f->cold_list)) {
+		list_del_init(&f->cold_list);
+		jffs2_nr_cold--;
+	}
+	spin_unlock(&jffs2_cold_lock);
+}
+
+/* Called with f->sem and c->alloc_sem held */
+int jffs2_build_frags(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	int ret;
+
+	if (!f->frags_dropped)
+		return 0;
+
+	ret = jffs2_do_build_frags(c, f, OFNI_EDONI_2SFFJ(f)->i_size);
+	if (ret)
+		return ret;
+
+	f->frags_dropped = 0;
+	jffs2_frags_mark_cold(f);
+	return 0;
+}
+
+/* Pin the fragtree of an inode in memory, rebuilding it if needed */
+int jffs2_frags_get(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	int ret = 0;
+
+	mutex_lock(&f->sem);
+	f->frag_users++;
+	jffs2_frags_unlist(f);
+	if (f->frags_dropped) {
+		/* Respect the alloc_sem -> f->sem lock ordering */
+		mutex_unlock(&f->sem);
+		mutex_lock(&c->alloc_sem);
+		mutex_lock(&f->sem);
+		ret = jffs2_build_frags(c, f);
+		mutex_unlock(&c->alloc_sem);
+		if (ret)
+			f->frag_users--;
+	}
+	mutex_unlock(&f->sem);
+	return ret;
+}
+
+void jffs2_frags_put(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	mutex_lock(&f->sem);
+	if (!--f->frag_users)
+		jffs2_frags_mark_cold(f);
+	mutex_unlock(&f->sem);
+}
+
+static void jffs2_drop_frags(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	if (!mutex_trylock(&c->alloc_sem))
+		return;
+
+	if (mutex_trylock(&f->sem)) {
+		if (!f->frag_users && !f->frags_dropped &&
+		    f->inocache && f->inocache->pino_nlink) {
+			jffs2_kill_fragtree(&f->fragtree, NULL);
+			if (f->metadata) {
+				jffs2_free_full_dnode(f->metadata);
+				f->metadata = NULL;
+			}
+			f->frags_dropped = 1;
+			jffs2_frags_unlist(f);
+		}
+		mutex_unlock(&f->sem);
+	}
+	mutex_unlock(&c->alloc_sem);
+}
+
+static int jffs2_shrink_frags(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct jffs2_inode_info *f;
+	struct super_block *sb;
+	struct inode *inode;
+
+	if (!nr_to_scan)
+		return jffs2_nr_cold;
+
+	/* Rebuilding may need to read the flash, and so may freeing */
+	if (!(gfp_mask & __GFP_FS))
+		return -1;
+
+	while (nr_to_scan-- > 0) {
+		spin_lock(&jffs2_cold_lock);
+		if (list_empty(&jffs2_cold_inodes)) {
+			spin_unlock(&jffs2_cold_lock);
+			break;
+		}
+		f = list_first_entry(&jffs2_cold_inodes,
+				     struct jffs2_inode_info, cold_list);
+		/* Rotate it, in case it cannot be dropped right now */
+		list_move_tail(&f->cold_list, &jffs2_cold_inodes);
+
+		/* Don't hold up or race with umount */
+		sb = OFNI_EDONI_2SFFJ(f)->i_sb;
+		if (!down_read_trylock(&sb->s_umount)) {
+			spin_unlock(&jffs2_cold_lock);
+			continue;
+		}
+		inode = sb->s_root ? igrab(OFNI_EDONI_2SFFJ(f)) : NULL;
+		spin_unlock(&jffs2_cold_lock);
+
+		if (inode) {
+			jffs2_drop_frags(JFFS2_SB_INFO(sb), f);
+			iput(inode);
+		}
+		up_read(&sb->s_umount);
+	}
+
+	return jffs2_nr_cold;
+}
+
+static struct shrinker jffs2_frags_shrinker = {
+	.shrink = jffs2_shrink_frags,
+	.seeks = DEFAULT_SEEKS,
+};
+
+void jffs2_frags_shrinker_init(void)
+{
+	register_shrinker(&jffs2_frags_shrinker);
+}
+
+void jffs2_frags_shrinker_exit(void)
+{
+	unregister_shrinker(&jffs2_frags_shrinker);
+}
@@ -471,6 +471,11 @@ static int jffs2_garbage_collect_live(struct jffs2_sb_info *c,  struct jffs2_era
 	}
 	spin_unlock(&c->erase_completion_lock);
 
+	/* The shrinker may have dropped the fragtree of an unopened file */
+	ret = jffs2_build_frags(c, f);
+	if (ret)
+		goto upnout;
+
 	/* OK. Looks safe. And nobody can get us now because we have the semaphore. Move the block */
 	if (f->metadata && f->metadata->raw == raw) {
 		fn = f->metadata;
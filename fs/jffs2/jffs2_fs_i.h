@@ -15,6 +15,7 @@
 #include <linux/rbtree.h>
 #include <linux/posix_acl.h>
 #include <linux/mutex.h>
+#include <linux/list.h>
 
 struct jffs2_inode_info {
 	/* We need an internal mutex similar to inode->i_mutex.
@@ -49,6 +50,13 @@ struct jffs2_inode_info {
 
 	uint16_t flags;
 	uint8_t usercompr;
+
+	/* The fragtree of a regular file nobody has open is only a cache of
+	   the node list: it sits on the cold list and may be dropped by the
+	   shrinker, to be rebuilt when it is next needed */
+	uint8_t frags_dropped;
+	unsigned int frag_users;
+	struct list_head cold_list;
 	struct inode vfs_inode;
 };
 
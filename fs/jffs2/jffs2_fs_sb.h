@@ -28,6 +28,11 @@
 
 struct jffs2_inodirty;
 
+struct jffs2_mount_opts {
+	bool trust_summary;	/* Account summarised inode and dirent nodes
+				   as checked at mount time */
+};
+
 /* A struct for the overall file system control.  Pointers to
    jffs2_sb_info structs are named `c' in the source code.
    Nee jffs_control
@@ -40,6 +45,8 @@ struct jffs2_sb_info {
 
 	unsigned int flags;
 
+	struct jffs2_mount_opts mount_opts;
+
 	struct task_struct *gc_task;	/* GC task struct */
 	struct completion gc_thread_start; /* GC thread start completion */
 	struct completion gc_thread_exit; /* GC thread exit completion port */
@@ -412,6 +412,8 @@ int jffs2_do_link(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f, uint3
 int jffs2_do_read_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			uint32_t ino, struct jffs2_raw_inode *latest_node);
 int jffs2_do_crccheck_inode(struct jffs2_sb_info *c, struct jffs2_inode_cache *ic);
+int jffs2_do_build_frags(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			 uint32_t isize);
 void jffs2_do_clear_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
 
 /* malloc.c */
@@ -56,6 +56,8 @@ static inline void jffs2_init_inode_info(struct jffs2_inode_info *f)
 	f->target = NULL;
 	f->flags = 0;
 	f->usercompr = 0;
+	f->frags_dropped = 0;
+	f->frag_users = 0;
 }
 
 
@@ -192,6 +194,11 @@ void jffs2_gc_release_page(struct jffs2_sb_info *c,
 			   unsigned char *pg,
 			   unsigned long *priv);
 void jffs2_flash_cleanup(struct jffs2_sb_info *c);
+int jffs2_build_frags(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
+int jffs2_frags_get(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
+void jffs2_frags_put(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
+void jffs2_frags_shrinker_init(void);
+void jffs2_frags_shrinker_exit(void);
 
 
 /* writev.c */
@@ -1419,6 +1419,94 @@ int jffs2_do_crccheck_inode(struct jffs2_sb_info *c, struct jffs2_inode_cache *i
 	return ret;
 }
 
+/*
+ * Rebuild the fragtree and metadata node of an in-core regular file whose
+ * fragtree has been dropped by the shrinker. The inode stays present, so
+ * only the node gathering and fragtree building parts of reading the inode
+ * are redone. Called with f->sem and c->alloc_sem held; @isize is the size
+ * of the file as the VFS currently sees it.
+ */
+int jffs2_do_build_frags(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			 uint32_t isize)
+{
+	struct jffs2_readinode_info rii;
+	uint32_t highest_version = f->highest_version;
+	int ret;
+
+	dbg_readinode("rebuild fragtree of ino #%u\n", f->inocache->ino);
+
+	memset(&rii, 0, sizeof(rii));
+
+	ret = jffs2_get_inode_nodes(c, f, &rii);
+	if (ret) {
+		JFFS2_ERROR("cannot read nodes for ino %u, returned error is %d\n", f->inocache->ino, ret);
+		goto out;
+	}
+
+	ret = jffs2_build_inode_fragtree(c, f, &rii);
+	if (ret) {
+		JFFS2_ERROR("Failed to rebuild fragtree for inode #%u: error %d\n",
+			    f->inocache->ino, ret);
+		jffs2_free_tmp_dnode_info_list(&rii.tn_root);
+		if (rii.mdata_tn) {
+			jffs2_free_full_dnode(rii.mdata_tn->fn);
+			jffs2_free_tmp_dnode_info(rii.mdata_tn);
+		}
+		jffs2_free_full_dirent_list(rii.fds);
+		jffs2_kill_fragtree(&f->fragtree, NULL);
+		goto out;
+	}
+
+	if (rii.mdata_tn) {
+		if (rii.mdata_tn->fn->raw == rii.latest_ref) {
+			f->metadata = rii.mdata_tn->fn;
+			jffs2_free_tmp_dnode_info(rii.mdata_tn);
+		} else {
+			jffs2_kill_tn(c, rii.mdata_tn);
+		}
+	}
+
+	/* Regular files have no directory entries */
+	jffs2_free_full_dirent_list(rii.fds);
+
+	jffs2_truncate_fragtree(c, &f->fragtree, isize);
+	jffs2_dbg_fragtree_paranoia_check_nolock(f);
+ out:
+	/* Never hand out a version lower than one already written */
+	if (f->highest_version < highest_version)
+		f->highest_version = highest_version;
+	return ret;
+}
+
+/*
+ * Obsolete the nodes of a deleted regular file whose fragtree has been
+ * dropped by the shrinker, walking the raw node list of the inode instead
+ * of the fragtree. Rebuilding the fragtree would need c->alloc_sem, which
+ * the final iput() may be called with. Called with f->sem held and the
+ * inode cache in INO_STATE_CLEARING, so that it is not freed under us when
+ * its last node goes.
+ */
+static void jffs2_obsolete_inode_nodes(struct jffs2_sb_info *c,
+				       struct jffs2_inode_cache *ic)
+{
+	struct jffs2_raw_node_ref *ref, *valid_ref;
+
+	spin_lock(&c->erase_completion_lock);
+	valid_ref = jffs2_first_valid_node(ic->nodes);
+	while (valid_ref) {
+		/* Find the next valid node before 'ref' is obsoleted and
+		   unlinked, see jffs2_get_inode_nodes() */
+		ref = valid_ref;
+		valid_ref = jffs2_first_valid_node(ref->next_in_ino);
+		spin_unlock(&c->erase_completion_lock);
+
+		jffs2_mark_node_obsolete(c, ref);
+
+		spin_lock(&c->erase_completion_lock);
+	}
+	spin_unlock(&c->erase_completion_lock);
+}
+
 void jffs2_do_clear_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
 {
 	struct jffs2_full_dirent *fd, *fds;
@@ -1437,6 +1525,9 @@ void jffs2_do_clear_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
 		jffs2_free_full_dnode(f->metadata);
 	}
 
+	if (deleted && f->frags_dropped)
+		jffs2_obsolete_inode_nodes(c, f->inocache);
+
 	jffs2_kill_fragtree(&f->fragtree, deleted?c:NULL);
 
 	if (f->target) {
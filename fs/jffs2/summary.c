@@ -365,6 +365,15 @@ no_mem:
 	return -ENOMEM;
 }
 
+/* On a trust_summary mount the inode and dirent nodes listed in a summary
+   are accounted as checked straight away, so jffs2_build_filesystem() can
+   spare their inodes the CRC check pass of the GC thread. Node header CRCs
+   are still checked, and data CRCs verified, when an inode is read. */
+static inline uint32_t sum_ref_flags(struct jffs2_sb_info *c)
+{
+	return c->mount_opts.trust_summary ? REF_NORMAL : REF_UNCHECKED;
+}
+
 static struct jffs2_raw_node_ref *sum_link_node_ref(struct jffs2_sb_info *c,
 						    struct jffs2_eraseblock *jeb,
 						    uint32_t ofs, uint32_t len,
@@ -419,7 +428,7 @@ static int jffs2_sum_process_sum_data(struct jffs2_sb_info *c, struct jffs2_eras
 					return -ENOMEM;
 				}
 
-				sum_link_node_ref(c, jeb, je32_to_cpu(spi->offset) | REF_UNCHECKED,
+				sum_link_node_ref(c, jeb, je32_to_cpu(spi->offset) | sum_ref_flags(c),
 						  PAD(je32_to_cpu(spi->totlen)), ic);
 
 				*pseudo_random += je32_to_cpu(spi->version);
@@ -465,7 +474,7 @@ static int jffs2_sum_process_sum_data(struct jffs2_sb_info *c, struct jffs2_eras
 					return -ENOMEM;
 				}
 
-				fd->raw = sum_link_node_ref(c, jeb,  je32_to_cpu(spd->offset) | REF_UNCHECKED,
+				fd->raw = sum_link_node_ref(c, jeb,  je32_to_cpu(spd->offset) | sum_ref_flags(c),
 							    PAD(je32_to_cpu(spd->totlen)), ic);
 
 				fd->next = NULL;
@@ -24,6 +24,7 @@
 #include <linux/ctype.h>
 #include <linux/namei.h>
 #include <linux/exportfs.h>
+#include <linux/seq_file.h>
 #include "compr.h"
 #include "nodelist.h"
 
@@ -51,6 +52,7 @@ static void jffs2_i_init_once(void *foo)
 	struct jffs2_inode_info *f = foo;
 
 	mutex_init(&f->sem);
+	INIT_LIST_HEAD(&f->cold_list);
 	inode_init_once(&f->vfs_inode);
 }
 
@@ -123,6 +125,16 @@ static struct dentry *jffs2_get_parent(struct dentry *child)
 	return d_obtain_alias(jffs2_iget(child->d_inode->i_sb, pino));
 }
 
+static int jffs2_show_options(struct seq_file *s, struct vfsmount *mnt)
+{
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(mnt->mnt_sb);
+
+	if (c->mount_opts.trust_summary)
+		seq_puts(s, ",trust_summary");
+
+	return 0;
+}
+
 static const struct export_operations jffs2_export_ops = {
 	.get_parent = jffs2_get_parent,
 	.fh_to_dentry = jffs2_fh_to_dentry,
@@ -140,6 +152,7 @@ static const struct super_operations jffs2_super_operations =
 	.clear_inode =	jffs2_clear_inode,
 	.dirty_inode =	jffs2_dirty_inode,
 	.sync_fs =	jffs2_sync_fs,
+	.show_options =	jffs2_show_options,
 };
 
 /*
@@ -287,6 +300,7 @@ static int __init init_jffs2_fs(void)
 		printk(KERN_ERR "JFFS2 error: Failed to register filesystem\n");
 		goto out_slab;
 	}
+	jffs2_frags_shrinker_init();
 	return 0;
 
  out_slab:
@@ -301,6 +315,7 @@ static int __init init_jffs2_fs(void)
 static void __exit exit_jffs2_fs(void)
 {
 	unregister_filesystem(&jffs2_fs_type);
+	jffs2_frags_shrinker_exit();
 	jffs2_destroy_slab_caches();
 	jffs2_compressors_exit();
 	kmem_cache_destroy(jffs2_inode_cachep);
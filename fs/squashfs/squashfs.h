@@ -36,6 +36,16 @@ static inline struct squashfs_inode_info *squashfs_i(struct inode *inode)
 extern int squashfs_read_data(struct super_block *, void **, u64, int, u64 *,
 				int, int);
 
+/* stream.c */
+extern int squashfs_stream_pool_init(struct squashfs_sb_info *);
+extern void squashfs_stream_pool_delete(struct squashfs_sb_info *);
+extern struct squashfs_stream *squashfs_stream_get(struct squashfs_sb_info *);
+extern void squashfs_stream_put(struct squashfs_sb_info *,
+				struct squashfs_stream *);
+
+/* decompressor.c */
+extern const struct squashfs_decompressor *squashfs_lookup_decompressor(int);
+
 /* cache.c */
 extern struct squashfs_cache *squashfs_cache_init(char *, int, int);
 extern void squashfs_cache_delete(struct squashfs_cache *);
@@ -88,3 +98,12 @@ extern const struct inode_operations squashfs_dir_inode_ops;
 
 /* symlink.c */
 extern const struct address_space_operations squashfs_symlink_aops;
+
+/* zlib_wrapper.c */
+extern const struct squashfs_decompressor squashfs_zlib_comp_ops;
+
+/* lzma_wrapper.c */
+extern const struct squashfs_decompressor squashfs_lzma_comp_ops;
+
+/* lzo_wrapper.c */
+extern const struct squashfs_decompressor squashfs_lzo_comp_ops;
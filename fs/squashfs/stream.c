@@ -0,0 +1,182 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008
+ * Phillip Lougher <phillip@lougher.demon.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * stream.c
+ */
+
+/*
+ * This file implements a pool of decompressor streams, so that blocks
+ * read by different processes are decompressed at the same time rather
+ * than one after the other.
+ *
+ * One stream is allocated at mount time, the others are only allocated
+ * when all the existing streams are busy, up to two per online CPU.  Past
+ * that limit readers sleep until a stream is released.  Idle streams are
+ * kept until umount.
+ */
+
+#include <linux/fs.h>
+#include <linux/vfs.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/cpumask.h>
+#include <linux/buffer_head.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "decompressor.h"
+#include "squashfs.h"
+
+struct squashfs_stream_pool {
+	spinlock_t		lock;
+	struct list_head	idle;
+	int			avail;
+	int			max;
+	wait_queue_head_t	wait;
+};
+
+
+static struct squashfs_stream *squashfs_stream_alloc(
+	struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream;
+
+	stream = kmalloc(sizeof(*stream), GFP_KERNEL);
+	if (stream == NULL)
+		return NULL;
+
+	stream->stream = squashfs_decompressor_init(msblk);
+	if (stream->stream == NULL) {
+		kfree(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+
+static void squashfs_stream_free(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	squashfs_decompressor_free(msblk, stream->stream);
+	kfree(stream);
+}
+
+
+int squashfs_stream_pool_init(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool;
+	struct squashfs_stream *stream;
+
+	pool = kmalloc(sizeof(*pool), GFP_KERNEL);
+	if (pool == NULL)
+		return -ENOMEM;
+
+	stream = squashfs_stream_alloc(msblk);
+	if (stream == NULL) {
+		kfree(pool);
+		return -ENOMEM;
+	}
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->idle);
+	list_add(&stream->list, &pool->idle);
+	pool->avail = 1;
+	pool->max = num_online_cpus() * 2;
+	init_waitqueue_head(&pool->wait);
+
+	msblk->stream_pool = pool;
+	return 0;
+}
+
+
+void squashfs_stream_pool_delete(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->stream_pool;
+	struct squashfs_stream *stream, *next;
+
+	if (pool == NULL)
+		return;
+
+	list_for_each_entry_safe(stream, next, &pool->idle, list)
+		squashfs_stream_free(msblk, stream);
+
+	kfree(pool);
+	msblk->stream_pool = NULL;
+}
+
+
+/*
+ * Get an idle stream, allocating a new one if all the streams are busy
+ * and the limit is not reached, otherwise wait for one to be released.
+ */
+struct squashfs_stream *squashfs_stream_get(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->stream_pool;
+	struct squashfs_stream *stream;
+
+	while (1) {
+		spin_lock(&pool->lock);
+		if (!list_empty(&pool->idle)) {
+			stream = list_entry(pool->idle.next,
+				struct squashfs_stream, list);
+			list_del(&stream->list);
+			spin_unlock(&pool->lock);
+			return stream;
+		}
+
+		if (pool->avail < pool->max) {
+			pool->avail++;
+			spin_unlock(&pool->lock);
+
+			stream = squashfs_stream_alloc(msblk);
+			if (stream != NULL)
+				return stream;
+
+			/* Out of memory, wait for one of the others */
+			spin_lock(&pool->lock);
+			pool->avail--;
+			if (!list_empty(&pool->idle)) {
+				spin_unlock(&pool->lock);
+				continue;
+			}
+		}
+		spin_unlock(&pool->lock);
+
+		wait_event(pool->wait, !list_empty(&pool->idle));
+	}
+}
+
+
+void squashfs_stream_put(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	struct squashfs_stream_pool *pool = msblk->stream_pool;
+
+	spin_lock(&pool->lock);
+	list_add(&stream->list, &pool->idle);
+	spin_unlock(&pool->lock);
+
+	wake_up(&pool->wait);
+}
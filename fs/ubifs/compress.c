@@ -133,6 +133,45 @@ no_compr:
 	*compr_type = UBIFS_COMPR_NONE;
 }
 
+/* How many bytes of a data block 'ubifs_incompressible()' looks at */
+#define PROBE_SAMPLES 128
+
+/**
+ * ubifs_incompressible - quickly check if data looks incompressible.
+ * @buf: data to check
+ * @len: length of the data
+ *
+ * This function samples @PROBE_SAMPLES bytes spread evenly over @buf and
+ * builds their histogram. The sum of the squared byte counts is about
+ * @n + @n^2/256 for @n samples of random data, and grows as the data gets
+ * more redundant. Data which does not come out clearly above the random level
+ * is considered to be incompressible, in which case this function returns
+ * %1. Otherwise it returns %0.
+ *
+ * This is much cheaper than a compression attempt, which is what it is used
+ * to avoid for inodes with the %UBIFS_CPROBE_FL flag.
+ */
+int ubifs_incompressible(const void *buf, int len)
+{
+	const unsigned char *p = buf;
+	unsigned char hist[256];
+	int i, n, step, sum = 0;
+
+	if (len < UBIFS_MIN_COMPR_LEN)
+		return 0;
+
+	n = min_t(int, len, PROBE_SAMPLES);
+	step = len / n;
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < n; i++)
+		hist[p[i * step]] += 1;
+	for (i = 0; i < 256; i++)
+		sum += hist[i] * hist[i];
+
+	/* As redundant as data spread evenly over 128 byte values, or less */
+	return sum <= n + n * n / 128;
+}
+
 /**
  * ubifs_decompress - decompress data.
  * @in_buf: data to decompress
@@ -51,6 +51,7 @@
  * parent directory inode @dir. UBIFS inodes inherit the following flags:
  * o %UBIFS_COMPR_FL, which is useful to switch compression on/of on
  *   sub-directory basis;
+ * o %UBIFS_CPROBE_FL, which goes together with %UBIFS_COMPR_FL;
  * o %UBIFS_SYNC_FL - useful for the same reasons;
  * o %UBIFS_DIRSYNC_FL - similar, but relevant only to directories.
  *
@@ -68,13 +69,42 @@ static int inherit_flags(const struct inode *dir, int mode)
 		 */
 		return 0;
 
-	flags = ui->flags & (UBIFS_COMPR_FL | UBIFS_SYNC_FL | UBIFS_DIRSYNC_FL);
+	flags = ui->flags & (UBIFS_COMPR_FL | UBIFS_CPROBE_FL | UBIFS_SYNC_FL |
+			     UBIFS_DIRSYNC_FL);
 	if (!S_ISDIR(mode))
 		/* The "DIRSYNC" flag only applies to directories */
 		flags &= ~UBIFS_DIRSYNC_FL;
 	return flags;
 }
 
+/**
+ * inherit_compr_type - inherit compression type of the parent inode.
+ * @c: UBIFS file-system description object
+ * @dir: parent directory inode
+ * @mode: new inode mode flags
+ *
+ * This is a helper function for 'ubifs_new_inode()'. Directories have
+ * %UBIFS_COMPR_NONE compression type unless it was set with
+ * %UBIFS_IOC_SETCOMPR, and they pass it on to new directories and regular
+ * files created in them. Regular files in directories without compression
+ * type get the default one. Other inodes do not have data nodes and get
+ * %UBIFS_COMPR_NONE.
+ */
+static int inherit_compr_type(const struct ubifs_info *c,
+			      const struct inode *dir, int mode)
+{
+	int compr_type = UBIFS_COMPR_NONE;
+
+	if (S_ISDIR(dir->i_mode))
+		compr_type = ubifs_inode(dir)->compr_type;
+
+	if (S_ISREG(mode) && compr_type == UBIFS_COMPR_NONE)
+		return c->default_compr;
+	if (!S_ISREG(mode) && !S_ISDIR(mode))
+		return UBIFS_COMPR_NONE;
+	return compr_type;
+}
+
 /**
  * ubifs_new_inode - allocate new UBIFS inode object.
  * @c: UBIFS file-system description object
@@ -144,10 +174,7 @@ struct inode *ubifs_new_inode(struct ubifs_info *c, const struct inode *dir,
 
 	ui->flags = inherit_flags(dir, mode);
 	ubifs_set_inode_flags(inode);
-	if (S_ISREG(mode))
-		ui->compr_type = c->default_compr;
-	else
-		ui->compr_type = UBIFS_COMPR_NONE;
+	ui->compr_type = inherit_compr_type(c, dir, mode);
 	ui->synced_i_size = 0;
 
 	spin_lock(&c->cnt_lock);
@@ -52,6 +52,8 @@
 #include "ubifs.h"
 #include <linux/mount.h>
 #include <linux/namei.h>
+#include <linux/workqueue.h>
+#include <linux/cpu.h>
 
 static int read_block(struct inode *inode, void *addr, unsigned int block,
 		      struct ubifs_data_node *dn)
@@ -887,7 +889,16 @@ static int ubifs_readpage(struct file *file, struct page *page)
 	return 0;
 }
 
-static int do_writepage(struct page *page, int len)
+/*
+ * write_page_nodes - write data nodes of a page under write-back.
+ * @page: the page to write, marked as under write-back
+ * @len: how many bytes of the page to write
+ *
+ * This is a helper function for 'do_writepage()' and the compression
+ * workqueue. It only relies on the page being under write-back, not on the
+ * page lock, and leaves the page flags and budget to the caller.
+ */
+static int write_page_nodes(struct page *page, int len)
 {
 	int err = 0, i, blen;
 	unsigned int block;
@@ -896,15 +907,6 @@ static int do_writepage(struct page *page, int len)
 	struct inode *inode = page->mapping->host;
 	struct ubifs_info *c = inode->i_sb->s_fs_info;
 
-#ifdef UBIFS_DEBUG
-	spin_lock(&ui->ui_lock);
-	ubifs_assert(page->index <= ui->synced_i_size << PAGE_CACHE_SIZE);
-	spin_unlock(&ui->ui_lock);
-#endif
-
-	/* Update radix tree tags */
-	set_page_writeback(page);
-
 	addr = kmap(page);
 	block = page->index << UBIFS_BLOCKS_PER_PAGE_SHIFT;
 	i = 0;
@@ -927,6 +929,20 @@ static int do_writepage(struct page *page, int len)
 		ubifs_ro_mode(c, err);
 	}
 
+	kunmap(page);
+	return err;
+}
+
+static int do_writepage(struct page *page, int len)
+{
+	int err;
+	struct ubifs_info *c = page->mapping->host->i_sb->s_fs_info;
+
+	/* Update radix tree tags */
+	set_page_writeback(page);
+
+	err = write_page_nodes(page, len);
+
 	ubifs_assert(PagePrivate(page));
 	if (PageChecked(page))
 		release_new_page_budget(c);
@@ -937,12 +953,99 @@ static int do_writepage(struct page *page, int len)
 	ClearPagePrivate(page);
 	ClearPageChecked(page);
 
-	kunmap(page);
 	unlock_page(page);
 	end_page_writeback(page);
 	return err;
 }
 
+/*
+ * Compressing data is the most CPU-hungry part of write-back, and with zlib
+ * on a slow CPU it holds up whoever ends up doing the write-back - including
+ * writers throttled in 'balance_dirty_pages()' and 'fsync()' callers. So when
+ * a large batch of pages of a compressed inode is being written back, whole
+ * pages are handed over to the compression workqueue, which has a worker
+ * thread per CPU, and the next page is looked at straight away.
+ *
+ * As '->writepage()' requires, a handed over page is unlocked before
+ * 'ubifs_writepage()' returns. Its dirty state is cleared while it is still
+ * locked, so a write which re-dirties it in the meantime budgets afresh, and
+ * the budget of the page being written is released by the worker. The page
+ * stays under write-back until its data nodes are in the journal, so
+ * truncation, 'fsync()' and 'sync()' wait for it just like they would for a
+ * synchronous 'do_writepage()', and write errors are reported through the
+ * page error flag as usual.
+ */
+struct async_wb {
+	struct work_struct work;
+	struct page *page;
+	int new_page;
+};
+
+static void async_writepage_work(struct work_struct *work)
+{
+	struct async_wb *awb = container_of(work, struct async_wb, work);
+	struct page *page = awb->page;
+	struct ubifs_info *c = page->mapping->host->i_sb->s_fs_info;
+
+	write_page_nodes(page, PAGE_CACHE_SIZE);
+
+	if (awb->new_page)
+		release_new_page_budget(c);
+	else
+		release_existing_page_budget(c);
+	kfree(awb);
+
+	end_page_writeback(page);
+}
+
+/*
+ * async_writepage - hand a page over to the compression workqueue.
+ * @page: the locked page to write, which must be fully inside @i_size
+ * @wbc: write-back control
+ *
+ * This function returns %1 if the page has been queued for write-back, in
+ * which case it has been unlocked, and %0 if it should be written
+ * synchronously instead.
+ */
+static int async_writepage(struct page *page, struct writeback_control *wbc)
+{
+	struct inode *inode = page->mapping->host;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	static int last_cpu = -1;
+	struct async_wb *awb;
+	int cpu;
+
+	if (wbc->for_reclaim || wbc->nr_to_write < UBIFS_ASYNC_WB_PAGES ||
+	    !(ui->flags & UBIFS_COMPR_FL) || ui->compr_type == UBIFS_COMPR_NONE)
+		return 0;
+
+	awb = kmalloc(sizeof(struct async_wb), GFP_NOFS);
+	if (!awb)
+		return 0;
+	INIT_WORK(&awb->work, async_writepage_work);
+	awb->page = page;
+
+	ubifs_assert(PagePrivate(page));
+	awb->new_page = !!PageChecked(page);
+	atomic_long_dec(&c->dirty_pg_cnt);
+	ClearPagePrivate(page);
+	ClearPageChecked(page);
+
+	set_page_writeback(page);
+	unlock_page(page);
+
+	/* Spread the pages over the workers, the race on @last_cpu is benign */
+	get_online_cpus();
+	cpu = cpumask_next(last_cpu, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(cpu_online_mask);
+	last_cpu = cpu;
+	queue_work_on(cpu, ubifs_compr_wq, &awb->work);
+	put_online_cpus();
+	return 1;
+}
+
 /*
  * When writing-back dirty inodes, VFS first writes-back pages belonging to the
  * inode, then the inode itself. For UBIFS this may cause a problem. Consider a
@@ -1023,6 +1126,8 @@ static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
 			 * with this.
 			 */
 		}
+		if (async_writepage(page, wbc))
+			return 0;
 		return do_writepage(page, PAGE_CACHE_SIZE);
 	}
 
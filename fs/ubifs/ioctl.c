@@ -22,7 +22,10 @@
  *          Adrian Hunter
  */
 
-/* This file implements EXT2-compatible extended attribute ioctl() calls */
+/*
+ * This file implements EXT2-compatible extended attribute ioctl() calls and
+ * the UBIFS-specific compression policy ioctl() calls.
+ */
 
 #include <linux/compat.h>
 #include <linux/mount.h>
@@ -124,7 +127,8 @@ static int setflags(struct inode *inode, int flags)
 		}
 	}
 
-	ui->flags = ioctl2ubifs(flags);
+	/* @UBIFS_CPROBE_FL has no ioctl flag and is kept as is */
+	ui->flags = ioctl2ubifs(flags) | (ui->flags & UBIFS_CPROBE_FL);
 	ubifs_set_inode_flags(inode);
 	inode->i_ctime = ubifs_current_time(inode);
 	release = ui->dirty;
@@ -144,6 +148,60 @@ out_unlock:
 	return err;
 }
 
+/*
+ * ubifs2compr - get compression policy of an inode.
+ * @ui: UBIFS inode to get the policy of
+ *
+ * This function returns the compression policy of @ui in the form used by
+ * %UBIFS_IOC_GETCOMPR and %UBIFS_IOC_SETCOMPR.
+ */
+static int ubifs2compr(const struct ubifs_inode *ui)
+{
+	if (!(ui->flags & UBIFS_COMPR_FL))
+		return UBIFS_COMPR_NONE;
+	if (ui->flags & UBIFS_CPROBE_FL)
+		return ui->compr_type | UBIFS_COMPR_PROBE;
+	return ui->compr_type;
+}
+
+static int setcompr(struct inode *inode, int policy)
+{
+	int err, release;
+	int compr_type = policy & ~UBIFS_COMPR_PROBE;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	struct ubifs_budget_req req = { .dirtied_ino = 1,
+					.dirtied_ino_d = ui->data_len };
+
+	if (compr_type < 0 || compr_type >= UBIFS_COMPR_TYPES_CNT)
+		return -EINVAL;
+	if (!ubifs_compr_present(compr_type))
+		return -EOPNOTSUPP;
+
+	err = ubifs_budget_space(c, &req);
+	if (err)
+		return err;
+
+	mutex_lock(&ui->ui_mutex);
+	ui->flags &= ~(UBIFS_COMPR_FL | UBIFS_CPROBE_FL);
+	if (compr_type != UBIFS_COMPR_NONE) {
+		ui->flags |= UBIFS_COMPR_FL;
+		if (policy & UBIFS_COMPR_PROBE)
+			ui->flags |= UBIFS_CPROBE_FL;
+	}
+	ui->compr_type = compr_type;
+	inode->i_ctime = ubifs_current_time(inode);
+	release = ui->dirty;
+	mark_inode_dirty_sync(inode);
+	mutex_unlock(&ui->ui_mutex);
+
+	if (release)
+		ubifs_release_budget(c, &req);
+	if (IS_SYNC(inode))
+		err = write_inode_now(inode, 1);
+	return err;
+}
+
 long ubifs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	int flags, err;
@@ -182,6 +240,32 @@ long ubifs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		return err;
 	}
 
+	case UBIFS_IOC_GETCOMPR:
+		flags = ubifs2compr(ubifs_inode(inode));
+		return put_user(flags, (int __user *) arg);
+
+	case UBIFS_IOC_SETCOMPR: {
+		if (IS_RDONLY(inode))
+			return -EROFS;
+
+		if (!is_owner_or_cap(inode))
+			return -EACCES;
+
+		if (!S_ISREG(inode->i_mode) && !S_ISDIR(inode->i_mode))
+			return -EINVAL;
+
+		if (get_user(flags, (int __user *) arg))
+			return -EFAULT;
+
+		err = mnt_want_write(file->f_path.mnt);
+		if (err)
+			return err;
+		dbg_gen("set compression policy: %#x", flags);
+		err = setcompr(inode, flags);
+		mnt_drop_write(file->f_path.mnt);
+		return err;
+	}
+
 	default:
 		return -ENOTTY;
 	}
@@ -197,6 +281,9 @@ long ubifs_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case FS_IOC32_SETFLAGS:
 		cmd = FS_IOC_SETFLAGS;
 		break;
+	case UBIFS_IOC_GETCOMPR:
+	case UBIFS_IOC_SETCOMPR:
+		break;
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -710,6 +710,9 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 	if (!(ui->flags & UBIFS_COMPR_FL))
 		/* Compression is disabled for this inode */
 		compr_type = UBIFS_COMPR_NONE;
+	else if ((ui->flags & UBIFS_CPROBE_FL) && ubifs_incompressible(buf, len))
+		/* Not worth trying to compress */
+		compr_type = UBIFS_COMPR_NONE;
 	else
 		compr_type = ui->compr_type;
 
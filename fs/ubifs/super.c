@@ -36,6 +36,7 @@
 #include <linux/mount.h>
 #include <linux/math64.h>
 #include <linux/writeback.h>
+#include <linux/workqueue.h>
 #include "ubifs.h"
 
 /*
@@ -47,6 +48,9 @@
 /* Slab cache for UBIFS inodes */
 struct kmem_cache *ubifs_inode_slab;
 
+/* Workqueue which compresses data of large write-back batches */
+struct workqueue_struct *ubifs_compr_wq;
+
 /* UBIFS TNC shrinker description */
 static struct shrinker ubifs_shrinker_info = {
 	.shrink = ubifs_shrinker,
@@ -2185,12 +2189,19 @@ static int __init ubifs_init(void)
 	if (err)
 		goto out_shrinker;
 
+	err = -ENOMEM;
+	ubifs_compr_wq = create_workqueue("ubifs_compr");
+	if (!ubifs_compr_wq)
+		goto out_compr;
+
 	err = dbg_debugfs_init();
 	if (err)
-		goto out_compr;
+		goto out_wq;
 
 	return 0;
 
+out_wq:
+	destroy_workqueue(ubifs_compr_wq);
 out_compr:
 	ubifs_compressors_exit();
 out_shrinker:
@@ -2209,6 +2220,7 @@ static void __exit ubifs_exit(void)
 	ubifs_assert(atomic_long_read(&ubifs_clean_zn_cnt) == 0);
 
 	dbg_debugfs_exit();
+	destroy_workqueue(ubifs_compr_wq);
 	ubifs_compressors_exit();
 	unregister_shrinker(&ubifs_shrinker_info);
 	kmem_cache_destroy(ubifs_inode_slab);
@@ -309,10 +309,12 @@ enum {
  * UBIFS_APPEND_FL: writes to the inode may only append data
  * UBIFS_DIRSYNC_FL: I/O on this directory inode has to be synchronous
  * UBIFS_XATTR_FL: this inode is the inode for an extended attribute value
+ * UBIFS_CPROBE_FL: do not compress data which looks incompressible
  *
  * Note, these are on-flash flags which correspond to ioctl flags
  * (@FS_COMPR_FL, etc). They have the same values now, but generally, do not
- * have to be the same.
+ * have to be the same. @UBIFS_CPROBE_FL has no ioctl flag counterpart, it is
+ * changed with %UBIFS_IOC_SETCOMPR.
  */
 enum {
 	UBIFS_COMPR_FL     = 0x01,
@@ -321,10 +323,11 @@ enum {
 	UBIFS_APPEND_FL    = 0x08,
 	UBIFS_DIRSYNC_FL   = 0x10,
 	UBIFS_XATTR_FL     = 0x20,
+	UBIFS_CPROBE_FL    = 0x40,
 };
 
 /* Inode flag bits used by UBIFS */
-#define UBIFS_FL_MASK 0x0000001F
+#define UBIFS_FL_MASK 0x0000005F
 
 /*
  * UBIFS compression algorithms.
@@ -341,6 +344,24 @@ enum {
 	UBIFS_COMPR_TYPES_CNT,
 };
 
+/*
+ * Per-inode compression policy ioctl commands.
+ *
+ * UBIFS_IOC_GETCOMPR: get the compression policy of an inode
+ * UBIFS_IOC_SETCOMPR: set the compression policy of an inode
+ *
+ * The policy is a compression type (%UBIFS_COMPR_NONE, etc), optionally
+ * OR'ed with %UBIFS_COMPR_PROBE, in which case data which looks incompressible
+ * is stored uncompressed without trying to compress it. The policy of a
+ * regular file applies to data written from now on. The policy of a directory
+ * is inherited by inodes created in it.
+ */
+#define UBIFS_COMPR_PROBE  0x100
+
+#define UBIFS_IOC_MAGIC 'O'
+#define UBIFS_IOC_GETCOMPR _IOR(UBIFS_IOC_MAGIC, 0x10, int)
+#define UBIFS_IOC_SETCOMPR _IOW(UBIFS_IOC_MAGIC, 0x11, int)
+
 /*
  * UBIFS node types.
  *
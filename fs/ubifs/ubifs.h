@@ -152,6 +152,12 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/*
+ * Write-back of a compressed inode which asks for at least this many pages
+ * hands the pages over to the compression workqueue (see 'ubifs_writepage()')
+ */
+#define UBIFS_ASYNC_WB_PAGES 16
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -1423,6 +1429,7 @@ extern const struct inode_operations ubifs_dir_inode_operations;
 extern const struct inode_operations ubifs_symlink_inode_operations;
 extern struct backing_dev_info ubifs_backing_dev_info;
 extern struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
+extern struct workqueue_struct *ubifs_compr_wq;
 
 /* io.c */
 void ubifs_ro_mode(struct ubifs_info *c, int err);
@@ -1724,6 +1731,7 @@ int __init ubifs_compressors_init(void);
 void ubifs_compressors_exit(void);
 void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 		    int *compr_type);
+int ubifs_incompressible(const void *buf, int len);
 int ubifs_decompress(const void *buf, int len, void *out, int *out_len,
 		     int compr_type);
 
@@ -56,6 +56,12 @@ unsigned long __bpa2_alloc_pages(struct bpa2_part *part, int count, int align,
 	       int priority, const char *trace_file, int trace_line);
 void bpa2_free_pages(struct bpa2_part *part, unsigned long base);
 
+typedef int (*bpa2_migrate_t)(void *priv, unsigned long old_base,
+		unsigned long new_base, unsigned long size);
+int bpa2_set_movable(struct bpa2_part *part, unsigned long base,
+		bpa2_migrate_t migrate, void *priv);
+int bpa2_compact(struct bpa2_part *part);
+
 void bpa2_memory(struct bpa2_part *part, unsigned long *base,
 		 unsigned long *size);
 
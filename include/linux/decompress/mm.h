@@ -87,7 +87,9 @@ static void free(void *where)
 static void(*error)(char *m);
 #define set_error_fn(x) error = x;
 
+#ifndef INIT
 #define INIT __init
+#endif
 #define STATIC
 
 #include <linux/init.h>
@@ -1,6 +1,8 @@
 #ifndef DECOMPRESS_UNLZMA_H
 #define DECOMPRESS_UNLZMA_H
 
+#include <linux/types.h>
+
 int unlzma(unsigned char *, int,
 	   int(*fill)(void*, unsigned int),
 	   int(*flush)(void*, unsigned int),
@@ -9,4 +11,7 @@ int unlzma(unsigned char *, int,
 	   void(*error)(char *x)
 	);
 
+int unlzma_mem(unsigned char *buf, int in_len, unsigned char *output,
+	       int *posp, uint16_t **probs, int *probs_size);
+
 #endif
@@ -135,6 +135,23 @@ typedef enum {
 	DMX_SOURCE_DVR3
 } dmx_source_t;
 
+/*
+ * Header of a demux/dvr buffer mapped with mmap(MAP_SHARED): it takes the
+ * first page of the mapping and the ring data start at data_offset.
+ * The kernel fills the ring and advances pwrite, the application consumes
+ * the data and advances pread. poll() reports POLLIN once at least
+ * threshold bytes (or any byte if zero) are available. When the ring is
+ * full the new data are dropped and counted in overflows.
+ */
+struct dmx_ring {
+	__u32 size;		/* size of the data area */
+	__u32 data_offset;	/* offset of the data area in the mapping */
+	__u32 pwrite;		/* producer index, written by the kernel */
+	__u32 pread;		/* consumer index, written by the application */
+	__u32 threshold;	/* poll() wakeup threshold in bytes */
+	__u32 overflows;	/* bytes dropped since the ring was mapped */
+};
+
 struct dmx_stc {
 	unsigned int num;	/* input : which STC? 0..N */
 	unsigned int base;	/* output: divisor for stc to get 90 kHz clock */
@@ -0,0 +1,14 @@
+#ifndef _LINUX_ERASED_BUF_H
+#define _LINUX_ERASED_BUF_H
+#include <linux/types.h>
+
+extern int erased_buf_bitflips(const void *buf, size_t len, int max_bitflips);
+
+/* True if 'buf' reads as erased flash, give or take 'max_bitflips' bits */
+static inline int erased_buf_check(const void *buf, size_t len,
+				   int max_bitflips)
+{
+	return erased_buf_bitflips(buf, len, max_bitflips) >= 0;
+}
+
+#endif
@@ -48,6 +48,12 @@ struct sockaddr_ll
 #define PACKET_RESERVE			12
 #define PACKET_TX_RING			13
 #define PACKET_LOSS			14
+/* Values 15-17 are taken by options this kernel does not have. */
+#define PACKET_FANOUT			18
+
+#define PACKET_FANOUT_HASH		0
+#define PACKET_FANOUT_LB		1
+#define PACKET_FANOUT_CPU		2
 
 struct tpacket_stats
 {
@@ -55,6 +61,13 @@ struct tpacket_stats
 	unsigned int	tp_drops;
 };
 
+struct tpacket_stats_v3
+{
+	unsigned int	tp_packets;
+	unsigned int	tp_drops;
+	unsigned int	tp_freeze_q_cnt;
+};
+
 struct tpacket_auxdata
 {
 	__u32		tp_status;
@@ -72,6 +85,7 @@ struct tpacket_auxdata
 #define TP_STATUS_COPY		0x2
 #define TP_STATUS_LOSING	0x4
 #define TP_STATUS_CSUMNOTREADY	0x8
+#define TP_STATUS_BLK_TMO	0x20
 
 /* Tx ring - header status */
 #define TP_STATUS_AVAILABLE	0x0
@@ -109,10 +123,76 @@ struct tpacket2_hdr
 
 #define TPACKET2_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket2_hdr)) + sizeof(struct sockaddr_ll))
 
+struct tpacket_hdr_variant1
+{
+	__u32		tp_rxhash;
+	__u32		tp_vlan_tci;
+};
+
+struct tpacket3_hdr
+{
+	__u32		tp_next_offset;
+	__u32		tp_sec;
+	__u32		tp_nsec;
+	__u32		tp_snaplen;
+	__u32		tp_len;
+	__u32		tp_status;
+	__u16		tp_mac;
+	__u16		tp_net;
+	/* pkt_hdr variants */
+	union {
+		struct tpacket_hdr_variant1 hv1;
+	};
+};
+
+#define TPACKET3_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + sizeof(struct sockaddr_ll))
+
+struct tpacket_bd_ts
+{
+	unsigned int	ts_sec;
+	union {
+		unsigned int	ts_usec;
+		unsigned int	ts_nsec;
+	};
+};
+
+struct tpacket_hdr_v1
+{
+	__u32		block_status;
+	__u32		num_pkts;
+	__u32		offset_to_first_pkt;
+
+	/* Number of valid bytes in the block, including the block
+	 * descriptor and the private area.
+	 */
+	__u32		blk_len;
+
+	/* Monotonically increasing block sequence number, so that user
+	 * space can detect blocks it missed.
+	 */
+	__u64		seq_num __attribute__((aligned(8)));
+
+	struct tpacket_bd_ts	ts_first_pkt;
+	struct tpacket_bd_ts	ts_last_pkt;
+};
+
+union tpacket_bd_header_u
+{
+	struct tpacket_hdr_v1 bh1;
+};
+
+struct tpacket_block_desc
+{
+	__u32		version;
+	__u32		offset_to_priv;
+	union tpacket_bd_header_u hdr;
+};
+
 enum tpacket_versions
 {
 	TPACKET_V1,
 	TPACKET_V2,
+	TPACKET_V3,
 };
 
 /*
@@ -126,6 +206,20 @@ enum tpacket_versions
    - Start+tp_mac: [ Optional MAC header ]
    - Start+tp_net: Packet data, aligned to TPACKET_ALIGNMENT=16.
    - Pad to align to TPACKET_ALIGNMENT=16
+
+   TPACKET_V3 block structure:
+
+   - Start. Block must be aligned to PAGE_SIZE
+   - struct tpacket_block_desc, padded to 8 bytes
+   - Optional private area of tp_sizeof_priv bytes, padded to 8 bytes
+   - Start+offset_to_first_pkt: first frame, laid out as above with
+     struct tpacket3_hdr; each frame is padded to 8 bytes and
+     tp_next_offset leads to the next one (0 on the last frame).
+
+   The whole block is handed to user space at once by setting
+   block_status to TP_STATUS_USER, either when it is full or when
+   tp_retire_blk_tov milliseconds have passed (TP_STATUS_BLK_TMO).
+   User space gives it back by writing TP_STATUS_KERNEL.
  */
 
 struct tpacket_req
@@ -136,6 +230,26 @@ struct tpacket_req
 	unsigned int	tp_frame_nr;	/* Total number of frames */
 };
 
+struct tpacket_req3
+{
+	unsigned int	tp_block_size;	/* Minimal size of contiguous block */
+	unsigned int	tp_block_nr;	/* Number of blocks */
+	unsigned int	tp_frame_size;	/* Maximal size of a frame */
+	unsigned int	tp_frame_nr;	/* Total number of frames */
+	unsigned int	tp_retire_blk_tov; /* Block timeout in msecs */
+	unsigned int	tp_sizeof_priv;	/* Size of per-block private area */
+	unsigned int	tp_feature_req_word;
+};
+
+union tpacket_req_u
+{
+	struct tpacket_req	req;
+	struct tpacket_req3	req3;
+};
+
+/* tp_feature_req_word bits */
+#define TP_FT_REQ_FILL_RXHASH	0x1
+
 struct packet_mreq
 {
 	int		mr_ifindex;
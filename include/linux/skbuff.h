@@ -306,6 +306,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@nf_bridge: Saved data about a bridged frame - see br_netfilter.c
  *	@iif: ifindex of device we arrived on
  *	@queue_mapping: Queue mapping for multiqueue devices
+ *	@rxhash: flow hash computed on receive, 0 if not computed yet
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
  *	@ndisc_nodetype: router type (from link layer)
@@ -396,6 +397,7 @@ struct sk_buff {
 #endif
 
 	__u32			mark;
+	__u32			rxhash;
 
 	__u16			vlan_tci;
 
@@ -74,6 +74,8 @@ struct rc {
 	uint32_t code;
 	uint32_t range;
 	uint32_t bound;
+	int error;
+	void (*error_fn)(char *x);
 };
 
 
@@ -87,12 +89,20 @@ static int nofill(void *buffer, unsigned int len)
 	return -1;
 }
 
+/* Record a decoding error, unlzma() fails once it is done */
+static void INIT rc_error(struct rc *rc, char *msg)
+{
+	rc->error = 1;
+	if (rc->error_fn)
+		rc->error_fn(msg);
+}
+
 /* Called twice: once at startup and once in rc_normalize() */
 static void INIT rc_read(struct rc *rc)
 {
 	rc->buffer_size = rc->fill((char *)rc->buffer, LZMA_IOBUF_SIZE);
 	if (rc->buffer_size <= 0)
-		error("unexpected EOF");
+		rc_error(rc, "unexpected EOF");
 	rc->ptr = rc->buffer;
 	rc->buffer_end = rc->buffer + rc->buffer_size;
 }
@@ -100,7 +110,8 @@ static void INIT rc_read(struct rc *rc)
 /* Called once */
 static inline void INIT rc_init(struct rc *rc,
 				       int (*fill)(void*, unsigned int),
-				       char *buffer, int buffer_size)
+				       char *buffer, int buffer_size,
+				       void (*error_fn)(char *x))
 {
 	if (fill)
 		rc->fill = fill;
@@ -113,6 +124,8 @@ static inline void INIT rc_init(struct rc *rc,
 
 	rc->code = 0;
 	rc->range = 0xFFFFFFFF;
+	rc->error = 0;
+	rc->error_fn = error_fn;
 }
 
 static inline void INIT rc_init_code(struct rc *rc)
@@ -288,6 +301,7 @@ struct writer {
 	size_t global_pos;
 	int(*flush)(void*, unsigned int);
 	struct lzma_header *header;
+	struct rc *rc;
 };
 
 struct cstate {
@@ -309,6 +323,10 @@ static inline uint8_t INIT peek_old_byte(struct writer *wr,
 		while (offs > wr->header->dict_size)
 			offs -= wr->header->dict_size;
 		pos = wr->buffer_pos - offs;
+		if (pos < 0) {
+			rc_error(wr->rc, "match distance beyond output");
+			return 0;
+		}
 		return wr->buffer[pos];
 	} else {
 		uint32_t pos = wr->buffer_pos - offs;
@@ -531,13 +549,18 @@ static inline void INIT process_bit1(struct writer *wr, struct rc *rc,
 
 
 
-STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
-			      int(*fill)(void*, unsigned int),
-			      int(*flush)(void*, unsigned int),
-			      unsigned char *output,
-			      int *posp,
-			      void(*error_fn)(char *x)
-	)
+/*
+ * The decoder proper.  When `probs' is given, the probability table is
+ * taken from (and if needed grown in) the caller's buffer instead of being
+ * allocated for this call only.
+ */
+static int INIT __unlzma(unsigned char *buf, int in_len,
+			 int(*fill)(void*, unsigned int),
+			 int(*flush)(void*, unsigned int),
+			 unsigned char *output,
+			 int *posp,
+			 void(*error_fn)(char *x),
+			 uint16_t **probs, int *probs_size)
 {
 	struct lzma_header header;
 	int lc, pb, lp;
@@ -552,14 +575,13 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 	unsigned char *inbuf;
 	int ret = -1;
 
-	set_error_fn(error_fn);
-
 	if (buf)
 		inbuf = buf;
 	else
 		inbuf = malloc(LZMA_IOBUF_SIZE);
 	if (!inbuf) {
-		error("Could not allocate input bufer");
+		if (error_fn)
+			error_fn("Could not allocate input bufer");
 		goto exit_0;
 	}
 
@@ -571,8 +593,9 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 	wr.global_pos = 0;
 	wr.previous_byte = 0;
 	wr.buffer_pos = 0;
+	wr.rc = &rc;
 
-	rc_init(&rc, fill, inbuf, in_len);
+	rc_init(&rc, fill, inbuf, in_len, error_fn);
 
 	for (i = 0; i < sizeof(header); i++) {
 		if (rc.ptr >= rc.buffer_end)
@@ -580,8 +603,10 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 		((unsigned char *)&header)[i] = *rc.ptr++;
 	}
 
-	if (header.pos >= (9 * 5 * 5))
-		error("bad header");
+	if (header.pos >= (9 * 5 * 5)) {
+		rc_error(&rc, "bad header");
+		goto exit_1;
+	}
 
 	mi = 0;
 	lc = header.pos;
@@ -614,7 +639,15 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 		goto exit_1;
 
 	num_probs = LZMA_BASE_SIZE + (LZMA_LIT_SIZE << (lc + lp));
-	p = (uint16_t *) large_malloc(num_probs * sizeof(*p));
+	if (probs) {
+		if (*probs_size < num_probs) {
+			large_free(*probs);
+			*probs = large_malloc(num_probs * sizeof(**probs));
+			*probs_size = *probs ? num_probs : 0;
+		}
+		p = *probs;
+	} else
+		p = (uint16_t *) large_malloc(num_probs * sizeof(*p));
 	if (p == 0)
 		goto exit_2;
 	num_probs = LZMA_LITERAL + (LZMA_LIT_SIZE << (lc + lp));
@@ -641,8 +674,9 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 		*posp = rc.ptr-rc.buffer;
 	if (wr.flush)
 		wr.flush(wr.buffer, wr.buffer_pos);
-	ret = 0;
-	large_free(p);
+	ret = rc.error ? -1 : 0;
+	if (!probs)
+		large_free(p);
 exit_2:
 	if (!output)
 		large_free(wr.buffer);
@@ -653,6 +687,43 @@ exit_0:
 	return ret;
 }
 
+STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
+			      int(*fill)(void*, unsigned int),
+			      int(*flush)(void*, unsigned int),
+			      unsigned char *output,
+			      int *posp,
+			      void(*error_fn)(char *x)
+	)
+{
+	set_error_fn(error_fn);
+
+	return __unlzma(buf, in_len, fill, flush, output, posp, error_fn,
+			NULL, NULL);
+}
+
+#ifndef PREBOOT
+/**
+ * unlzma_mem - decompress an LZMA stream held in memory
+ * @buf: compressed data, starting with the LZMA header
+ * @in_len: length of @buf
+ * @output: output buffer, large enough for the size given in the header
+ * @posp: if not NULL, set to the number of input bytes used
+ * @probs: caller's probability table, vmalloc()ed or NULL
+ * @probs_size: number of entries in *@probs
+ *
+ * Unlike unlzma() this keeps no global state, so any number of callers
+ * may run it at once, and errors are only reported by the return value.
+ * The probability table is reused from one call to the next, growing it
+ * when a stream needs a larger one; release it with vfree().
+ */
+int INIT unlzma_mem(unsigned char *buf, int in_len, unsigned char *output,
+		    int *posp, uint16_t **probs, int *probs_size)
+{
+	return __unlzma(buf, in_len, NULL, NULL, output, posp, NULL,
+			probs, probs_size);
+}
+#endif
+
 #ifdef PREBOOT
 STATIC int INIT decompress(unsigned char *buf, int in_len,
 			      int(*fill)(void*, unsigned int),
@@ -0,0 +1,67 @@
+/*
+ *      erased_buf.c
+ *
+ * Checks whether a buffer read from flash looks erased (all 0xff), while
+ * tolerating a number of bits stuck at, or drifted to, 0.
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2. See the file COPYING for more details.
+ */
+
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/bitops.h>
+#include <linux/erased_buf.h>
+
+/**
+ * erased_buf_bitflips - count the bits at 0 in a supposedly erased buffer
+ * @buf:	data read from flash
+ * @len:	length of @buf, in bytes
+ * @max_bitflips: number of bits at 0 to tolerate
+ *
+ * The buffer is scanned a word at a time, and all-ones words, by far the
+ * common case, cost a single compare.  Gives up as soon as more than
+ * @max_bitflips bits at 0 are found, which is immediate for programmed data.
+ *
+ * Returns the number of bits at 0, or -EBADMSG if @buf is not erased.
+ */
+int erased_buf_bitflips(const void *buf, size_t len, int max_bitflips)
+{
+	const unsigned char *p = buf;
+	const unsigned long *w;
+	int bitflips = 0;
+
+	/* Leading bytes, up to word alignment */
+	for (; len && ((unsigned long)p & (sizeof(long) - 1)); len--, p++) {
+		if (likely(*p == 0xff))
+			continue;
+		bitflips += hweight8(~*p & 0xff);
+		if (bitflips > max_bitflips)
+			return -EBADMSG;
+	}
+
+	/* Aligned words */
+	for (w = (const unsigned long *)p; len >= sizeof(long);
+	     len -= sizeof(long), w++) {
+		if (likely(*w == ~0UL))
+			continue;
+		bitflips += hweight_long(~*w);
+		if (bitflips > max_bitflips)
+			return -EBADMSG;
+	}
+
+	/* Trailing bytes */
+	for (p = (const unsigned char *)w; len; len--, p++) {
+		if (likely(*p == 0xff))
+			continue;
+		bitflips += hweight8(~*p & 0xff);
+		if (bitflips > max_bitflips)
+			return -EBADMSG;
+	}
+
+	return bitflips;
+}
+EXPORT_SYMBOL(erased_buf_bitflips);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Erased flash buffer check with bitflip tolerance");
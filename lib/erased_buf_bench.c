@@ -0,0 +1,127 @@
+/*
+ *      erased_buf_bench.c
+ *
+ * Measures the throughput of erased_buf_bitflips() over synthetic flash
+ * pages, against the byte-at-a-time check it replaces.  Results are printed
+ * when the module is loaded.
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2. See the file COPYING for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/bitops.h>
+#include <linux/sched.h>
+#include <linux/erased_buf.h>
+
+static unsigned int page_size = 2048;
+module_param(page_size, uint, 0444);
+MODULE_PARM_DESC(page_size, "Page size, in bytes (default 2048)");
+
+static unsigned int iterations = 10000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "Pages checked per test (default 10000)");
+
+static unsigned int max_bitflips = 2;
+module_param(max_bitflips, uint, 0444);
+MODULE_PARM_DESC(max_bitflips, "Bits at 0 to tolerate (default 2)");
+
+/* Reference: the original one byte at a time check */
+static int bench_bytewise(const void *buf, size_t len, int max)
+{
+	const uint8_t *data = buf;
+	int e = 0;
+
+	while (len--) {
+		e += hweight8(~*data++ & 0xff);
+		if (e > max)
+			return -EBADMSG;
+	}
+
+	return e;
+}
+
+static void bench_run(const char *name, const void *buf,
+		      int (*check)(const void *, size_t, int))
+{
+	ktime_t start, end;
+	unsigned int i;
+	u64 ns;
+	int ret = 0;
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++)
+		ret = check(buf, page_size, max_bitflips);
+	end = ktime_get();
+
+	ns = ktime_to_ns(ktime_sub(end, start));
+	if (!ns)
+		ns = 1;
+
+	pr_info("erased_buf_bench: %-24s %s: %llu pages/s (ret %d)\n",
+		name, check == bench_bytewise ? "bytewise" : "wordwise",
+		div64_u64((u64)iterations * NSEC_PER_SEC, ns), ret);
+
+	cond_resched();
+}
+
+static void bench_page(const char *name, const void *buf)
+{
+	bench_run(name, buf, bench_bytewise);
+	bench_run(name, buf, erased_buf_bitflips);
+}
+
+static int __init erased_buf_bench_init(void)
+{
+	uint8_t *buf;
+	unsigned int i;
+
+	if (!page_size || !iterations)
+		return -EINVAL;
+
+	buf = kmalloc(page_size, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	pr_info("erased_buf_bench: %u byte pages, %u iterations, "
+		"max_bitflips %u\n", page_size, iterations, max_bitflips);
+
+	/* Erased page */
+	memset(buf, 0xff, page_size);
+	bench_page("erased", buf);
+
+	/* Erased page with bit-flips, the last one at the very end */
+	for (i = 0; i < max_bitflips; i++)
+		buf[(i + 1) * page_size / max_bitflips - 1] &= ~0x10;
+	bench_page("erased, bit-flipped", buf);
+
+	/* One bit-flip too many, found at the end */
+	memset(buf, 0xff, page_size);
+	for (i = 0; i <= max_bitflips && i < page_size; i++)
+		buf[page_size - 1 - i] = 0xff & ~0x80;
+	bench_page("not erased (late)", buf);
+
+	/* Programmed page */
+	get_random_bytes(buf, page_size);
+	bench_page("programmed", buf);
+
+	kfree(buf);
+
+	return 0;
+}
+
+static void __exit erased_buf_bench_exit(void)
+{
+}
+
+module_init(erased_buf_bench_init);
+module_exit(erased_buf_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Erased flash page checker benchmark");
@@ -0,0 +1,20 @@
+/*
+ * Run time build of the unlzma decoder.  decompress_unlzma.c is normally
+ * only used to unpack the initramfs and is placed in .init.text, this
+ * keeps it around for filesystems which store LZMA compressed blocks.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+
+#define INIT
+#include "decompress_unlzma.c"
+
+EXPORT_SYMBOL(unlzma);
+EXPORT_SYMBOL(unlzma_mem);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZMA Decompressor");
@@ -72,6 +72,11 @@
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/pfn.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
 #include <linux/bpa2.h>
 
 
@@ -80,23 +85,53 @@
 #define BPA2_RES_PREFIX "bpa2:"
 #define BPA2_RES_PREFIX_LEN 5
 
+/* Allocation latency histogram: bucket 0 counts calls shorter than 1 us,
+ * bucket n (n > 0) calls taking [2^(n-1), 2^n) us, the last one collects
+ * everything longer. */
+#define BPA2_LAT_BUCKETS 12
 
 
+
+/*
+ * Every range lives in the "by base" tree of either the free or the used
+ * set. Free ranges are additionally indexed by size (ties broken by base),
+ * so the best fitting block can be found without walking the whole
+ * partition.
+ */
 struct bpa2_range {
-	struct bpa2_range *next;
+	struct rb_node base_node; /* free_base or used_base tree */
+	struct rb_node size_node; /* free_size tree (free ranges only) */
 	unsigned long base; /* base of allocated block */
 	unsigned long size; /* size in bytes */
+	unsigned long align; /* required alignment in bytes (used only) */
+	bpa2_migrate_t migrate; /* NULL if the block is not movable */
+	void *migrate_priv;
 #if defined(CONFIG_BPA2_ALLOC_TRACE)
 	const char *trace_file;
 	int trace_line;
 #endif
 };
 
+struct bpa2_stats {
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long failed;
+	unsigned long migrated;
+	unsigned long long latency_max; /* ns */
+	unsigned long latency[BPA2_LAT_BUCKETS];
+};
+
 struct bpa2_part {
 	struct resource res;
-	struct bpa2_range initial_free_list;
-	struct bpa2_range *free_list;
-	struct bpa2_range *used_list;
+	struct bpa2_range initial_free_range;
+	struct mutex compact_lock; /* serializes bpa2_compact() */
+	spinlock_t lock; /* protects the trees below */
+	struct bpa2_range *migrating; /* block being moved by bpa2_compact() */
+	wait_queue_head_t migrate_wait; /* waiting for `migrating' to clear */
+	struct rb_root free_base;
+	struct rb_root free_size;
+	struct rb_root used_base;
+	struct bpa2_stats stats;
 	int flags;
 	int low_mem;
 	struct list_head list;
@@ -110,7 +145,6 @@ struct bpa2_part {
 
 static LIST_HEAD(bpa2_parts);
 static struct bpa2_part *bpa2_bigphysarea_part;
-static DEFINE_SPINLOCK(bpa2_lock);
 
 
 
@@ -146,6 +180,158 @@ static int bpa2_check_name(struct bpa2_part *part, const char *name)
 	return -1;
 }
 
+/*
+ * Range trees management; all of them must be called with part->lock held
+ * (or before the partition is visible to anyone else).
+ */
+
+static void bpa2_base_insert(struct rb_root *root, struct bpa2_range *range)
+{
+	struct rb_node **link = &root->rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*link) {
+		struct bpa2_range *this;
+
+		parent = *link;
+		this = rb_entry(parent, struct bpa2_range, base_node);
+		if (range->base < this->base)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	rb_link_node(&range->base_node, parent, link);
+	rb_insert_color(&range->base_node, root);
+}
+
+static struct bpa2_range *bpa2_base_lookup(struct rb_root *root,
+		unsigned long base)
+{
+	struct rb_node *node = root->rb_node;
+
+	while (node) {
+		struct bpa2_range *this;
+
+		this = rb_entry(node, struct bpa2_range, base_node);
+		if (base < this->base)
+			node = node->rb_left;
+		else if (base > this->base)
+			node = node->rb_right;
+		else
+			return this;
+	}
+
+	return NULL;
+}
+
+static void bpa2_size_insert(struct bpa2_part *part, struct bpa2_range *range)
+{
+	struct rb_node **link = &part->free_size.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*link) {
+		struct bpa2_range *this;
+
+		parent = *link;
+		this = rb_entry(parent, struct bpa2_range, size_node);
+		if (range->size < this->size ||
+				(range->size == this->size &&
+				range->base < this->base))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	rb_link_node(&range->size_node, parent, link);
+	rb_insert_color(&range->size_node, &part->free_size);
+}
+
+/* Find the smallest free range not smaller than `size' */
+static struct bpa2_range *bpa2_size_lookup(struct bpa2_part *part,
+		unsigned long size)
+{
+	struct rb_node *node = part->free_size.rb_node;
+	struct bpa2_range *best = NULL;
+
+	while (node) {
+		struct bpa2_range *this;
+
+		this = rb_entry(node, struct bpa2_range, size_node);
+		if (this->size >= size) {
+			best = this;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	return best;
+}
+
+static struct bpa2_range *bpa2_size_next(struct bpa2_range *range)
+{
+	struct rb_node *node = rb_next(&range->size_node);
+
+	return node ? rb_entry(node, struct bpa2_range, size_node) : NULL;
+}
+
+static void bpa2_free_insert(struct bpa2_part *part, struct bpa2_range *range)
+{
+	bpa2_base_insert(&part->free_base, range);
+	bpa2_size_insert(part, range);
+}
+
+static void bpa2_free_erase(struct bpa2_part *part, struct bpa2_range *range)
+{
+	rb_erase(&range->base_node, &part->free_base);
+	rb_erase(&range->size_node, &part->free_size);
+}
+
+static struct bpa2_range *bpa2_range_first(struct rb_root *root)
+{
+	struct rb_node *node = rb_first(root);
+
+	return node ? rb_entry(node, struct bpa2_range, base_node) : NULL;
+}
+
+static struct bpa2_range *bpa2_range_next(struct bpa2_range *range)
+{
+	struct rb_node *node = rb_next(&range->base_node);
+
+	return node ? rb_entry(node, struct bpa2_range, base_node) : NULL;
+}
+
+static struct bpa2_range *bpa2_range_prev(struct bpa2_range *range)
+{
+	struct rb_node *node = rb_prev(&range->base_node);
+
+	return node ? rb_entry(node, struct bpa2_range, base_node) : NULL;
+}
+
+/* Must be called with part->lock held */
+static void bpa2_stats_account(struct bpa2_part *part, unsigned long result,
+		unsigned long long start)
+{
+	struct bpa2_stats *stats = &part->stats;
+	unsigned long long delta = sched_clock() - start;
+	unsigned long us;
+	int bucket;
+
+	if (result)
+		stats->allocs++;
+	else
+		stats->failed++;
+
+	if (delta > stats->latency_max)
+		stats->latency_max = delta;
+
+	/* Anything longer than 4 seconds is off the scale anyway */
+	us = (unsigned long)min_t(unsigned long long, delta, ULONG_MAX) / 1000;
+	bucket = min(fls(us), BPA2_LAT_BUCKETS - 1);
+	stats->latency[bucket]++;
+}
+
 static int __init bpa2_alloc_low(struct bpa2_part *part, unsigned long size,
 		unsigned long *start)
 {
@@ -257,11 +443,16 @@ static int __init bpa2_add_part(const char **names, int names_cnt,
 	}
 
 	/* Initialize ranges */
-	part->initial_free_list.next = NULL;
-	part->initial_free_list.base = start;
-	part->initial_free_list.size = size;
-	part->free_list = &part->initial_free_list;
-	part->used_list = NULL;
+	mutex_init(&part->compact_lock);
+	init_waitqueue_head(&part->migrate_wait);
+	spin_lock_init(&part->lock);
+	part->free_base = RB_ROOT;
+	part->free_size = RB_ROOT;
+	part->used_base = RB_ROOT;
+	memset(&part->stats, 0, sizeof(part->stats));
+	part->initial_free_range.base = start;
+	part->initial_free_range.size = size;
+	bpa2_free_insert(part, &part->initial_free_range);
 
 	/* And finally... */
 	list_add_tail(&part->list, &bpa2_parts);
@@ -472,6 +663,95 @@ EXPORT_SYMBOL(bpa2_low_part);
 
 
 
+/*
+ * Carve `size' bytes at `aligned_base' out of the free `range'. Spare range
+ * structures are consumed (and set to NULL) as needed. The returned range
+ * is not inserted into any tree. Must be called with part->lock held.
+ */
+static struct bpa2_range *bpa2_take(struct bpa2_part *part,
+		struct bpa2_range *range, unsigned long aligned_base,
+		unsigned long size, struct bpa2_range **align_range,
+		struct bpa2_range **new_range)
+{
+	struct bpa2_range *used_range;
+
+	/* The block is going to shrink (or disappear), so take it out
+	 * of the size index; the base index order is not affected. */
+	rb_erase(&range->size_node, &part->free_size);
+
+	/* When we have to align, the pages needed for alignment can
+	 * be put back to the free pool. */
+	if (aligned_base != range->base) {
+		(*align_range)->base = range->base;
+		(*align_range)->size = aligned_base - range->base;
+		range->base = aligned_base;
+		range->size -= (*align_range)->size;
+		bpa2_free_insert(part, *align_range);
+		*align_range = NULL;
+	}
+
+	if (size < range->size) {
+		/* Range is larger than needed, create a new element for
+		 * the used tree and shrink the free one. */
+		used_range = *new_range;
+		used_range->base = range->base;
+		used_range->size = size;
+		range->base = used_range->base + used_range->size;
+		range->size = range->size - used_range->size;
+		bpa2_size_insert(part, range);
+		*new_range = NULL;
+	} else {
+		/* Range fits perfectly, remove it from free tree. */
+		rb_erase(&range->base_node, &part->free_base);
+		used_range = range;
+	}
+
+	return used_range;
+}
+
+/*
+ * Return a range (already removed from the used tree) to the free trees,
+ * merging it with its neighbours. Range structures which became redundant
+ * are returned via `drop' and should be passed to bpa2_range_kfree() once
+ * the lock is released. Must be called with part->lock held.
+ */
+static void bpa2_release(struct bpa2_part *part, struct bpa2_range *range,
+		struct bpa2_range *drop[2])
+{
+	struct bpa2_range *prev, *next;
+
+	bpa2_base_insert(&part->free_base, range);
+
+	/* Concatenate free range with neighbors, if possible.
+	 * Try for upper neighbor first, then for lower one. */
+	next = bpa2_range_next(range);
+	if (next != NULL && range->base + range->size == next->base) {
+		bpa2_free_erase(part, next);
+		range->size += next->size;
+	} else {
+		next = NULL;
+	}
+	prev = bpa2_range_prev(range);
+	if (prev != NULL && prev->base + prev->size == range->base) {
+		rb_erase(&range->base_node, &part->free_base);
+		rb_erase(&prev->size_node, &part->free_size);
+		prev->size += range->size;
+		bpa2_size_insert(part, prev);
+	} else {
+		bpa2_size_insert(part, range);
+		range = NULL;
+	}
+
+	drop[0] = next;
+	drop[1] = range;
+}
+
+static void bpa2_range_kfree(struct bpa2_part *part, struct bpa2_range *range)
+{
+	if (range && (range != &part->initial_free_range))
+		kfree(range);
+}
+
 /**
  * __bpa2_alloc_pages - allocate pages from a bpa2 partition
  * @part: partition to allocate from
@@ -489,83 +769,64 @@ EXPORT_SYMBOL(bpa2_low_part);
 unsigned long __bpa2_alloc_pages(struct bpa2_part *part, int count, int align,
 		int priority, const char *trace_file, int trace_line)
 {
-	struct bpa2_range *range, **range_ptr;
+	struct bpa2_range *range;
 	struct bpa2_range *new_range, *align_range, *used_range;
+	unsigned long size = count * PAGE_SIZE;
 	unsigned long aligned_base = 0;
 	unsigned long result = 0;
+	unsigned long long start;
 
 	if (count == 0)
 		return 0;
 
+	start = sched_clock();
+
 	/* Allocate the data structures we might need here so that we
 	 * don't have problems inside the spinlock.
 	 * Free at the end if not used. */
 	new_range = kmalloc(sizeof(*new_range), priority);
 	align_range = kmalloc(sizeof(*align_range), priority);
-	if ((new_range == NULL) || (align_range == NULL))
-		goto fail;
+	if ((new_range == NULL) || (align_range == NULL)) {
+		spin_lock(&part->lock);
+		goto fail_unlock;
+	}
 
 	if (align == 0)
 		align = PAGE_SIZE;
 	else
 		align = align * PAGE_SIZE;
 
-	spin_lock(&bpa2_lock);
+	spin_lock(&part->lock);
 
-	/* Search a free block which is large enough, even with alignment. */
-	range_ptr = &part->free_list;
-	while (*range_ptr != NULL) {
-		range = *range_ptr;
+	/* Search the smallest free block which is large enough, even with
+	 * alignment. Blocks are visited in the size order, starting from
+	 * the first one which could possibly fit. */
+	for (range = bpa2_size_lookup(part, size); range != NULL;
+			range = bpa2_size_next(range)) {
 		aligned_base = ((range->base + align - 1) / align) * align;
-		if (aligned_base + count * PAGE_SIZE <=
-				range->base + range->size)
+		if (aligned_base + size <= range->base + range->size)
 			break;
-		range_ptr = &range->next;
 	}
-	if (*range_ptr == NULL)
+	if (range == NULL)
 		goto fail_unlock;
-	range = *range_ptr;
 
-	/* When we have to align, the pages needed for alignment can
-	 * be put back to the free pool. */
-	if (aligned_base != range->base) {
-		align_range->base = range->base;
-		align_range->size = aligned_base - range->base;
-		range->base = aligned_base;
-		range->size -= align_range->size;
-		align_range->next = range;
-		*range_ptr = align_range;
-		range_ptr = &align_range->next;
-		align_range = NULL;
-	}
-
-	if (count * PAGE_SIZE < range->size) {
-		/* Range is larger than needed, create a new list element for
-		 * the used list and shrink the element in the free list. */
-		new_range->base = range->base;
-		new_range->size = count * PAGE_SIZE;
-		range->base = new_range->base + new_range->size;
-		range->size = range->size - new_range->size;
-		used_range = new_range;
-		new_range = NULL;
-	} else {
-		/* Range fits perfectly, remove it from free list. */
-		*range_ptr = range->next;
-		used_range = range;
-	}
+	used_range = bpa2_take(part, range, aligned_base, size,
+			&align_range, &new_range);
+	used_range->align = align;
+	used_range->migrate = NULL;
+	used_range->migrate_priv = NULL;
 #if defined(CONFIG_BPA2_ALLOC_TRACE)
 	/* Save the caller data */
 	used_range->trace_file = trace_file;
 	used_range->trace_line = trace_line;
 #endif
-	/* Insert block into used list */
-	used_range->next = part->used_list;
-	part->used_list = used_range;
+	/* Insert block into used tree */
+	bpa2_base_insert(&part->used_base, used_range);
 	result = used_range->base;
 
 fail_unlock:
-	spin_unlock(&bpa2_lock);
-fail:
+	bpa2_stats_account(part, result, start);
+	spin_unlock(&part->lock);
 	if (new_range)
 		kfree(new_range);
 	if (align_range)
@@ -575,76 +836,294 @@ fail:
 }
 EXPORT_SYMBOL(__bpa2_alloc_pages);
 
+/* Look the used block at `base' up, waiting for bpa2_compact() to finish
+ * moving it first. A moved block keeps its range structure, so the block
+ * is followed to its new base rather than looked up again at the old one.
+ * Called and returns with part->lock held. */
+static struct bpa2_range *bpa2_used_lookup_idle(struct bpa2_part *part,
+		unsigned long base)
+{
+	struct bpa2_range *range;
+
+	range = bpa2_base_lookup(&part->used_base, base);
+	while (range != NULL && range == part->migrating) {
+		spin_unlock(&part->lock);
+		wait_event(part->migrate_wait, part->migrating != range);
+		spin_lock(&part->lock);
+	}
+
+	return range;
+}
+
 /**
  * bpa2_free_pages - free pages allocated from a bpa2 partition
  * @part: partition to free pages back to
- * @base:
- * @align: required alinment
- * @priority: GFP_* flags to use
+ * @base: physical address of the block, as returned by bpa2_alloc_pages()
  *
- * Free pages allocated with `bigphysarea_alloc_pages'. `base' must be an
- * address returned by `bigphysarea_alloc_pages'.
+ * Free pages allocated with `bpa2_alloc_pages'. `base' must be an
+ * address returned by `bpa2_alloc_pages'.
+ * If the block is being moved by bpa2_compact(), wait for the move to
+ * complete and free it at its new location.
  * This function my not be called from an interrupt!
  */
 void bpa2_free_pages(struct bpa2_part *part, unsigned long base)
 {
-	struct bpa2_range *prev, *next, *range, **range_ptr;
+	struct bpa2_range *range, *drop[2];
 
-	spin_lock(&bpa2_lock);
+	spin_lock(&part->lock);
 
-	/* Search the block in the used list. */
-	for (range_ptr = &part->used_list;
-			*range_ptr != NULL;
-			range_ptr = &(*range_ptr)->next)
-		if ((*range_ptr)->base == base)
-			break;
-	if (*range_ptr == NULL) {
+	/* Search the block in the used tree. */
+	range = bpa2_used_lookup_idle(part, base);
+	if (range == NULL) {
 		printk(KERN_ERR "%s: 0x%08lx not allocated!\n",
 				__func__, base);
-		spin_unlock(&bpa2_lock);
+		spin_unlock(&part->lock);
 		return;
 	}
-	range = *range_ptr;
 
-	/* Remove range from the used list: */
-	*range_ptr = (*range_ptr)->next;
+	/* Move range from the used tree to the free ones */
+	rb_erase(&range->base_node, &part->used_base);
+	bpa2_release(part, range, drop);
+	part->stats.frees++;
 
-	/* The free-list is sorted by address, search insertion point
-	 * and insert block in free list. */
-	for (range_ptr = &part->free_list, prev = NULL;
-			*range_ptr != NULL;
-			prev = *range_ptr, range_ptr = &(*range_ptr)->next)
-		if ((*range_ptr)->base >= base)
-			break;
-	range->next  = *range_ptr;
-	*range_ptr   = range;
+	spin_unlock(&part->lock);
 
-	/* Concatenate free range with neighbors, if possible.
-	 * Try for upper neighbor (next in list) first, then
-	 * for lower neighbor (predecessor in list). */
-	next = NULL;
-	if (range->next != NULL &&
-			range->base + range->size == range->next->base) {
-		next = range->next;
-		range->size += next->size;
-		range->next = next->next;
-	}
-	if (prev != NULL &&
-			prev->base + prev->size == range->base) {
-		prev->size += range->size;
-		prev->next = range->next;
+	bpa2_range_kfree(part, drop[0]);
+	bpa2_range_kfree(part, drop[1]);
+}
+EXPORT_SYMBOL(bpa2_free_pages);
+
+/**
+ * bpa2_set_movable - declare that an allocated block may be moved
+ * @part: partition the block was allocated from
+ * @base: physical address of the block, as returned by bpa2_alloc_pages()
+ * @migrate: callback moving the block contents, NULL makes it unmovable
+ * @priv: private data passed to the callback
+ *
+ * Allow bpa2_compact() to relocate the block. When this happens the
+ * `migrate' callback is called (in process context, without any bpa2
+ * locks held) with the old and new physical base addresses. It must stop
+ * any device accessing the block, copy the contents to the new location
+ * and update all the references, then return 0. Any other return value
+ * aborts the move and the block stays where it was. The new location may
+ * overlap the old one (the block slides down), so the copy must be done
+ * as memmove() would.
+ *
+ * Freeing the block or changing its callback while it is being moved
+ * waits for the move to complete, so the callback must not do either.
+ */
+int bpa2_set_movable(struct bpa2_part *part, unsigned long base,
+		bpa2_migrate_t migrate, void *priv)
+{
+	struct bpa2_range *range;
+	int result = 0;
+
+	spin_lock(&part->lock);
+
+	range = bpa2_used_lookup_idle(part, base);
+	if (range) {
+		range->migrate = migrate;
+		range->migrate_priv = priv;
 	} else {
-		range = NULL;
+		printk(KERN_ERR "%s: 0x%08lx not allocated!\n",
+				__func__, base);
+		result = -EINVAL;
 	}
 
-	spin_unlock(&bpa2_lock);
+	spin_unlock(&part->lock);
 
-	if (next && (next != &part->initial_free_list))
-		kfree(next);
-	if (range && (range != &part->initial_free_list))
-		kfree(range);
+	return result;
 }
-EXPORT_SYMBOL(bpa2_free_pages);
+EXPORT_SYMBOL(bpa2_set_movable);
+
+/* First movable block at or above `base'. Called with part->lock held. */
+static struct bpa2_range *bpa2_next_movable(struct bpa2_part *part,
+		unsigned long base)
+{
+	struct rb_node *node = part->used_base.rb_node;
+	struct bpa2_range *range = NULL;
+
+	/* Lower bound lookup... */
+	while (node) {
+		struct bpa2_range *this;
+
+		this = rb_entry(node, struct bpa2_range, base_node);
+		if (this->base >= base) {
+			range = this;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	/* ... and skip the immovable ones */
+	while (range && !range->migrate)
+		range = bpa2_range_next(range);
+
+	return range;
+}
+
+/* Lowest free block below `range' able to hold it or, failing that, the
+ * free block right below `range', into which it can slide down. `size' is
+ * set to the number of bytes to take from the hole at `aligned_base'.
+ * Called with part->lock held. */
+static struct bpa2_range *bpa2_find_hole(struct bpa2_part *part,
+		struct bpa2_range *range, unsigned long *aligned_base,
+		unsigned long *size)
+{
+	struct bpa2_range *hole, *below = NULL;
+	unsigned long base;
+
+	for (hole = bpa2_range_first(&part->free_base);
+			hole != NULL && hole->base < range->base;
+			hole = bpa2_range_next(hole)) {
+		base = ((hole->base + range->align - 1) /
+				range->align) * range->align;
+		if (base + range->size <= hole->base + hole->size) {
+			*aligned_base = base;
+			*size = range->size;
+			return hole;
+		}
+		below = hole;
+	}
+
+	if (below == NULL || below->base + below->size != range->base)
+		return NULL;
+
+	base = ((below->base + range->align - 1) / range->align) *
+			range->align;
+	if (base >= range->base)
+		return NULL;
+
+	*aligned_base = base;
+	*size = range->base - base;
+	return below;
+}
+
+/**
+ * bpa2_compact - defragment a bpa2 partition
+ * @part: partition to compact
+ *
+ * Walk the allocated blocks from the bottom of the partition up and move
+ * every movable one (see bpa2_set_movable()) to the lowest free block it
+ * fits in or, if there is none, slide it down over the free block right
+ * below it, so that free memory accumulates at the top of the partition
+ * and merges into large extents.
+ *
+ * Returns the number of blocks moved or a negative error code. This
+ * function may sleep.
+ */
+int bpa2_compact(struct bpa2_part *part)
+{
+	struct bpa2_range *new_range = NULL, *align_range = NULL;
+	unsigned long cursor = 0;
+	int moved = 0;
+	int result = 0;
+
+	mutex_lock(&part->compact_lock);
+
+	for (;;) {
+		struct bpa2_range *range, *hole, *dest, *drop[2];
+		unsigned long aligned_base = 0, hole_size = 0;
+		bpa2_migrate_t migrate;
+		void *migrate_priv;
+		unsigned long base, size, new_base;
+		int err;
+
+		/* Spare range structures for bpa2_take() */
+		if (!new_range)
+			new_range = kmalloc(sizeof(*new_range), GFP_KERNEL);
+		if (!align_range)
+			align_range = kmalloc(sizeof(*align_range), GFP_KERNEL);
+		if (!new_range || !align_range) {
+			result = -ENOMEM;
+			break;
+		}
+
+		spin_lock(&part->lock);
+
+		range = bpa2_next_movable(part, cursor);
+		if (!range) {
+			spin_unlock(&part->lock);
+			break;
+		}
+		cursor = range->base + range->size;
+
+		hole = bpa2_find_hole(part, range, &aligned_base, &hole_size);
+		if (!hole) {
+			spin_unlock(&part->lock);
+			continue;
+		}
+
+		/* Reserve the destination, so nobody allocates it while
+		 * the owner is copying the data. When sliding down, only
+		 * the part not covered by the block itself is reserved. */
+		dest = bpa2_take(part, hole, aligned_base, hole_size,
+				&align_range, &new_range);
+		dest->align = range->align;
+		dest->migrate = NULL;
+		dest->migrate_priv = NULL;
+#if defined(CONFIG_BPA2_ALLOC_TRACE)
+		dest->trace_file = NULL;
+		dest->trace_line = 0;
+#endif
+		bpa2_base_insert(&part->used_base, dest);
+
+		/* Nobody may free the block or change its callback until
+		 * the move is over (see bpa2_used_lookup_idle()) */
+		migrate = range->migrate;
+		migrate_priv = range->migrate_priv;
+		base = range->base;
+		size = range->size;
+		new_base = dest->base;
+		part->migrating = range;
+
+		spin_unlock(&part->lock);
+
+		err = migrate(migrate_priv, base, new_base, size);
+
+		spin_lock(&part->lock);
+
+		part->migrating = NULL;
+
+		/* Nobody could have released it, but be paranoid... */
+		if (WARN_ON(bpa2_base_lookup(&part->used_base, base) != range))
+			err = -EINVAL;
+
+		if (err == 0) {
+			/* The block keeps its range structure, for anybody
+			 * waiting in bpa2_used_lookup_idle(), and `dest'
+			 * becomes the part of the old and reserved areas
+			 * left over above the block's new location */
+			rb_erase(&range->base_node, &part->used_base);
+			rb_erase(&dest->base_node, &part->used_base);
+			range->base = new_base;
+			bpa2_base_insert(&part->used_base, range);
+			dest->base = base + size - dest->size;
+			bpa2_release(part, dest, drop);
+			part->stats.migrated++;
+			moved++;
+		} else {
+			rb_erase(&dest->base_node, &part->used_base);
+			bpa2_release(part, dest, drop);
+		}
+
+		spin_unlock(&part->lock);
+
+		wake_up_all(&part->migrate_wait);
+
+		bpa2_range_kfree(part, drop[0]);
+		bpa2_range_kfree(part, drop[1]);
+	}
+
+	mutex_unlock(&part->compact_lock);
+
+	kfree(new_range);
+	kfree(align_range);
+
+	return result ? result : moved;
+}
+EXPORT_SYMBOL(bpa2_compact);
 
 
 
@@ -680,8 +1159,6 @@ EXPORT_SYMBOL(bigphysarea_free_pages);
 
 static void *bpa2_seq_start(struct seq_file *s, loff_t *pos)
 {
-	spin_lock(&bpa2_lock);
-
 	return seq_list_start(&bpa2_parts, *pos);
 }
 
@@ -692,36 +1169,53 @@ static void *bpa2_seq_next(struct seq_file *s, void *v, loff_t *pos)
 
 static void bpa2_seq_stop(struct seq_file *s, void *v)
 {
-	spin_unlock(&bpa2_lock);
+}
+
+static void bpa2_walk_ranges(struct rb_root *root, int *count,
+		unsigned long *total, unsigned long *max)
+{
+	struct bpa2_range *range;
+
+	*count = 0;
+	*total = 0;
+	*max = 0;
+	for (range = bpa2_range_first(root); range != NULL;
+			range = bpa2_range_next(range)) {
+		(*count)++;
+		*total += range->size;
+		if (range->size > *max)
+			*max = range->size;
+	}
+}
+
+/* Fragmentation of the free memory in 1/1000 units: 0 means all the free
+ * memory is available as one block, values close to 1000 mean that the
+ * largest free block is a tiny fraction of the free memory. */
+static int bpa2_frag_index(unsigned long free_total, unsigned long free_max)
+{
+	if (free_total == 0)
+		return 0;
+
+	return 1000 - (free_max >> PAGE_SHIFT) * 1000 /
+			(free_total >> PAGE_SHIFT);
 }
 
 static int bpa2_seq_show(struct seq_file *s, void *v)
 {
 	struct bpa2_part *part = list_entry(v, struct bpa2_part, list);
+	struct bpa2_stats *stats = &part->stats;
 	struct bpa2_range *range;
-	int free_count, free_total, free_max;
-	int used_count, used_total, used_max;
+	int free_count, used_count;
+	unsigned long free_total, free_max;
+	unsigned long used_total, used_max;
 	int i;
 
-	free_count = 0;
-	free_total = 0;
-	free_max = 0;
-	for (range = part->free_list; range != NULL; range = range->next) {
-		free_count++;
-		free_total += range->size;
-		if (range->size > free_max)
-			free_max = range->size;
-	}
+	spin_lock(&part->lock);
 
-	used_count = 0;
-	used_total = 0;
-	used_max = 0;
-	for (range = part->used_list; range != NULL; range = range->next) {
-		used_count++;
-		used_total += range->size;
-		if (range->size > used_max)
-			used_max = range->size;
-	}
+	bpa2_walk_ranges(&part->free_base, &free_count, &free_total,
+			&free_max);
+	bpa2_walk_ranges(&part->used_base, &used_count, &used_total,
+			&used_max);
 
 	seq_printf(s, "Partition: ");
 	for (i = 0; i < part->names_cnt; i++)
@@ -735,15 +1229,32 @@ static int bpa2_seq_show(struct seq_file *s, void *v)
 			"    used\n");
 	seq_printf(s, "- number of blocks:      %8d       %8d\n",
 			free_count, used_count);
-	seq_printf(s, "- size of largest block: %8d kB    %8d kB\n",
+	seq_printf(s, "- size of largest block: %8lu kB    %8lu kB\n",
 			free_max / 1024, used_max / 1024);
-	seq_printf(s, "- total:                 %8d kB    %8d kB\n",
+	seq_printf(s, "- total:                 %8lu kB    %8lu kB\n",
 			free_total / 1024, used_total / 1024);
+	seq_printf(s, "- fragmentation index:   %8d/1000\n",
+			bpa2_frag_index(free_total, free_max));
+	seq_printf(s, "Counters: %lu allocations, %lu frees, %lu failed, "
+			"%lu migrated\n", stats->allocs, stats->frees,
+			stats->failed, stats->migrated);
+	seq_printf(s, "Allocation latency (max %llu ns):\n",
+			stats->latency_max);
+	for (i = 0; i < BPA2_LAT_BUCKETS; i++) {
+		if (!stats->latency[i])
+			continue;
+		if (i == BPA2_LAT_BUCKETS - 1)
+			seq_printf(s, "- >= %5d us:            %8lu\n",
+					1 << (i - 1), stats->latency[i]);
+		else
+			seq_printf(s, "- <  %5d us:            %8lu\n",
+					1 << i, stats->latency[i]);
+	}
 
 	if (used_count) {
 		seq_printf(s, "Allocations:\n");
-		for (range = part->used_list; range != NULL;
-				range = range->next) {
+		for (range = bpa2_range_first(&part->used_base);
+				range != NULL; range = bpa2_range_next(range)) {
 			seq_printf(s, "- %lu B at 0x%.8lx",
 					range->size, range->base);
 #if defined(CONFIG_BPA2_ALLOC_TRACE)
@@ -757,6 +1268,47 @@ static int bpa2_seq_show(struct seq_file *s, void *v)
 
 	seq_printf(s, "\n");
 
+	spin_unlock(&part->lock);
+
+	return 0;
+}
+
+/*
+ * Machine readable variant: one line per partition, sizes in bytes,
+ * latency histogram buckets as described at BPA2_LAT_BUCKETS.
+ */
+static int bpa2_stats_seq_show(struct seq_file *s, void *v)
+{
+	struct bpa2_part *part = list_entry(v, struct bpa2_part, list);
+	struct bpa2_stats *stats = &part->stats;
+	int free_count, used_count;
+	unsigned long free_total, free_max;
+	unsigned long used_total, used_max;
+	int i;
+
+	spin_lock(&part->lock);
+
+	bpa2_walk_ranges(&part->free_base, &free_count, &free_total,
+			&free_max);
+	bpa2_walk_ranges(&part->used_base, &used_count, &used_total,
+			&used_max);
+
+	seq_printf(s, "%s size=%lu free=%lu used=%lu free_blocks=%d "
+			"used_blocks=%d largest_free=%lu frag=%d allocs=%lu "
+			"frees=%lu failed=%lu migrated=%lu latency_max_ns=%llu "
+			"latency_us=",
+			bpa2_get_name(part, 0),
+			(unsigned long)(part->res.end - part->res.start + 1),
+			free_total, used_total, free_count, used_count,
+			free_max, bpa2_frag_index(free_total, free_max),
+			stats->allocs, stats->frees, stats->failed,
+			stats->migrated, stats->latency_max);
+	for (i = 0; i < BPA2_LAT_BUCKETS; i++)
+		seq_printf(s, "%s%lu", i > 0 ? "," : "", stats->latency[i]);
+	seq_printf(s, "\n");
+
+	spin_unlock(&part->lock);
+
 	return 0;
 }
 
@@ -780,10 +1332,63 @@ static const struct file_operations bpa2_debugfs_ops = {
 	.release = seq_release,
 };
 
+static struct seq_operations bpa2_stats_seq_ops = {
+	.start = bpa2_seq_start,
+	.next = bpa2_seq_next,
+	.stop = bpa2_seq_stop,
+	.show = bpa2_stats_seq_show,
+};
+
+static int bpa2_stats_debugfs_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &bpa2_stats_seq_ops);
+}
+
+static const struct file_operations bpa2_stats_debugfs_ops = {
+	.owner = THIS_MODULE,
+	.open = bpa2_stats_debugfs_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+/* Writing a partition name triggers its compaction */
+static ssize_t bpa2_compact_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	char name[BPA2_MAX_NAME_LEN + 1];
+	size_t len = min(count, sizeof(name) - 1);
+	struct bpa2_part *part;
+	int result;
+
+	if (copy_from_user(name, buf, len))
+		return -EFAULT;
+	name[len] = 0;
+
+	part = bpa2_find_part(strstrip(name));
+	if (!part)
+		return -ENOENT;
+
+	result = bpa2_compact(part);
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+static const struct file_operations bpa2_compact_debugfs_ops = {
+	.owner = THIS_MODULE,
+	.write = bpa2_compact_write,
+};
+
 static int __init bpa2_debugfs_init(void)
 {
 	debugfs_create_file("bpa2", S_IFREG | S_IRUGO,
 			NULL, NULL, &bpa2_debugfs_ops);
+	debugfs_create_file("bpa2_stats", S_IFREG | S_IRUGO,
+			NULL, NULL, &bpa2_stats_debugfs_ops);
+	debugfs_create_file("bpa2_compact", S_IFREG | S_IWUSR,
+			NULL, NULL, &bpa2_compact_debugfs_ops);
 
 	return 0;
 }
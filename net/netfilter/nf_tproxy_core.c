@@ -31,6 +31,7 @@ nf_tproxy_get_sock_v4(struct net *net, const u8 protocol,
 	case IPPROTO_TCP:
 		if (listening_only)
 			sk = __inet_lookup_listener(net, &tcp_hashinfo,
+						    saddr, sport,
 						    daddr, ntohs(dport),
 						    in->ifindex);
 		else
@@ -56,6 +56,8 @@
 #include <linux/in.h>
 #include <linux/inet.h>
 #include <linux/netdevice.h>
+#include <linux/ethtool.h>
+#include <linux/rtnetlink.h>
 #include <linux/if_packet.h>
 #include <linux/wireless.h>
 #include <linux/kernel.h>
@@ -156,9 +158,44 @@ struct packet_mreq_max {
 };
 
 #ifdef CONFIG_PACKET_MMAP
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring);
 
+/* Block descriptor queue of a TPACKET_V3 rx ring. */
+struct tpacket_kbdq_core {
+	char		**pkbdq;
+	unsigned int	feature_req_word;
+	unsigned int	knum_blocks;
+	unsigned int	kblk_size;
+	unsigned int	blk_sizeof_priv;
+
+	/* block currently being filled, and its value at the last timer run */
+	unsigned int	kactive_blk_num;
+	unsigned int	last_kactive_blk_num;
+
+	char		*nxt_offset;	/* where the next frame goes */
+	char		*prev;		/* last frame put in the block */
+	u64		knxt_seq_num;
+
+	/* user space still owns the next block, nothing can be stored */
+	unsigned int	reset_pending_on_curr_blk:1,
+			delete_blk_timer:1;
+
+	/* frames claimed but not yet completely copied out */
+	atomic_t	blk_fill_in_prog;
+
+	unsigned int	retire_blk_tov;	/* msecs */
+	unsigned long	tov_in_jiffies;
+	struct timer_list retire_blk_timer;
+};
+
+#define V3_ALIGNMENT		8
+#define BLK_HDR_LEN		ALIGN(sizeof(struct tpacket_block_desc), \
+				      V3_ALIGNMENT)
+#define BLK_PLUS_PRIV(sz_of_priv) \
+	(BLK_HDR_LEN + ALIGN((sz_of_priv), V3_ALIGNMENT))
+#define DEFAULT_PRB_RETIRE_TOV	8	/* msecs */
+
 struct packet_ring_buffer {
 	char			**pg_vec;
 	unsigned int		head;
@@ -171,6 +208,8 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_len;
 
 	atomic_t		pending;
+
+	struct tpacket_kbdq_core	prb_bdqc;
 };
 
 struct packet_sock;
@@ -179,6 +218,27 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg);
 
 static void packet_flush_mclist(struct sock *sk);
 
+#define PACKET_FANOUT_MAX	256
+
+/*
+ * A fanout group owns the only protocol hook of its member sockets and
+ * passes each packet on to one of them.
+ */
+struct packet_fanout {
+#ifdef CONFIG_NET_NS
+	struct net		*net;
+#endif
+	unsigned int		num_members;
+	u16			id;
+	u8			type;
+	atomic_t		rr_cur;
+	struct list_head	list;
+	struct sock		*arr[PACKET_FANOUT_MAX];
+	spinlock_t		lock;
+	atomic_t		sk_ref;
+	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
+};
+
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
@@ -197,12 +257,14 @@ struct packet_sock {
 	int			ifindex;	/* bound device		*/
 	__be16			num;
 	struct packet_mclist	*mclist;
+	struct packet_fanout	*fanout;
 #ifdef CONFIG_PACKET_MMAP
 	atomic_t		mapped;
 	enum tpacket_versions	tp_version;
 	unsigned int		tp_hdrlen;
 	unsigned int		tp_reserve;
 	unsigned int		tp_loss:1;
+	unsigned int		tp_freeze_q_cnt;
 #endif
 };
 
@@ -312,6 +374,241 @@ static inline void packet_increment_head(struct packet_ring_buffer *buff)
 	buff->head = buff->head != buff->frame_max ? buff->head+1 : 0;
 }
 
+/*
+ * TPACKET_V3: frames of any length are packed one after the other into
+ * the current block, and user space is handed whole blocks instead of
+ * single frames.  A block is retired when the next frame does not fit
+ * in it, or when it has been open for retire_blk_tov msecs, so that a
+ * slow link does not keep frames away from user space for too long.
+ * Everything below runs under sk_receive_queue.lock.
+ */
+
+static inline struct tpacket_block_desc *prb_block(
+		struct tpacket_kbdq_core *pkc, unsigned int num)
+{
+	return (struct tpacket_block_desc *)pkc->pkbdq[num];
+}
+
+static inline unsigned int prb_next_blk_num(struct tpacket_kbdq_core *pkc)
+{
+	unsigned int num = pkc->kactive_blk_num + 1;
+
+	return num < pkc->knum_blocks ? num : 0;
+}
+
+static inline unsigned int prb_previous_blk_num(struct tpacket_kbdq_core *pkc)
+{
+	unsigned int num = pkc->kactive_blk_num;
+
+	return (num ? num : pkc->knum_blocks) - 1;
+}
+
+static int prb_blk_in_use(struct tpacket_block_desc *pbd)
+{
+	smp_rmb();
+	flush_dcache_page(virt_to_page(&pbd->hdr.bh1.block_status));
+	return pbd->hdr.bh1.block_status & TP_STATUS_USER;
+}
+
+static void prb_open_block(struct tpacket_kbdq_core *pkc,
+		struct tpacket_block_desc *pbd)
+{
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct timespec ts;
+
+	getnstimeofday(&ts);
+
+	pbd->version = TPACKET_V3;
+	pbd->offset_to_priv = BLK_HDR_LEN;
+	h1->num_pkts = 0;
+	h1->offset_to_first_pkt = BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	h1->blk_len = h1->offset_to_first_pkt;
+	h1->seq_num = pkc->knxt_seq_num++;
+	h1->ts_first_pkt.ts_sec = ts.tv_sec;
+	h1->ts_first_pkt.ts_nsec = ts.tv_nsec;
+	h1->ts_last_pkt = h1->ts_first_pkt;
+
+	pkc->nxt_offset = (char *)pbd + h1->offset_to_first_pkt;
+	pkc->prev = pkc->nxt_offset;
+	pkc->reset_pending_on_curr_blk = 0;
+
+	if (!pkc->delete_blk_timer)
+		mod_timer(&pkc->retire_blk_timer,
+			  jiffies + pkc->tov_in_jiffies);
+}
+
+/*
+ * Hand the current block over to user space.  Frames are copied into
+ * the block outside the queue lock, so wait for the ones in flight.
+ */
+static void prb_retire_current_block(struct packet_sock *po,
+		struct tpacket_kbdq_core *pkc, unsigned int status)
+{
+	struct tpacket_block_desc *pbd = prb_block(pkc, pkc->kactive_blk_num);
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct tpacket3_hdr *last_pkt;
+
+	while (atomic_read(&pkc->blk_fill_in_prog))
+		cpu_relax();
+
+	if (po->stats.tp_drops)
+		status |= TP_STATUS_LOSING;
+
+	last_pkt = (struct tpacket3_hdr *)pkc->prev;
+	last_pkt->tp_next_offset = 0;
+	h1->ts_last_pkt.ts_sec = last_pkt->tp_sec;
+	h1->ts_last_pkt.ts_nsec = last_pkt->tp_nsec;
+
+	smp_wmb();
+	h1->block_status = TP_STATUS_USER | status;
+	flush_dcache_page(virt_to_page(&h1->block_status));
+	smp_wmb();
+
+	pkc->kactive_blk_num = prb_next_blk_num(pkc);
+	po->sk.sk_data_ready(&po->sk, 0);
+}
+
+/*
+ * Open the block following the one just retired.  If user space has not
+ * given it back yet the queue is frozen, and incoming frames are dropped
+ * until it does.
+ */
+static char *prb_dispatch_next_block(struct packet_sock *po,
+		struct tpacket_kbdq_core *pkc)
+{
+	struct tpacket_block_desc *pbd = prb_block(pkc, pkc->kactive_blk_num);
+
+	if (prb_blk_in_use(pbd)) {
+		pkc->reset_pending_on_curr_blk = 1;
+		po->tp_freeze_q_cnt++;
+		return NULL;
+	}
+
+	prb_open_block(pkc, pbd);
+	return pkc->nxt_offset;
+}
+
+static void *prb_lookup_frame_in_block(struct packet_sock *po,
+		unsigned int len)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct tpacket_block_desc *pbd = prb_block(pkc, pkc->kactive_blk_num);
+	char *curr;
+
+	if (pkc->reset_pending_on_curr_blk) {
+		if (prb_blk_in_use(pbd))
+			return NULL;
+		prb_open_block(pkc, pbd);
+	}
+
+	len = ALIGN(len, V3_ALIGNMENT);
+	curr = pkc->nxt_offset;
+	if (curr + len > (char *)pbd + pkc->kblk_size) {
+		prb_retire_current_block(po, pkc, 0);
+		curr = prb_dispatch_next_block(po, pkc);
+		if (!curr)
+			return NULL;
+		pbd = prb_block(pkc, pkc->kactive_blk_num);
+	}
+
+	((struct tpacket3_hdr *)curr)->tp_next_offset = len;
+	pkc->prev = curr;
+	pkc->nxt_offset = curr + len;
+	pbd->hdr.bh1.blk_len += len;
+	pbd->hdr.bh1.num_pkts++;
+	atomic_inc(&pkc->blk_fill_in_prog);
+
+	return curr;
+}
+
+static void prb_retire_rx_blk_timer_expired(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct tpacket_block_desc *pbd;
+
+	spin_lock(&po->sk.sk_receive_queue.lock);
+	if (unlikely(pkc->delete_blk_timer))
+		goto out;
+
+	pbd = prb_block(pkc, pkc->kactive_blk_num);
+	if (pkc->reset_pending_on_curr_blk) {
+		/* Frozen: see whether user space gave the block back. */
+		if (!prb_blk_in_use(pbd)) {
+			prb_open_block(pkc, pbd);
+			goto out;
+		}
+	} else if (pbd->hdr.bh1.num_pkts &&
+		   !atomic_read(&pkc->blk_fill_in_prog)) {
+		prb_retire_current_block(po, pkc, TP_STATUS_BLK_TMO);
+		if (prb_dispatch_next_block(po, pkc))
+			goto out;
+	}
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+out:
+	spin_unlock(&po->sk.sk_receive_queue.lock);
+}
+
+/*
+ * Default block timeout: the time the link needs to fill a block at
+ * line rate, falling back to DEFAULT_PRB_RETIRE_TOV when the speed is
+ * unknown.
+ */
+static unsigned int prb_calc_retire_blk_tmo(struct packet_sock *po,
+		unsigned int blk_size)
+{
+	struct ethtool_cmd ecmd = { .cmd = ETHTOOL_GSET };
+	struct net_device *dev;
+	unsigned int tmo;
+	u32 speed = 0;
+
+	rtnl_lock();
+	dev = __dev_get_by_index(sock_net(&po->sk), po->ifindex);
+	if (dev && dev->ethtool_ops && dev->ethtool_ops->get_settings &&
+	    !dev->ethtool_ops->get_settings(dev, &ecmd))
+		speed = ethtool_cmd_speed(&ecmd);
+	rtnl_unlock();
+
+	/* speed is in Mb/s, i.e. 125 * speed bytes per msec */
+	if (!speed || speed > 100000)
+		return DEFAULT_PRB_RETIRE_TOV;
+	tmo = blk_size / (125 * speed);
+	return tmo ? tmo : 1;
+}
+
+static void prb_init_blk_queue(struct packet_sock *po, char **pg_vec,
+		struct tpacket_req3 *req3, unsigned int retire_blk_tov)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+
+	memset(pkc, 0, sizeof(*pkc));
+	pkc->pkbdq = pg_vec;
+	pkc->knum_blocks = req3->tp_block_nr;
+	pkc->kblk_size = req3->tp_block_size;
+	pkc->blk_sizeof_priv = req3->tp_sizeof_priv;
+	pkc->feature_req_word = req3->tp_feature_req_word;
+	pkc->knxt_seq_num = 1;
+	pkc->retire_blk_tov = retire_blk_tov;
+	pkc->tov_in_jiffies = msecs_to_jiffies(retire_blk_tov);
+	setup_timer(&pkc->retire_blk_timer, prb_retire_rx_blk_timer_expired,
+		    (unsigned long)po);
+	po->tp_freeze_q_cnt = 0;
+
+	prb_open_block(pkc, prb_block(pkc, 0));
+}
+
+static void prb_shutdown_retire_blk_timer(struct packet_sock *po,
+		struct sk_buff_head *rb_queue)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+
+	spin_lock_bh(&rb_queue->lock);
+	pkc->delete_blk_timer = 1;
+	spin_unlock_bh(&rb_queue->lock);
+
+	del_timer_sync(&pkc->retire_blk_timer);
+}
+
 #endif
 
 static inline struct packet_sock *pkt_sk(struct sock *sk)
@@ -332,6 +629,232 @@ static void packet_sock_destruct(struct sock *sk)
 	sk_refcnt_debug_dec(sk);
 }
 
+static void __fanout_link(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+
+	spin_lock(&f->lock);
+	f->arr[f->num_members] = sk;
+	smp_wmb();
+	f->num_members++;
+	spin_unlock(&f->lock);
+}
+
+static void __fanout_unlink(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+	int i;
+
+	spin_lock(&f->lock);
+	for (i = 0; i < f->num_members; i++) {
+		if (f->arr[i] == sk)
+			break;
+	}
+	BUG_ON(i >= f->num_members);
+	f->arr[i] = f->arr[f->num_members - 1];
+	f->num_members--;
+	spin_unlock(&f->lock);
+}
+
+/*
+ * The protocol hook of a socket is either registered on its own, or,
+ * for a fanout member, stands for its slot in the group.  Both must be
+ * called with po->bind_lock held, or before the socket is visible.
+ */
+static void register_prot_hook(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (!po->running) {
+		if (po->fanout)
+			__fanout_link(sk, po);
+		else
+			dev_add_pack(&po->prot_hook);
+		sock_hold(sk);
+		po->running = 1;
+	}
+}
+
+static void __unregister_prot_hook(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	po->running = 0;
+	if (po->fanout)
+		__fanout_unlink(sk, po);
+	else
+		__dev_remove_pack(&po->prot_hook);
+	__sock_put(sk);
+}
+
+static DEFINE_MUTEX(fanout_mutex);
+static LIST_HEAD(fanout_list);
+
+static struct sock *fanout_demux_hash(struct packet_fanout *f,
+				      struct sk_buff *skb, unsigned int num)
+{
+	u32 hash;
+
+	/* The skb is shared with the other taps: use the cached hash, or
+	 * compute it without pulling anything (data is not at the network
+	 * header for outgoing packets).
+	 */
+	hash = skb->rxhash;
+	if (!hash)
+		hash = skb_flow_hash(skb, skb_network_offset(skb));
+
+	return f->arr[((u64)hash * num) >> 32];
+}
+
+static struct sock *fanout_demux_lb(struct packet_fanout *f,
+				    struct sk_buff *skb, unsigned int num)
+{
+	int cur, old, next;
+
+	cur = atomic_read(&f->rr_cur);
+	for (;;) {
+		next = cur + 1 < num ? cur + 1 : 0;
+		old = atomic_cmpxchg(&f->rr_cur, cur, next);
+		if (old == cur)
+			break;
+		cur = old;
+	}
+	/* a member may have left since rr_cur was last moved */
+	return f->arr[cur < num ? cur : 0];
+}
+
+static struct sock *fanout_demux_cpu(struct packet_fanout *f,
+				     struct sk_buff *skb, unsigned int num)
+{
+	return f->arr[smp_processor_id() % num];
+}
+
+static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
+			     struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct packet_fanout *f = pt->af_packet_priv;
+	unsigned int num = f->num_members;
+	struct packet_sock *po;
+	struct sock *sk;
+
+	if (dev_net(dev) != read_pnet(&f->net) || !num) {
+		kfree_skb(skb);
+		return 0;
+	}
+	smp_rmb();
+
+	switch (f->type) {
+	case PACKET_FANOUT_HASH:
+	default:
+		sk = fanout_demux_hash(f, skb, num);
+		break;
+	case PACKET_FANOUT_LB:
+		sk = fanout_demux_lb(f, skb, num);
+		break;
+	case PACKET_FANOUT_CPU:
+		sk = fanout_demux_cpu(f, skb, num);
+		break;
+	}
+
+	po = pkt_sk(sk);
+	return po->prot_hook.func(skb, dev, &po->prot_hook, orig_dev);
+}
+
+static int fanout_add(struct sock *sk, u16 id, u16 type)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f, *match;
+	int err;
+
+	switch (type) {
+	case PACKET_FANOUT_HASH:
+	case PACKET_FANOUT_LB:
+	case PACKET_FANOUT_CPU:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (po->fanout)
+		return -EALREADY;
+
+	mutex_lock(&fanout_mutex);
+	match = NULL;
+	list_for_each_entry(f, &fanout_list, list) {
+		if (f->id == id &&
+		    read_pnet(&f->net) == sock_net(sk)) {
+			match = f;
+			break;
+		}
+	}
+	if (!match) {
+		err = -ENOMEM;
+		match = kzalloc(sizeof(*match), GFP_KERNEL);
+		if (!match)
+			goto out;
+		write_pnet(&match->net, sock_net(sk));
+		match->id = id;
+		match->type = type;
+		atomic_set(&match->rr_cur, 0);
+		INIT_LIST_HEAD(&match->list);
+		spin_lock_init(&match->lock);
+		atomic_set(&match->sk_ref, 0);
+		match->prot_hook.type = po->prot_hook.type;
+		match->prot_hook.dev = po->prot_hook.dev;
+		match->prot_hook.func = packet_rcv_fanout;
+		match->prot_hook.af_packet_priv = match;
+		dev_add_pack(&match->prot_hook);
+		list_add(&match->list, &fanout_list);
+	}
+
+	/* Only bound sockets of the same protocol and device may join. */
+	err = -EINVAL;
+	spin_lock(&po->bind_lock);
+	if (po->running && !po->fanout &&
+	    match->type == type &&
+	    match->prot_hook.type == po->prot_hook.type &&
+	    match->prot_hook.dev == po->prot_hook.dev) {
+		err = -ENOSPC;
+		if (atomic_read(&match->sk_ref) < PACKET_FANOUT_MAX) {
+			__dev_remove_pack(&po->prot_hook);
+			po->fanout = match;
+			atomic_inc(&match->sk_ref);
+			__fanout_link(sk, po);
+			err = 0;
+		}
+	}
+	spin_unlock(&po->bind_lock);
+
+	if (err && !atomic_read(&match->sk_ref)) {
+		list_del(&match->list);
+		dev_remove_pack(&match->prot_hook);
+		kfree(match);
+	}
+out:
+	mutex_unlock(&fanout_mutex);
+	return err;
+}
+
+static void fanout_release(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f;
+
+	f = po->fanout;
+	if (!f)
+		return;
+
+	po->fanout = NULL;
+
+	mutex_lock(&fanout_mutex);
+	if (atomic_dec_and_test(&f->sk_ref)) {
+		list_del(&f->list);
+		dev_remove_pack(&f->prot_hook);
+		kfree(f);
+	}
+	mutex_unlock(&fanout_mutex);
+}
+
 
 static const struct proto_ops packet_ops;
 
@@ -656,6 +1179,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} h;
 	u8 *skb_head = skb->data;
@@ -726,10 +1250,17 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
-	if (!h.raw)
-		goto ring_is_full;
-	packet_increment_head(&po->rx_ring);
+	if (po->tp_version == TPACKET_V3) {
+		h.raw = prb_lookup_frame_in_block(po, macoff + snaplen);
+		if (!h.raw)
+			goto ring_is_full;
+	} else {
+		h.raw = packet_current_frame(po, &po->rx_ring,
+					     TP_STATUS_KERNEL);
+		if (!h.raw)
+			goto ring_is_full;
+		packet_increment_head(&po->rx_ring);
+	}
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -770,6 +1301,27 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		h.h2->tp_padding = 0;
 		hdrlen = sizeof(*h.h2);
 		break;
+	case TPACKET_V3:
+		/* tp_next_offset was set when the frame was claimed */
+		h.h3->tp_status = status;
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		if (skb->tstamp.tv64)
+			ts = ktime_to_timespec(skb->tstamp);
+		else
+			getnstimeofday(&ts);
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		if (po->rx_ring.prb_bdqc.feature_req_word &
+		    TP_FT_REQ_FILL_RXHASH)
+			h.h3->hv1.tp_rxhash = skb->rxhash;
+		else
+			h.h3->hv1.tp_rxhash = 0;
+		h.h3->hv1.tp_vlan_tci = skb->vlan_tci;
+		hdrlen = sizeof(*h.h3);
+		break;
 	default:
 		BUG();
 	}
@@ -785,7 +1337,8 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	else
 		sll->sll_ifindex = dev->ifindex;
 
-	__packet_set_status(po, h.raw, status);
+	if (po->tp_version != TPACKET_V3)
+		__packet_set_status(po, h.raw, status);
 	smp_mb();
 	{
 		struct page *p_start, *p_end;
@@ -799,7 +1352,11 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		}
 	}
 
-	sk->sk_data_ready(sk, 0);
+	/* TPACKET_V3 wakes user space up only when a block is retired */
+	if (po->tp_version == TPACKET_V3)
+		atomic_dec(&po->rx_ring.prb_bdqc.blk_fill_in_prog);
+	else
+		sk->sk_data_ready(sk, 0);
 
 drop_n_restore:
 	if (skb_head != skb->data && skb_shared(skb)) {
@@ -1178,7 +1735,7 @@ static int packet_release(struct socket *sock)
 	struct packet_sock *po;
 	struct net *net;
 #ifdef CONFIG_PACKET_MMAP
-	struct tpacket_req req;
+	union tpacket_req_u req_u;
 #endif
 
 	if (!sk)
@@ -1196,28 +1753,31 @@ static int packet_release(struct socket *sock)
 	 *	Unhook packet receive handler.
 	 */
 
+	spin_lock(&po->bind_lock);
 	if (po->running) {
 		/*
 		 *	Remove the protocol hook
 		 */
-		dev_remove_pack(&po->prot_hook);
-		po->running = 0;
+		__unregister_prot_hook(sk);
 		po->num = 0;
-		__sock_put(sk);
 	}
+	spin_unlock(&po->bind_lock);
+	synchronize_net();
 
 	packet_flush_mclist(sk);
 
 #ifdef CONFIG_PACKET_MMAP
-	memset(&req, 0, sizeof(req));
+	memset(&req_u, 0, sizeof(req_u));
 
 	if (po->rx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 0);
+		packet_set_ring(sk, &req_u, 1, 0);
 
 	if (po->tx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 1);
+		packet_set_ring(sk, &req_u, 1, 1);
 #endif
 
+	fanout_release(sk);
+
 	/*
 	 *	Now the socket is dead. No more input will appear.
 	 */
@@ -1241,6 +1801,11 @@ static int packet_release(struct socket *sock)
 static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protocol)
 {
 	struct packet_sock *po = pkt_sk(sk);
+
+	/* A fanout member is bound through its group. */
+	if (po->fanout)
+		return -EINVAL;
+
 	/*
 	 *	Detach an existing hook if present.
 	 */
@@ -1249,11 +1814,10 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 
 	spin_lock(&po->bind_lock);
 	if (po->running) {
-		__sock_put(sk);
-		po->running = 0;
+		__unregister_prot_hook(sk);
 		po->num = 0;
 		spin_unlock(&po->bind_lock);
-		dev_remove_pack(&po->prot_hook);
+		synchronize_net();
 		spin_lock(&po->bind_lock);
 	}
 
@@ -1267,9 +1831,7 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 		goto out_unlock;
 
 	if (!dev || (dev->flags & IFF_UP)) {
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	} else {
 		sk->sk_err = ENETDOWN;
 		if (!sock_flag(sk, SOCK_DEAD))
@@ -1399,9 +1961,7 @@ static int packet_create(struct net *net, struct socket *sock, int protocol)
 
 	if (proto) {
 		po->prot_hook.type = proto;
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	}
 
 	write_lock_bh(&net->packet.sklist_lock);
@@ -1745,13 +2305,19 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 	case PACKET_RX_RING:
 	case PACKET_TX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen < sizeof(req))
+		if (po->tp_version == TPACKET_V3)
+			len = sizeof(req_u.req3);
+		else
+			len = sizeof(req_u.req);
+		if (optlen < len)
 			return -EINVAL;
-		if (copy_from_user(&req, optval, sizeof(req)))
+		if (copy_from_user(&req_u, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
+		return packet_set_ring(sk, &req_u, 0,
+				       optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1778,6 +2344,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		switch (val) {
 		case TPACKET_V1:
 		case TPACKET_V2:
+		case TPACKET_V3:
 			po->tp_version = val;
 			return 0;
 		default:
@@ -1835,6 +2402,17 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->origdev = !!val;
 		return 0;
 	}
+	case PACKET_FANOUT:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		return fanout_add(sk, val & 0xffff, val >> 16);
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1849,6 +2427,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
 	struct tpacket_stats st;
+#ifdef CONFIG_PACKET_MMAP
+	struct tpacket_stats_v3 st3;
+#endif
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -1861,14 +2442,28 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch (optname) {
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
-			len = sizeof(struct tpacket_stats);
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		st = po->stats;
 		memset(&po->stats, 0, sizeof(st));
+#ifdef CONFIG_PACKET_MMAP
+		st3.tp_freeze_q_cnt = po->tp_freeze_q_cnt;
+		po->tp_freeze_q_cnt = 0;
+#endif
 		spin_unlock_bh(&sk->sk_receive_queue.lock);
 		st.tp_packets += st.tp_drops;
 
+#ifdef CONFIG_PACKET_MMAP
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(st3))
+				len = sizeof(st3);
+			st3.tp_packets = st.tp_packets;
+			st3.tp_drops = st.tp_drops;
+			data = &st3;
+			break;
+		}
+#endif
+		if (len > sizeof(struct tpacket_stats))
+			len = sizeof(struct tpacket_stats);
 		data = &st;
 		break;
 	case PACKET_AUXDATA:
@@ -1883,6 +2478,16 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 			len = sizeof(int);
 		val = po->origdev;
 
+		data = &val;
+		break;
+	case PACKET_FANOUT:
+		if (len > sizeof(int))
+			len = sizeof(int);
+		val = (po->fanout ?
+		       ((u32)po->fanout->id |
+			((u32)po->fanout->type << 16)) :
+		       0);
+
 		data = &val;
 		break;
 #ifdef CONFIG_PACKET_MMAP
@@ -1904,6 +2509,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		case TPACKET_V2:
 			val = sizeof(struct tpacket2_hdr);
 			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -1955,9 +2563,7 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
 				if (po->running) {
-					__dev_remove_pack(&po->prot_hook);
-					__sock_put(sk);
-					po->running = 0;
+					__unregister_prot_hook(sk);
 					sk->sk_err = ENETDOWN;
 					if (!sock_flag(sk, SOCK_DEAD))
 						sk->sk_error_report(sk);
@@ -1971,12 +2577,8 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 			break;
 		case NETDEV_UP:
 			spin_lock(&po->bind_lock);
-			if (dev->ifindex == po->ifindex && po->num &&
-			    !po->running) {
-				dev_add_pack(&po->prot_hook);
-				sock_hold(sk);
-				po->running = 1;
-			}
+			if (dev->ifindex == po->ifindex && po->num)
+				register_prot_hook(sk);
 			spin_unlock(&po->bind_lock);
 			break;
 		}
@@ -2055,7 +2657,14 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
 	if (po->rx_ring.pg_vec) {
-		if (!packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
+		if (po->tp_version == TPACKET_V3) {
+			struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+
+			if (prb_blk_in_use(prb_block(pkc,
+						     prb_previous_blk_num(pkc))))
+				mask |= POLLIN | POLLRDNORM;
+		} else if (!packet_previous_frame(po, &po->rx_ring,
+						  TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
@@ -2141,14 +2750,16 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
 	char **pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
+	struct tpacket_req *req = &req_u->req;
 	int was_running, order = 0;
 	struct packet_ring_buffer *rb;
 	struct sk_buff_head *rb_queue;
+	unsigned int retire_blk_tov = 0;
 	__be16 num;
 	int err;
 
@@ -2176,6 +2787,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		case TPACKET_V2:
 			po->tp_hdrlen = TPACKET2_HDRLEN;
 			break;
+		case TPACKET_V3:
+			po->tp_hdrlen = TPACKET3_HDRLEN;
+			break;
 		}
 
 		err = -EINVAL;
@@ -2196,6 +2810,26 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 					req->tp_frame_nr))
 			goto out;
 
+		if (po->tp_version == TPACKET_V3) {
+			struct tpacket_req3 *req3 = &req_u->req3;
+
+			/* Blocks are only handed out on the rx side. */
+			if (unlikely(tx_ring))
+				goto out;
+			/* A frame of tp_frame_size must fit in an empty block. */
+			if (unlikely(req3->tp_sizeof_priv >=
+				     req3->tp_block_size ||
+				     BLK_PLUS_PRIV(req3->tp_sizeof_priv) +
+				     req3->tp_frame_size >
+				     req3->tp_block_size))
+				goto out;
+
+			retire_blk_tov = req3->tp_retire_blk_tov;
+			if (!retire_blk_tov)
+				retire_blk_tov = prb_calc_retire_blk_tmo(po,
+						req3->tp_block_size);
+		}
+
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
 		pg_vec = alloc_pg_vec(req, order);
@@ -2216,10 +2850,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	was_running = po->running;
 	num = po->num;
 	if (was_running) {
-		__dev_remove_pack(&po->prot_hook);
 		po->num = 0;
-		po->running = 0;
-		__sock_put(sk);
+		__unregister_prot_hook(sk);
 	}
 	spin_unlock(&po->bind_lock);
 
@@ -2229,12 +2861,17 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_lock(&po->pg_vec_lock);
 	if (closing || atomic_read(&po->mapped) == 0) {
 		err = 0;
+		if (!tx_ring && rb->pg_vec && po->tp_version == TPACKET_V3)
+			prb_shutdown_retire_blk_timer(po, rb_queue);
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 		spin_lock_bh(&rb_queue->lock);
 		pg_vec = XC(rb->pg_vec, pg_vec);
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
+		if (!tx_ring && rb->pg_vec && po->tp_version == TPACKET_V3)
+			prb_init_blk_queue(po, rb->pg_vec, &req_u->req3,
+					   retire_blk_tov);
 		spin_unlock_bh(&rb_queue->lock);
 
 		order = XC(rb->pg_vec_order, order);
@@ -2252,11 +2889,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_unlock(&po->pg_vec_lock);
 
 	spin_lock(&po->bind_lock);
-	if (was_running && !po->running) {
-		sock_hold(sk);
-		po->running = 1;
+	if (was_running) {
 		po->num = num;
-		dev_add_pack(&po->prot_hook);
+		register_prot_hook(sk);
 	}
 	spin_unlock(&po->bind_lock);
 